@@ -19,25 +19,244 @@
  */
 
 #include "canvas-region-snapshot.h"
+#include "utils/damage.h"
 
+static gsize
+get_surface_size (cairo_surface_t *surface)
+{
+  return (gsize) cairo_image_surface_get_stride (surface) * cairo_image_surface_get_height (surface);
+}
+
+/**
+ * Returns the bytes taken in the spill file by each of before and after.
+ */
+static gsize
+get_spilled_surface_size (CanvasRegionSnapshot *self)
+{
+  return (gsize) cairo_format_stride_for_width (CAIRO_FORMAT_RGB24, self->area.width) * self->area.height;
+}
+
+/**
+ * A snapshot that does not change any pixel, used for the first state of the image.
+ */
 CanvasRegionSnapshot *
-canvas_region_snapshot_new (gint             width,
-                            gint             height,
-                            gboolean         is_current_file_saved,
-                            cairo_surface_t *surface)
+canvas_region_snapshot_new (gint     width,
+                            gint     height,
+                            gboolean is_current_file_saved)
 {
   CanvasRegionSnapshot *obj;
   obj = g_malloc (sizeof (CanvasRegionSnapshot));
   obj->width = width;
   obj->height = height;
   obj->is_current_file_saved = is_current_file_saved;
-  obj->surface = surface;
+  obj->area.x = 0;
+  obj->area.y = 0;
+  obj->area.width = 0;
+  obj->area.height = 0;
+  obj->before = NULL;
+  obj->after = NULL;
+  obj->spill_file = NULL;
+  obj->before_offset = 0;
+  obj->after_offset = 0;
+  obj->tile_store_before = NULL;
+  obj->tile_store_after = NULL;
+  obj->size = sizeof (CanvasRegionSnapshot);
+  return obj;
+}
+
+/**
+ * Takes ownership of before and after, which hold the pixels inside area.
+ */
+CanvasRegionSnapshot *
+canvas_region_snapshot_new_from_change (gint             width,
+                                        gint             height,
+                                        gboolean         is_current_file_saved,
+                                        GdkRectangle    *area,
+                                        cairo_surface_t *before,
+                                        cairo_surface_t *after)
+{
+  CanvasRegionSnapshot *obj;
+  obj = canvas_region_snapshot_new (width, height, is_current_file_saved);
+  obj->area = *area;
+  obj->before = before;
+  obj->after = after;
+  obj->size += get_surface_size (before) + get_surface_size (after);
+
+  // So they can be painted on the store as they are
+  cairo_surface_set_device_offset (before, -area->x, -area->y);
+  cairo_surface_set_device_offset (after, -area->x, -area->y);
+
+  return obj;
+}
+
+/**
+ * Takes ownership of both stores, they are expected to share the tiles that did
+ * not change.
+ */
+CanvasRegionSnapshot *
+canvas_region_snapshot_new_from_resize (gboolean   is_current_file_saved,
+                                        TileStore *tile_store_before,
+                                        TileStore *tile_store_after)
+{
+  CanvasRegionSnapshot *obj;
+  obj = canvas_region_snapshot_new (tile_store_get_width (tile_store_after),
+                                    tile_store_get_height (tile_store_after),
+                                    is_current_file_saved);
+  obj->tile_store_before = tile_store_before;
+  obj->tile_store_after = tile_store_after;
+  obj->size += tile_store_get_unshared_size (tile_store_before, NULL) +
+               tile_store_get_unshared_size (tile_store_after, tile_store_before);
   return obj;
 }
 
 void
 canvas_region_snapshot_dispose (CanvasRegionSnapshot *self)
 {
-  cairo_surface_destroy (self->surface);
+  // In the reverse order of the writes, so the file can shrink
+  if (self->spill_file != NULL)
+    {
+      spill_file_discard (self->spill_file, self->after_offset, get_spilled_surface_size (self));
+      spill_file_discard (self->spill_file, self->before_offset, get_spilled_surface_size (self));
+    }
+
+  g_clear_pointer (&self->before, cairo_surface_destroy);
+  g_clear_pointer (&self->after, cairo_surface_destroy);
+  g_clear_pointer (&self->tile_store_before, tile_store_dispose);
+  g_clear_pointer (&self->tile_store_after, tile_store_dispose);
   g_free (self);
 }
+
+/**
+ * Only the pixels of changed areas can be spilled, resizes share their tiles with
+ * the other snapshots.
+ */
+gboolean
+canvas_region_snapshot_can_spill (CanvasRegionSnapshot *self)
+{
+  return self->before != NULL;
+}
+
+/**
+ * Writes the pixels to the spill file and frees them, they are mapped back when
+ * the snapshot is reverted or applied. Returns false if nothing was spilled.
+ */
+gboolean
+canvas_region_snapshot_spill (CanvasRegionSnapshot *self,
+                              SpillFile            *spill_file)
+{
+  if (!canvas_region_snapshot_can_spill (self))
+    return false;
+
+  if (!spill_file_write_surface (spill_file, self->before, &self->before_offset) ||
+      !spill_file_write_surface (spill_file, self->after, &self->after_offset))
+    return false;
+
+  self->size -= get_surface_size (self->before) + get_surface_size (self->after);
+  self->spill_file = spill_file;
+  g_clear_pointer (&self->before, cairo_surface_destroy);
+  g_clear_pointer (&self->after, cairo_surface_destroy);
+
+  return true;
+}
+
+/**
+ * Returns the bytes this snapshot takes in its spill file.
+ */
+gsize
+canvas_region_snapshot_get_spill_size (CanvasRegionSnapshot *self)
+{
+  return self->spill_file == NULL ? 0 : 2 * get_spilled_surface_size (self);
+}
+
+/**
+ * Writes the spilled pixels again to spill_file and sets where they start in it,
+ * the snapshot keeps using its own file until the caller moves it to the new one.
+ */
+gboolean
+canvas_region_snapshot_copy_spill (CanvasRegionSnapshot *self,
+                                   SpillFile            *spill_file,
+                                   goffset              *before_offset,
+                                   goffset              *after_offset)
+{
+  cairo_surface_t *before;
+  cairo_surface_t *after;
+  gboolean is_copied;
+
+  g_return_val_if_fail (self->spill_file != NULL, false);
+
+  before = spill_file_map_surface (self->spill_file, self->before_offset,
+                                   self->area.width, self->area.height);
+  after = spill_file_map_surface (self->spill_file, self->after_offset,
+                                  self->area.width, self->area.height);
+
+  is_copied = before != NULL && after != NULL &&
+              spill_file_write_surface (spill_file, before, before_offset) &&
+              spill_file_write_surface (spill_file, after, after_offset);
+
+  g_clear_pointer (&before, cairo_surface_destroy);
+  g_clear_pointer (&after, cairo_surface_destroy);
+
+  return is_copied;
+}
+
+/**
+ * Paints pixels, or the pixels spilled at offset if it was spilled, on tile_store.
+ */
+static void
+paint_pixels (CanvasRegionSnapshot *self,
+              cairo_surface_t      *pixels,
+              goffset               offset,
+              TileStore            *tile_store)
+{
+  if (self->spill_file == NULL)
+    {
+      tile_store_paint_surface (tile_store, pixels, &self->area);
+      return;
+    }
+
+  pixels = spill_file_map_surface (self->spill_file, offset, self->area.width, self->area.height);
+
+  if (pixels == NULL)
+    return;
+
+  cairo_surface_set_device_offset (pixels, -self->area.x, -self->area.y);
+  tile_store_paint_surface (tile_store, pixels, &self->area);
+  cairo_surface_destroy (pixels);
+}
+
+/**
+ * Brings tile_store back to the state before the change, tile_store may be
+ * replaced.
+ */
+void
+canvas_region_snapshot_revert (CanvasRegionSnapshot  *self,
+                               TileStore            **tile_store)
+{
+  if (self->tile_store_before != NULL)
+    {
+      tile_store_dispose (*tile_store);
+      *tile_store = tile_store_copy (self->tile_store_before);
+    }
+  else if (!damage_is_empty (&self->area))
+    {
+      paint_pixels (self, self->before, self->before_offset, *tile_store);
+    }
+}
+
+/**
+ * Does the change again on tile_store, tile_store may be replaced.
+ */
+void
+canvas_region_snapshot_apply (CanvasRegionSnapshot  *self,
+                              TileStore            **tile_store)
+{
+  if (self->tile_store_after != NULL)
+    {
+      tile_store_dispose (*tile_store);
+      *tile_store = tile_store_copy (self->tile_store_after);
+    }
+  else if (!damage_is_empty (&self->area))
+    {
+      paint_pixels (self, self->after, self->after_offset, *tile_store);
+    }
+}
@@ -17,21 +17,65 @@
  *
  * SPDX-License-Identifier: GPL-3.0-or-later
  */
-
 #pragma once
 
 #include <gtk/gtk.h>
 
+#include "utils/spill-file.h"
+#include "utils/tile-store.h"
+
+/* A snapshot is the state of the image after a change, it keeps what the change
+ * did so it can be reverted and applied again. Small changes keep the pixels of
+ * the changed area before and after them, changes of the image size keep both
+ * images. */
 typedef struct _CanvasRegionSnapshot {
   gint             width;
   gint             height;
   gboolean         is_current_file_saved;
-  cairo_surface_t *surface;
+
+  /* Changed area, empty when the change did not touch any pixel */
+  GdkRectangle     area;
+  cairo_surface_t *before;
+  cairo_surface_t *after;
+
+  /* Set once before and after are written to a spill file and freed */
+  SpillFile       *spill_file;
+  goffset          before_offset;
+  goffset          after_offset;
+
+  /* Size change, NULL for the other changes */
+  TileStore       *tile_store_before;
+  TileStore       *tile_store_after;
+
+  /* Bytes held in memory by this snapshot */
+  gsize            size;
 } CanvasRegionSnapshot;
 
-CanvasRegionSnapshot *canvas_region_snapshot_new     (gint                 width,
-                                                      gint                 height,
-                                                      gboolean             is_current_file_saved,
-                                                      cairo_surface_t     *surface);
+CanvasRegionSnapshot *canvas_region_snapshot_new             (gint                  width,
+                                                              gint                  height,
+                                                              gboolean              is_current_file_saved);
+CanvasRegionSnapshot *canvas_region_snapshot_new_from_change (gint                  width,
+                                                              gint                  height,
+                                                              gboolean              is_current_file_saved,
+                                                              GdkRectangle         *area,
+                                                              cairo_surface_t      *before,
+                                                              cairo_surface_t      *after);
+CanvasRegionSnapshot *canvas_region_snapshot_new_from_resize (gboolean              is_current_file_saved,
+                                                              TileStore            *tile_store_before,
+                                                              TileStore            *tile_store_after);
+
+void                  canvas_region_snapshot_dispose         (CanvasRegionSnapshot *self);
+
+gboolean              canvas_region_snapshot_can_spill       (CanvasRegionSnapshot *self);
+gboolean              canvas_region_snapshot_spill           (CanvasRegionSnapshot *self,
+                                                              SpillFile            *spill_file);
+gsize                 canvas_region_snapshot_get_spill_size  (CanvasRegionSnapshot *self);
+gboolean              canvas_region_snapshot_copy_spill      (CanvasRegionSnapshot *self,
+                                                              SpillFile            *spill_file,
+                                                              goffset              *before_offset,
+                                                              goffset              *after_offset);
 
-void                  canvas_region_snapshot_dispose (CanvasRegionSnapshot *self);
+void                  canvas_region_snapshot_revert          (CanvasRegionSnapshot *self,
+                                                              TileStore           **tile_store);
+void                  canvas_region_snapshot_apply           (CanvasRegionSnapshot *self,
+                                                              TileStore           **tile_store);
@@ -27,7 +27,9 @@
 #include "drawing-tools/circle.h"
 #include "drawing-tools/color-picker.h"
 #include "drawing-tools/fill.h"
+#include "drawing-tools/lasso.h"
 #include "drawing-tools/line.h"
+#include "drawing-tools/magic-wand.h"
 #include "drawing-tools/rectangle.h"
 #include "drawing-tools/select.h"
 #include "drawing-tools/text.h"
@@ -35,6 +37,11 @@
 #include "utils/cairo-utils.h"
 #include "utils/canvas-region-caretaker.h"
 #include "utils/colors.h"
+#include "utils/damage.h"
+#include "utils/region-labels.h"
+#include "utils/resample.h"
+#include "utils/selection-mask.h"
+#include "utils/tile-store.h"
 
 enum {
   SAVE_STATUS_CHANGE,
@@ -42,6 +49,7 @@ enum {
   // TODO: remove the D from the name
   COLOR_PICKED,
   TOOL_CHANGE,
+  FILL_PROGRESS,
   NUMBER_OF_SIGNALS
 };
 
@@ -62,10 +70,36 @@ struct _CanvasRegion
 
   /* Draw */
   DrawEvent              draw_event;
-  cairo_surface_t       *cairo_surface;
-  cairo_surface_t       *cairo_surface_save;
+  TileStore             *tile_store;
   DRAWING_TOOL_TYPE      current_tool_type;
 
+  /* Damage tracking */
+  GdkRectangle           previous_damage;
+  GdkRectangle           change_area;
+  gsize                  bytes_copied;
+
+  /* Drag offsets received since the last frame, with the compressed motion
+   * history for tools that save while drawing. They keep their fractions so
+   * the curve through them is not snapped to whole pixels. */
+  GArray                *pending_samples;
+  guint                  tick_callback_id;
+  PrecisePoint           precise_drag_start;
+
+  /* Sample drawn before the last drawn point, it shapes the curve to the next one */
+  PrecisePoint           point_before_last_drawn;
+
+  /* Preview, drawn over the image until it is committed */
+  cairo_surface_t       *preview;
+  GdkRectangle           preview_area;
+
+  /* Fill running on a worker thread, the progress belongs to the fill */
+  GCancellable          *fill_cancellable;
+  FloodFillProgress     *fill_progress;
+  guint                  fill_progress_source_id;
+
+  /* Regions of the image for the fills, lent to the running fill */
+  RegionLabels          *region_labels;
+
   /* Callbacks */
   on_draw_start_click    draw_start_click_cb;
   on_draw                draw_cb;
@@ -76,10 +110,35 @@ struct _CanvasRegion
   gchar                 *current_filename;
   gboolean               is_current_file_saved;
   gboolean               save_while_drawing;
+  gboolean               draw_on_preview;
 
   CanvasRegionCaretaker *caretaker;
+  GSettings             *settings;
   GdkRectangle           selection_rectangle;
   GdkRectangle           selection_destination;
+  GdkRectangle           selection_outline;
+
+  /* The selected pixels when the selection is not the whole selection
+   * rectangle, which is then their bounding box */
+  SelectionMask         *selection_mask;
+
+  /* Points of the lasso being drawn, it is only stroked over the image until
+   * the drag ends and the pixels inside it are selected */
+  GArray                *lasso_points;
+
+  /* Pixels lifted from the selection while it is dragged, they are drawn over
+   * the image at the selection destination until the move is committed */
+  cairo_surface_t       *floating_selection;
+  cairo_surface_t       *floating_mask;
+  GdkRectangle           floating_source;
+
+  /* The floating pixels were pasted rather than lifted, so nothing is left
+   * behind them and they float until they are dragged or clicked away from */
+  gboolean               is_floating_pasted;
+
+  /* The floating pixels are scaled to the size of the destination and rotated
+   * by this angle, in radians, around its center */
+  gdouble                selection_angle;
 };
 
 static void
@@ -96,20 +155,263 @@ static gdouble SELECTION_DASH_PATTERN[] = { 6 };
 static gint    SELECTION_LINE_WIDTH = 6;
 static gint    NUM_DASHES = 1;
 static gdouble DASH_OFFSET = 0;
+static gint    LASSO_LINE_WIDTH = 2;
+
+// Selection handles, in pixels
+static gdouble HANDLE_SIZE = 10;
+static gdouble ROTATE_HANDLE_DISTANCE = 24;
+
+// Milliseconds between two updates of the fill progress
+static guint FILL_PROGRESS_INTERVAL = 100;
+
+// Strokes follow a curve through the samples in pieces of about this many pixels
+static gdouble CURVE_PIECE_LENGTH = 4;
+static gint    MAX_CURVE_PIECES = 32;
 
 static void
-destroy_current_surface (CanvasRegion *self)
+drop_pending_samples (CanvasRegion *self)
 {
-  if (self->cairo_surface == NULL)
+  if (self->tick_callback_id != 0)
+    {
+      gtk_widget_remove_tick_callback (GTK_WIDGET (self->drawing_area), self->tick_callback_id);
+      self->tick_callback_id = 0;
+    }
+
+  g_array_set_size (self->pending_samples, 0);
+}
+
+/**
+ * Stops watching the running fill and hides its progress, the fill may still
+ * end later but its result is ignored.
+ */
+static void
+cancel_fill (CanvasRegion *self)
+{
+  if (self->fill_cancellable == NULL)
     return;
 
-  cairo_surface_destroy (self->cairo_surface);
-  self->cairo_surface = NULL;
+  g_cancellable_cancel (self->fill_cancellable);
+  g_clear_object (&self->fill_cancellable);
+  g_clear_handle_id (&self->fill_progress_source_id, g_source_remove);
+  self->fill_progress = NULL;
+
+  g_signal_emit (self, canvas_region_signals[FILL_PROGRESS], 0, -1.0);
+}
+
+static void
+clear_preview (CanvasRegion *self)
+{
+  g_clear_pointer (&self->preview, cairo_surface_destroy);
+  damage_reset (&self->preview_area);
+}
+
+static gboolean
+is_selection_tool (CanvasRegion *self)
+{
+  return self->current_tool_type == SELECT ||
+         self->current_tool_type == MAGIC_WAND ||
+         self->current_tool_type == LASSO;
+}
+
+static void
+clear_floating_selection (CanvasRegion *self)
+{
+  g_clear_pointer (&self->floating_selection, cairo_surface_destroy);
+  g_clear_pointer (&self->floating_mask, cairo_surface_destroy);
+  damage_reset (&self->floating_source);
+  self->selection_angle = 0;
+  self->is_floating_pasted = false;
+}
+
+/**
+ * Gets how far the selection was dragged since it was lifted.
+ */
+static void
+get_floating_offset (CanvasRegion *self,
+                     gint         *offset_x,
+                     gint         *offset_y)
+{
+  if (self->floating_selection == NULL)
+    {
+      *offset_x = 0;
+      *offset_y = 0;
+      return;
+    }
+
+  *offset_x = self->selection_destination.x - self->floating_source.x;
+  *offset_y = self->selection_destination.y - self->floating_source.y;
+}
+
+/**
+ * Draws the floating selection moved to the selection destination, over white
+ * where it was lifted from. Only the selected pixels move when there is a mask.
+ * Pasted pixels are only drawn at the destination.
+ */
+static void
+paint_moved_floating_selection (CanvasRegion *self,
+                                cairo_t      *cr)
+{
+  gint offset_x;
+  gint offset_y;
+
+  if (self->floating_mask == NULL && !self->is_floating_pasted)
+    {
+      cairo_move_rectangle (self->floating_selection, cr,
+                            &self->floating_source, &self->selection_destination);
+      return;
+    }
+
+  get_floating_offset (self, &offset_x, &offset_y);
+
+  cairo_save (cr);
+
+  if (!self->is_floating_pasted)
+    {
+      cairo_set_source_rgb (cr, 1, 1, 1);
+      cairo_mask_surface (cr, self->floating_mask, 0, 0);
+    }
+
+  cairo_set_source_surface (cr, self->floating_selection,
+                            self->selection_destination.x, self->selection_destination.y);
+
+  if (self->floating_mask != NULL)
+    cairo_mask_surface (cr, self->floating_mask, offset_x, offset_y);
+  else
+    cairo_paint (cr);
+
+  cairo_restore (cr);
+}
+
+/**
+ * Gets the transform that draws the floating selection, from its own pixels
+ * to the image.
+ */
+static void
+get_floating_transform (CanvasRegion   *self,
+                        cairo_matrix_t *matrix)
+{
+  GdkRectangle *source = &self->floating_source;
+  GdkRectangle *dest = &self->selection_destination;
+
+  cairo_matrix_init_translate (matrix,
+                               dest->x + dest->width / 2.0,
+                               dest->y + dest->height / 2.0);
+  cairo_matrix_rotate (matrix, self->selection_angle);
+  cairo_matrix_scale (matrix,
+                      dest->width / (gdouble) source->width,
+                      dest->height / (gdouble) source->height);
+  cairo_matrix_translate (matrix, -source->width / 2.0, -source->height / 2.0);
+}
+
+static gboolean
+is_floating_transformed (CanvasRegion *self)
+{
+  return self->selection_angle != 0 ||
+         self->selection_destination.width != self->floating_source.width ||
+         self->selection_destination.height != self->floating_source.height;
+}
+
+/**
+ * Converts a point of the image to the frame of the selection outline, where
+ * the origin is the center of the outline and its sides are not rotated.
+ */
+static void
+image_to_outline (CanvasRegion *self,
+                  gdouble       x,
+                  gdouble       y,
+                  gdouble      *outline_x,
+                  gdouble      *outline_y)
+{
+  gdouble center_x;
+  gdouble center_y;
+  gdouble cosine;
+  gdouble sine;
+
+  center_x = self->selection_outline.x + self->selection_outline.width / 2.0;
+  center_y = self->selection_outline.y + self->selection_outline.height / 2.0;
+  cosine = cos (self->selection_angle);
+  sine = sin (self->selection_angle);
+
+  x -= center_x;
+  y -= center_y;
+
+  *outline_x = x * cosine + y * sine;
+  *outline_y = y * cosine - x * sine;
+}
+
+/**
+ * The inverse of image_to_outline ().
+ */
+static void
+outline_to_image (CanvasRegion *self,
+                  gdouble       outline_x,
+                  gdouble       outline_y,
+                  gdouble      *x,
+                  gdouble      *y)
+{
+  gdouble center_x;
+  gdouble center_y;
+  gdouble cosine;
+  gdouble sine;
+
+  center_x = self->selection_outline.x + self->selection_outline.width / 2.0;
+  center_y = self->selection_outline.y + self->selection_outline.height / 2.0;
+  cosine = cos (self->selection_angle);
+  sine = sin (self->selection_angle);
+
+  *x = center_x + outline_x * cosine - outline_y * sine;
+  *y = center_y + outline_x * sine + outline_y * cosine;
+}
+
+/**
+ * Gets the position of a handle in the frame of the selection outline, index
+ * picks one of the corners for the scale handles.
+ */
+static void
+get_handle_position (CanvasRegion   *self,
+                     SelectionHandle handle,
+                     gint            index,
+                     gdouble        *x,
+                     gdouble        *y)
+{
+  gdouble half_width = self->selection_outline.width / 2.0;
+  gdouble half_height = self->selection_outline.height / 2.0;
+
+  if (handle == SELECTION_HANDLE_ROTATE)
+    {
+      *x = 0;
+      *y = -half_height - ROTATE_HANDLE_DISTANCE;
+    }
+  else
+    {
+      *x = index & 1 ? half_width : -half_width;
+      *y = index & 2 ? half_height : -half_height;
+    }
+}
+
+/**
+ * Drops everything drawn since the last snapshot.
+ */
+static void
+discard_current_changes (CanvasRegion *self)
+{
+  if (tile_store_is_changing (self->tile_store))
+    tile_store_cancel_change (self->tile_store);
+
+  drop_pending_samples (self);
+  cancel_fill (self);
+  clear_preview (self);
+  clear_floating_selection (self);
+  damage_reset (&self->selection_outline);
+  g_clear_pointer (&self->lasso_points, g_array_unref);
+  g_clear_pointer (&self->draw_event.dabs, dab_stroke_dispose);
 }
 
 static void
 reset_selection (CanvasRegion *self)
 {
+  g_clear_pointer (&self->selection_mask, selection_mask_dispose);
+
   self->selection_rectangle.x = 0;
   self->selection_rectangle.y = 0;
   self->selection_rectangle.width = 0;
@@ -122,38 +424,321 @@ reset_selection (CanvasRegion *self)
 }
 
 static void
-create_and_save_snapshot (CanvasRegion *self)
+begin_change (CanvasRegion *self)
+{
+  tile_store_begin_change (self->tile_store);
+  damage_reset (&self->change_area);
+}
+
+/**
+ * Rasterizes the preview into the tile store, if there is any, and saves a
+ * snapshot with the pixels of the changed area before and after the change.
+ */
+static void
+commit_current_changes (CanvasRegion *self)
 {
   CanvasRegionSnapshot *snapshot;
-  cairo_surface_t *copy_surface;
-  copy_surface = cairo_clone_surface (self->cairo_surface_save);
+  cairo_surface_t *before;
+  cairo_surface_t *after;
+
+  if (self->preview != NULL)
+    {
+      if (!tile_store_is_changing (self->tile_store))
+        begin_change (self);
+
+      tile_store_paint_surface (self->tile_store, self->preview, &self->preview_area);
+      damage_add_damage (&self->change_area, &self->preview_area);
+      clear_preview (self);
+    }
+
+  if (tile_store_is_changing (self->tile_store) && !damage_is_empty (&self->change_area))
+    {
+      if (self->region_labels != NULL)
+        region_labels_invalidate (self->region_labels, &self->change_area);
+
+      before = tile_store_flatten_original (self->tile_store, &self->change_area);
+      after = tile_store_flatten (self->tile_store, &self->change_area);
+
+      if (before != NULL && after != NULL)
+        {
+          snapshot = canvas_region_snapshot_new_from_change (self->width,
+                                                             self->height,
+                                                             self->is_current_file_saved,
+                                                             &self->change_area,
+                                                             before,
+                                                             after);
+        }
+      else
+        {
+          // The area is too big for image surfaces, the tiles are shared instead
+          g_clear_pointer (&before, cairo_surface_destroy);
+          g_clear_pointer (&after, cairo_surface_destroy);
+          snapshot = canvas_region_snapshot_new_from_resize (self->is_current_file_saved,
+                                                             tile_store_copy_original (self->tile_store),
+                                                             tile_store_copy (self->tile_store));
+        }
+    }
+  else
+    {
+      snapshot = canvas_region_snapshot_new (self->width,
+                                             self->height,
+                                             self->is_current_file_saved);
+    }
+
+  if (tile_store_is_changing (self->tile_store))
+    tile_store_end_change (self->tile_store);
+
+  g_clear_pointer (&self->draw_event.dabs, dab_stroke_dispose);
 
-  snapshot = canvas_region_snapshot_new (self->width,
-                                         self->height,
-                                         self->is_current_file_saved,
-                                         copy_surface);
   canvas_region_caretaker_save_snapshot (self->caretaker, snapshot);
 }
 
+/**
+ * Prepares the tile store for the next draw call. Tools that do not save while
+ * drawing redraw their whole shape each time, so only the area they touched last
+ * time is restored.
+ */
 static void
-save_and_destroy_current_surface (CanvasRegion *self)
+prepare_for_drawing (CanvasRegion *self)
 {
-   if (self->cairo_surface != NULL)
+  if (!tile_store_is_changing (self->tile_store))
     {
-      cairo_surface_destroy (self->cairo_surface_save);
-      self->cairo_surface_save = cairo_clone_surface (self->cairo_surface);
-      self->width = cairo_image_surface_get_width (self->cairo_surface);
-      self->height = cairo_image_surface_get_height (self->cairo_surface);
-      destroy_current_surface (self);
+      begin_change (self);
+      damage_reset (&self->previous_damage);
+      return;
     }
 
-  create_and_save_snapshot (self);
+  if (!self->save_while_drawing)
+    self->bytes_copied += tile_store_restore_rectangle (self->tile_store, &self->previous_damage);
+}
+
+/**
+ * Calls the draw callback and paints what it drew on the tiles it touched.
+ * The callback draws on a recording surface, which is then replayed only
+ * inside the damaged area. Tools that add dabs instead have them blended
+ * straight into the tiles. Tools that draw on the preview keep the recording
+ * as the preview instead, and the image is not touched until they commit.
+ */
+static void
+run_draw_callback (CanvasRegion *self,
+                   on_draw       callback)
+{
+  cairo_surface_t *recording;
+  cairo_surface_t *dabs_mask;
+  GdkRectangle dabs_area;
+  const GdkRGBA *color;
+  GdkRGBA stroke_color;
+  cairo_t *cr;
+
+  dabs_mask = NULL;
+
+  if (!self->draw_on_preview)
+    prepare_for_drawing (self);
+
+  recording = cairo_recording_surface_create (CAIRO_CONTENT_COLOR_ALPHA, NULL);
+  cr = cairo_create (recording);
+
+  if (self->current_tool_type == ERASER)
+    color = &WHITE_COLOR;
+  else
+    color = toolbar_get_current_color (self->toolbar);
+
+  gdk_cairo_set_source_rgba (cr, color);
+
+  damage_reset (&self->draw_event.damage);
+
+  callback (self, cr, &self->draw_event);
+
+  cairo_destroy (cr);
+
+  if (self->draw_event.dabs != NULL)
+    {
+      dabs_mask = dab_stroke_render (self->draw_event.dabs, &dabs_area);
+
+      if (dabs_mask != NULL)
+        damage_add_rectangle (&self->draw_event.damage,
+                              dabs_area.x, dabs_area.y, dabs_area.width, dabs_area.height);
+    }
+
+  damage_clip (&self->draw_event.damage, self->width, self->height);
+
+  if (self->draw_on_preview)
+    {
+      clear_preview (self);
+      self->preview = recording;
+      self->preview_area = self->draw_event.damage;
+    }
+  else
+    {
+      if (dabs_mask != NULL)
+        {
+          // The mask has the coverage of the whole stroke, it goes over the pixels from before the stroke
+          stroke_color = *color;
+          stroke_color.alpha *= self->draw_event.brush_opacity / 100;
+
+          self->bytes_copied += tile_store_restore_rectangle (self->tile_store, &dabs_area);
+          self->bytes_copied += tile_store_blend_mask (self->tile_store,
+                                                       dabs_mask,
+                                                       &dabs_area,
+                                                       &stroke_color);
+        }
+      else
+        self->bytes_copied += tile_store_paint_surface (self->tile_store,
+                                                        recording,
+                                                        &self->draw_event.damage);
+
+      damage_add_damage (&self->change_area, &self->draw_event.damage);
+      cairo_surface_destroy (recording);
+
+      if (!self->save_while_drawing)
+        self->previous_damage = self->draw_event.damage;
+    }
+
+  g_clear_pointer (&dabs_mask, cairo_surface_destroy);
+
+  g_debug ("Draw touched %dx%d pixels at (%d, %d), copied %" G_GSIZE_FORMAT " bytes",
+           self->draw_event.damage.width, self->draw_event.damage.height,
+           self->draw_event.damage.x, self->draw_event.damage.y,
+           self->bytes_copied);
+
+  self->bytes_copied = 0;
+
+  gtk_widget_queue_draw (GTK_WIDGET (self->drawing_area));
 }
 
 static void
 update_draw_event_from_toolbar (CanvasRegion *self)
 {
   self->draw_event.draw_size = toolbar_get_draw_size (self->toolbar);
+  self->draw_event.brush_hardness = toolbar_get_brush_hardness (self->toolbar);
+  self->draw_event.brush_opacity = toolbar_get_brush_opacity (self->toolbar);
+  self->draw_event.fill_tolerance = toolbar_get_fill_tolerance (self->toolbar);
+  self->draw_event.fill_gap = toolbar_get_fill_gap (self->toolbar);
+  self->draw_event.fill_everywhere = toolbar_get_fill_everywhere (self->toolbar);
+}
+
+static void
+draw_to (CanvasRegion *self,
+         cairo_t      *cr,
+         DrawEvent    *draw_event,
+         PrecisePoint *point)
+{
+  draw_event->precise_position = *point;
+  draw_event->current_mouse_position.x = point->x;
+  draw_event->current_mouse_position.y = point->y;
+  draw_event->drag_offset.x = point->x - draw_event->drag_start.x;
+  draw_event->drag_offset.y = point->y - draw_event->drag_start.y;
+
+  self->draw_cb (self, cr, draw_event);
+
+  draw_event->last_drawn_point = draw_event->current_mouse_position;
+}
+
+/**
+ * Draws from the last drawn point to point along the Catmull-Rom curve that
+ * also goes through the point before it and next, in short straight pieces.
+ */
+static void
+draw_curve_to (CanvasRegion *self,
+               cairo_t      *cr,
+               DrawEvent    *draw_event,
+               PrecisePoint *point,
+               PrecisePoint *next)
+{
+  PrecisePoint before;
+  PrecisePoint start;
+  PrecisePoint piece_end;
+  gint pieces;
+
+  before = self->point_before_last_drawn;
+  start = draw_event->precise_position;
+  pieces = ceil (hypot (point->x - start.x, point->y - start.y) / CURVE_PIECE_LENGTH);
+  pieces = CLAMP (pieces, 1, MAX_CURVE_PIECES);
+
+  for (gint piece = 1; piece < pieces; piece++)
+    {
+      point_catmull_rom (&before, &start, point, next, (gdouble) piece / pieces, &piece_end);
+      draw_to (self, cr, draw_event, &piece_end);
+    }
+
+  draw_to (self, cr, draw_event, point);
+  self->point_before_last_drawn = start;
+}
+
+/**
+ * Passes the pending samples to the tool, in order, as one batch. Tools that
+ * save while drawing get a smooth curve through the samples, all in the same
+ * pass. Tools that redraw their whole shape each time only need the latest one.
+ */
+static void
+draw_pending_samples (CanvasRegion *self,
+                      cairo_t      *cr,
+                      DrawEvent    *draw_event)
+{
+  PrecisePoint *offset;
+  PrecisePoint point;
+  PrecisePoint next;
+  guint i;
+
+  if (!self->save_while_drawing)
+    {
+      offset = &g_array_index (self->pending_samples, PrecisePoint, self->pending_samples->len - 1);
+      point.x = self->precise_drag_start.x + offset->x;
+      point.y = self->precise_drag_start.y + offset->y;
+      draw_to (self, cr, draw_event, &point);
+      g_array_set_size (self->pending_samples, 0);
+      return;
+    }
+
+  for (i = 0; i < self->pending_samples->len; i++)
+    {
+      offset = &g_array_index (self->pending_samples, PrecisePoint, i);
+      point.x = self->precise_drag_start.x + offset->x;
+      point.y = self->precise_drag_start.y + offset->y;
+
+      // The last sample has no next one yet, the stroke is assumed to keep its direction
+      if (i + 1 < self->pending_samples->len)
+        {
+          offset = &g_array_index (self->pending_samples, PrecisePoint, i + 1);
+          next.x = self->precise_drag_start.x + offset->x;
+          next.y = self->precise_drag_start.y + offset->y;
+        }
+      else
+        {
+          next.x = 2 * point.x - draw_event->precise_position.x;
+          next.y = 2 * point.y - draw_event->precise_position.y;
+        }
+
+      draw_curve_to (self, cr, draw_event, &point, &next);
+    }
+
+  g_array_set_size (self->pending_samples, 0);
+}
+
+static void
+flush_pending_samples (CanvasRegion *self)
+{
+  if (self->pending_samples->len == 0)
+    return;
+
+  update_draw_event_from_toolbar (self);
+  run_draw_callback (self, draw_pending_samples);
+}
+
+/**
+ * Draws everything received since the last frame, once per frame.
+ */
+static gboolean
+on_drawing_area_tick (GtkWidget     *widget,
+                      GdkFrameClock *frame_clock,
+                      gpointer       user_data)
+{
+  CanvasRegion *self = user_data;
+
+  self->tick_callback_id = 0;
+  flush_pending_samples (self);
+
+  return G_SOURCE_REMOVE;
 }
 
 static void
@@ -171,14 +756,53 @@ set_is_current_file_saved (CanvasRegion *self,
 static void
 save_to_current_file (CanvasRegion *self)
 {
+  g_autoptr (GdkTexture) texture = NULL;
+
   if (self->is_current_file_saved)
     return;
 
-  cairo_surface_write_to_png (self->cairo_surface_save, self->current_filename);
+  texture = tile_store_to_texture (self->tile_store);
+
+  if (!gdk_texture_save_to_png (texture, self->current_filename))
+    {
+      g_message ("Error saving file: %s", self->current_filename);
+      return;
+    }
+
   set_is_current_file_saved (self, true);
   canvas_region_mark_current_snapshot_as_saved (self->caretaker);
 }
 
+static void
+apply_undo_history_settings (GSettings             *settings,
+                             CanvasRegionCaretaker *caretaker)
+{
+  g_autofree gchar *spill_directory;
+
+  spill_directory = g_settings_get_string (settings, "undo-history-spill-directory");
+
+  canvas_region_caretaker_set_max_size (caretaker,
+                                        g_settings_get_uint64 (settings, "undo-history-size"));
+  canvas_region_caretaker_set_spill_options (caretaker,
+                                             spill_directory,
+                                             g_settings_get_uint (settings,
+                                                                  "undo-history-resident-steps"),
+                                             g_settings_get_uint64 (settings,
+                                                                    "undo-history-spill-size"));
+}
+
+static CanvasRegionCaretaker *
+create_caretaker (CanvasRegion *self)
+{
+  CanvasRegionCaretaker *caretaker;
+
+  caretaker = canvas_region_caretaker_new (g_settings_get_uint64 (self->settings,
+                                                                  "undo-history-size"));
+  apply_undo_history_settings (self->settings, caretaker);
+
+  return caretaker;
+}
+
 static void
 update_drawing_area_size (CanvasRegion *self,
                           gint          width,
@@ -201,23 +825,37 @@ static void
 open_file (CanvasRegion *self,
            gchar        *filename)
 {
-  gint width;
-  gint height;
+  g_autoptr (GdkTexture) texture;
+  g_autoptr (GError) error;
 
-  cairo_surface_destroy (self->cairo_surface_save);
-  self->cairo_surface_save = cairo_image_surface_create_from_png (filename);
+  error = NULL;
+  texture = gdk_texture_new_from_filename (filename, &error);
 
-  width = cairo_image_surface_get_width (self->cairo_surface_save);
-  height = cairo_image_surface_get_height (self->cairo_surface_save);
-  update_drawing_area_size (self, width, height);
+  if (error != NULL)
+    {
+      g_message ("Error opening file: %s", error->message);
+      return;
+    }
+
+  cancel_fill (self);
+  g_clear_pointer (&self->region_labels, region_labels_dispose);
+  tile_store_dispose (self->tile_store);
+  self->tile_store = tile_store_new_from_texture (texture);
+
+  update_drawing_area_size (self,
+                            tile_store_get_width (self->tile_store),
+                            tile_store_get_height (self->tile_store));
 
   self->current_filename = filename;
 
   set_is_current_file_saved (self, true);
 
   canvas_region_caretaker_dispose (self->caretaker);
-  self->caretaker = canvas_region_caretaker_new ();
-  create_and_save_snapshot (self);
+  self->caretaker = create_caretaker (self);
+  canvas_region_caretaker_save_snapshot (self->caretaker,
+                                         canvas_region_snapshot_new (self->width,
+                                                                     self->height,
+                                                                     true));
 
   gtk_widget_queue_draw (GTK_WIDGET (self->drawing_area));
 }
@@ -352,6 +990,120 @@ on_file_dialog_save_finish (GObject      *source_object,
   g_free (cb_data);
 }
 
+/**
+ * Previews a scaled or rotated floating selection. Only the visible part is
+ * drawn with the nearest pixels, which is cheap enough to follow the mouse
+ * even for the whole image, the move resamples it properly.
+ */
+static void
+paint_transformed_floating_selection (CanvasRegion *self,
+                                      cairo_t      *cr)
+{
+  cairo_matrix_t matrix;
+
+  get_floating_transform (self, &matrix);
+
+  if (!self->is_floating_pasted)
+    {
+      cairo_set_source_rgb (cr, 1, 1, 1);
+      gdk_cairo_rectangle (cr, &self->floating_source);
+      cairo_fill (cr);
+    }
+
+  cairo_transform (cr, &matrix);
+  cairo_set_source_surface (cr, self->floating_selection, 0, 0);
+  cairo_pattern_set_filter (cairo_get_source (cr), CAIRO_FILTER_NEAREST);
+  cairo_rectangle (cr, 0, 0, self->floating_source.width, self->floating_source.height);
+  cairo_fill (cr);
+}
+
+static void
+draw_selection_outline (CanvasRegion *self,
+                        cairo_t      *cr)
+{
+  GdkRectangle mask_area;
+  gdouble x;
+  gdouble y;
+  gint offset_x;
+  gint offset_y;
+  gint i;
+
+  cairo_save (cr);
+  gdk_cairo_set_source_rgba (cr, &SELECTION_RECTANGLE_COLOR);
+  cairo_set_line_width (cr, SELECTION_LINE_WIDTH);
+  cairo_set_dash (cr, SELECTION_DASH_PATTERN, NUM_DASHES, DASH_OFFSET);
+
+  if (self->selection_mask != NULL)
+    {
+      // Traced the first time only, after that it is a copy of the path
+      mask_area = selection_mask_get_area (self->selection_mask);
+      get_floating_offset (self, &offset_x, &offset_y);
+      selection_mask_append_outline (self->selection_mask, cr,
+                                     mask_area.x + offset_x, mask_area.y + offset_y);
+      cairo_stroke (cr);
+      cairo_restore (cr);
+      return;
+    }
+
+  // The corners go around the outline in the order 0, 1, 3, 2
+  for (i = 0; i < 4; i++)
+    {
+      get_handle_position (self, SELECTION_HANDLE_SCALE, i ^ (i >> 1), &x, &y);
+      outline_to_image (self, x, y, &x, &y);
+      cairo_line_to (cr, x, y);
+    }
+
+  cairo_close_path (cr);
+  cairo_stroke (cr);
+
+  if (!is_selection_tool (self))
+    {
+      cairo_restore (cr);
+      return;
+    }
+
+  cairo_set_dash (cr, NULL, 0, 0);
+
+  for (i = 0; i < 4; i++)
+    {
+      get_handle_position (self, SELECTION_HANDLE_SCALE, i, &x, &y);
+      outline_to_image (self, x, y, &x, &y);
+      cairo_rectangle (cr, x - HANDLE_SIZE / 2, y - HANDLE_SIZE / 2, HANDLE_SIZE, HANDLE_SIZE);
+    }
+
+  cairo_fill (cr);
+
+  get_handle_position (self, SELECTION_HANDLE_ROTATE, 0, &x, &y);
+  outline_to_image (self, x, y, &x, &y);
+  cairo_arc (cr, x, y, HANDLE_SIZE / 2, 0, 2 * G_PI);
+  cairo_fill (cr);
+
+  cairo_restore (cr);
+}
+
+/**
+ * Strokes the lasso drawn so far, it is never drawn to the image.
+ */
+static void
+draw_lasso (CanvasRegion *self,
+            cairo_t      *cr)
+{
+  Point *points;
+
+  points = (Point *) self->lasso_points->data;
+
+  cairo_save (cr);
+  gdk_cairo_set_source_rgba (cr, &SELECTION_RECTANGLE_COLOR);
+  cairo_set_line_width (cr, LASSO_LINE_WIDTH);
+  cairo_set_dash (cr, SELECTION_DASH_PATTERN, NUM_DASHES, DASH_OFFSET);
+
+  for (guint i = 0; i < self->lasso_points->len; i++)
+    cairo_line_to (cr, points[i].x, points[i].y);
+
+  cairo_stroke (cr);
+  cairo_restore (cr);
+}
+
 static void
 drawing_area_draw_function (GtkDrawingArea *area,
                             cairo_t        *cr,
@@ -360,48 +1112,357 @@ drawing_area_draw_function (GtkDrawingArea *area,
                             gpointer        user_data)
 {
   CanvasRegion *self = user_data;
+  GdkRectangle visible_area;
+  gdouble x1;
+  gdouble y1;
+  gdouble x2;
+  gdouble y2;
+
+  cairo_clip_extents (cr, &x1, &y1, &x2, &y2);
+  visible_area.x = floor (x1);
+  visible_area.y = floor (y1);
+  visible_area.width = ceil (x2) - visible_area.x;
+  visible_area.height = ceil (y2) - visible_area.y;
+
+  // The drawing area is bigger than the image while resizing
+  if (width > tile_store_get_width (self->tile_store) ||
+      height > tile_store_get_height (self->tile_store))
+    {
+      cairo_set_source_rgb (cr, 1, 1, 1);
+      cairo_paint (cr);
+    }
+
+  tile_store_paint_to (self->tile_store, cr, &visible_area);
+
+  if (self->preview != NULL)
+    {
+      cairo_save (cr);
+      cairo_set_source_surface (cr, self->preview, 0, 0);
+      gdk_cairo_rectangle (cr, &self->preview_area);
+      cairo_fill (cr);
+      cairo_restore (cr);
+    }
+
+  if (self->floating_selection != NULL)
+    {
+      cairo_save (cr);
+      cairo_rectangle (cr, 0, 0, self->width, self->height);
+      cairo_clip (cr);
+
+      if (is_floating_transformed (self))
+        paint_transformed_floating_selection (self, cr);
+      else
+        paint_moved_floating_selection (self, cr);
+
+      cairo_restore (cr);
+    }
+
+  if (!damage_is_empty (&self->selection_outline))
+    draw_selection_outline (self, cr);
 
-  if (self->cairo_surface)
-    cairo_set_source_surface (cr, self->cairo_surface, 0, 0);
+  if (self->lasso_points != NULL && self->lasso_points->len > 1)
+    draw_lasso (self, cr);
+}
+
+/**
+ * Resamples the scaled or rotated floating selection, area is set to the part
+ * of the image that the result covers.
+ */
+static cairo_surface_t *
+resample_floating_selection (CanvasRegion *self,
+                             GdkRectangle *area)
+{
+  GdkRectangle bounds = { 0, 0, self->width, self->height };
+  cairo_matrix_t to_source;
+  ResampleFilter filter;
+  gdouble min_x = G_MAXDOUBLE;
+  gdouble min_y = G_MAXDOUBLE;
+  gdouble max_x = -G_MAXDOUBLE;
+  gdouble max_y = -G_MAXDOUBLE;
+  gdouble x;
+  gdouble y;
+  gint i;
+
+  get_floating_transform (self, &to_source);
+
+  for (i = 0; i < 4; i++)
+    {
+      x = i & 1 ? self->floating_source.width : 0;
+      y = i & 2 ? self->floating_source.height : 0;
+      cairo_matrix_transform_point (&to_source, &x, &y);
+
+      min_x = MIN (min_x, x);
+      min_y = MIN (min_y, y);
+      max_x = MAX (max_x, x);
+      max_y = MAX (max_y, y);
+    }
+
+  area->x = floor (min_x);
+  area->y = floor (min_y);
+  area->width = ceil (max_x) - area->x;
+  area->height = ceil (max_y) - area->y;
+
+  if (!gdk_rectangle_intersect (area, &bounds, area) ||
+      cairo_matrix_invert (&to_source) != CAIRO_STATUS_SUCCESS)
+    return NULL;
+
+  // Bicubic keeps enlarged pixels sharp, bilinear is enough when shrinking
+  if (self->selection_destination.width > self->floating_source.width ||
+      self->selection_destination.height > self->floating_source.height)
+    filter = RESAMPLE_BICUBIC;
   else
-    cairo_set_source_surface (cr, self->cairo_surface_save, 0, 0);
+    filter = RESAMPLE_BILINEAR;
 
-  cairo_paint (cr);
+  return resample_surface (self->floating_selection, &to_source, area, filter);
 }
 
+/**
+ * Moves the lifted pixels to the selection destination in the image, this is
+ * the only time a drag of the selection changes the image. A scaled or rotated
+ * selection becomes the rectangle around the transformed pixels.
+ */
 static void
 canvas_region_move_selection (CanvasRegion *self)
 {
+  cairo_surface_t *recording;
+  cairo_surface_t *resampled;
   cairo_t *cr;
+  GdkRectangle area;
+  GdkRectangle moved_to;
+  gint offset_x;
+  gint offset_y;
 
-  cr = cairo_create (self->cairo_surface_save);
+  moved_to = self->selection_destination;
 
-  cairo_move_rectangle (self->cairo_surface_save, cr,
-                        &self->selection_rectangle, &self->selection_destination);
+  if (self->floating_selection != NULL && is_floating_transformed (self))
+    {
+      resampled = resample_floating_selection (self, &moved_to);
 
-  self->selection_rectangle = self->selection_destination;
+      recording = cairo_recording_surface_create (CAIRO_CONTENT_COLOR_ALPHA, NULL);
+      cr = cairo_create (recording);
 
-  cairo_destroy (cr);
+      if (!self->is_floating_pasted)
+        {
+          cairo_set_source_rgb (cr, 1, 1, 1);
+          gdk_cairo_rectangle (cr, &self->floating_source);
+          cairo_fill (cr);
+        }
+
+      if (resampled != NULL)
+        {
+          cairo_set_source_surface (cr, resampled, 0, 0);
+          cairo_paint (cr);
+          cairo_surface_destroy (resampled);
+        }
+      else
+        {
+          damage_reset (&moved_to);
+        }
+
+      cairo_destroy (cr);
+    }
+  else if (self->floating_selection != NULL &&
+           (self->is_floating_pasted ||
+            !gdk_rectangle_equal (&self->floating_source, &self->selection_destination)))
+    {
+      recording = cairo_recording_surface_create (CAIRO_CONTENT_COLOR_ALPHA, NULL);
+      cr = cairo_create (recording);
+      paint_moved_floating_selection (self, cr);
+      cairo_destroy (cr);
+    }
+  else
+    {
+      recording = NULL;
+    }
+
+  if (recording != NULL)
+    {
+      // Pasted pixels only cover where they were moved to
+      if (self->is_floating_pasted)
+        area = moved_to;
+      else
+        {
+          area = self->floating_source;
+          damage_add_damage (&area, &moved_to);
+        }
+
+      damage_clip (&area, self->width, self->height);
+
+      if (!tile_store_is_changing (self->tile_store))
+        begin_change (self);
+
+      tile_store_paint_surface (self->tile_store, recording, &area);
+      damage_add_damage (&self->change_area, &area);
+      cairo_surface_destroy (recording);
+    }
+
+  // The mask keeps its own bounding box, which can be partly outside the image
+  if (self->selection_mask != NULL)
+    {
+      moved_to = selection_mask_get_area (self->selection_mask);
+      get_floating_offset (self, &offset_x, &offset_y);
+      moved_to.x += offset_x;
+      moved_to.y += offset_y;
+      selection_mask_move_to (self->selection_mask, moved_to.x, moved_to.y);
+    }
+
+  clear_floating_selection (self);
+  self->selection_rectangle = moved_to;
+  self->selection_destination = moved_to;
+  canvas_region_draw_selection_rectangle (self, &moved_to);
 }
 
+/**
+ * Moves the selection and commits the move, a move that left the image as it
+ * was, like a click without a drag, is dropped instead of becoming an undo step.
+ */
 static void
-restore_from_snapshot (CanvasRegion         *self,
-                       CanvasRegionSnapshot *snapshot)
+commit_selection_move (CanvasRegion *self)
 {
-  update_drawing_area_size (self, snapshot->width, snapshot->height);
+  canvas_region_move_selection (self);
+
+  if (!tile_store_is_changing (self->tile_store))
+    return;
+
+  if (damage_is_empty (&self->change_area))
+    {
+      tile_store_cancel_change (self->tile_store);
+      return;
+    }
+
+  set_is_current_file_saved (self, false);
+  commit_current_changes (self);
+}
+
+/**
+ * Paints a pasted selection that is still floating into the image, as a change
+ * of its own.
+ */
+static void
+anchor_pasted_selection (CanvasRegion *self)
+{
+  if (!self->is_floating_pasted)
+    return;
 
-  destroy_current_surface (self);
+  commit_selection_move (self);
+  gtk_widget_queue_draw (GTK_WIDGET (self->drawing_area));
+}
 
-  cairo_surface_destroy (self->cairo_surface_save);
-  
-  self->cairo_surface_save = cairo_clone_surface (snapshot->surface);
+/**
+ * Forgets the regions that undoing or redoing snapshot changes.
+ */
+static void
+invalidate_region_labels (CanvasRegion         *self,
+                          CanvasRegionSnapshot *snapshot)
+{
+  if (self->region_labels == NULL)
+    return;
+
+  if (snapshot->tile_store_before != NULL)
+    g_clear_pointer (&self->region_labels, region_labels_dispose);
+  else
+    region_labels_invalidate (self->region_labels, &snapshot->area);
+}
 
+/**
+ * Updates everything that is not in the tile store to the current snapshot.
+ */
+static void
+update_from_current_snapshot (CanvasRegion *self)
+{
+  CanvasRegionSnapshot *snapshot;
+
+  snapshot = canvas_region_caretaker_get_current_snapshot (self->caretaker);
+
+  update_drawing_area_size (self, snapshot->width, snapshot->height);
   set_is_current_file_saved (self, snapshot->is_current_file_saved);
 
   gtk_widget_queue_draw (GTK_WIDGET (self->drawing_area));
 }
 
+static gboolean
+on_fill_progress_timeout (gpointer user_data)
+{
+  CanvasRegion *self = user_data;
+
+  g_signal_emit (self, canvas_region_signals[FILL_PROGRESS], 0,
+                 g_atomic_int_get (&self->fill_progress->permille) / 1000.0);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+on_fill_finish (GObject      *source_object,
+                GAsyncResult *result,
+                gpointer      user_data)
+{
+  CanvasRegion *self = PAINT_CANVAS_REGION (source_object);
+  g_autoptr (GError) error = NULL;
+  cairo_surface_t *cairo_surface;
+  RegionLabels *region_labels;
+  GdkRectangle filled_area;
+
+  cairo_surface = fill_finish (result, &filled_area, &region_labels, &error);
+
+  // A cancelled fill was already forgotten, a newer one may be running
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    return;
+
+  g_clear_object (&self->fill_cancellable);
+  g_clear_handle_id (&self->fill_progress_source_id, g_source_remove);
+  self->fill_progress = NULL;
+  g_signal_emit (self, canvas_region_signals[FILL_PROGRESS], 0, -1.0);
+
+  if (error != NULL)
+    {
+      g_message ("Could not fill: %s", error->message);
+      return;
+    }
+
+  if (cairo_surface == NULL)
+    {
+      self->region_labels = region_labels;
+      return;
+    }
+
+  // Only the part that changed is copied back to the image
+  begin_change (self);
+  tile_store_paint_surface (self->tile_store, cairo_surface, &filled_area);
+  damage_add_damage (&self->change_area, &filled_area);
+  cairo_surface_destroy (cairo_surface);
+
+  set_is_current_file_saved (self, false);
+  commit_current_changes (self);
 
+  // Given back after the commit, the labels already know about the fill
+  self->region_labels = region_labels;
+
+  gtk_widget_queue_draw (GTK_WIDGET (self->drawing_area));
+}
+
+/**
+ * Starts filling at the current mouse position on a copy of the image, the
+ * drawing area keeps working while the fill runs.
+ */
+static void
+start_fill (CanvasRegion *self)
+{
+  self->fill_cancellable = g_cancellable_new ();
+  self->fill_progress = g_new0 (FloodFillProgress, 1);
+  self->fill_progress->cancellable = self->fill_cancellable;
+
+  fill_async (tile_store_copy (self->tile_store),
+              g_steal_pointer (&self->region_labels),
+              &self->draw_event,
+              toolbar_get_current_color (self->toolbar),
+              self->fill_progress,
+              self,
+              on_fill_finish,
+              NULL);
+
+  self->fill_progress_source_id = g_timeout_add (FILL_PROGRESS_INTERVAL, on_fill_progress_timeout, self);
+  g_signal_emit (self, canvas_region_signals[FILL_PROGRESS], 0, 0.0);
+}
 
 static void
 on_mouse_press (GtkGestureClick *gesture,
@@ -411,44 +1472,49 @@ on_mouse_press (GtkGestureClick *gesture,
                 gpointer         user_data)
 {
   CanvasRegion *self;
-  cairo_t *cr;
   Point click_point;
 
   self = user_data;
   click_point.x = x;
   click_point.y = y;
 
-  if (self->draw_start_click_cb == NULL)
+  if (self->draw_start_click_cb == NULL && self->current_tool_type != FILL)
     return;
 
-  destroy_current_surface (self);
+  // The handles are found before discarding clears the selection outline
+  if (is_selection_tool (self))
+    self->draw_event.selection_handle = canvas_region_get_selection_handle_at (self, &click_point);
+  else
+    self->draw_event.selection_handle = SELECTION_HANDLE_NONE;
+
+  // A pasted selection stays floating when it is dragged, clicking away anchors it
+  if (self->draw_event.selection_handle == SELECTION_HANDLE_NONE)
+    anchor_pasted_selection (self);
 
-  if (self->current_tool_type == SELECT &&
-          !point_is_inside_rectangle (&click_point, &self->selection_rectangle))
+  // Also cancels a fill that is still running
+  if (!self->is_floating_pasted)
+    discard_current_changes (self);
+
+  if (is_selection_tool (self) &&
+      self->draw_event.selection_handle == SELECTION_HANDLE_NONE)
     {
       reset_selection (self);
     }
 
-  cr = cairo_create (self->cairo_surface_save);
-
-  if (self->current_tool_type == ERASER)
-    gdk_cairo_set_source_rgba (cr, &WHITE_COLOR);
-  else
-    gdk_cairo_set_source_rgba (cr, toolbar_get_current_color (self->toolbar));
-
   update_draw_event_from_toolbar (self);
 
   self->draw_event.current_mouse_position.x = x;
   self->draw_event.current_mouse_position.y = y;
+  self->draw_event.precise_position.x = x;
+  self->draw_event.precise_position.y = y;
 
-  self->draw_start_click_cb (self, cr, &self->draw_event);
+  if (self->current_tool_type == FILL)
+    start_fill (self);
+  else
+    run_draw_callback (self, self->draw_start_click_cb);
 
   self->draw_event.last_drawn_point.x = self->draw_event.current_mouse_position.x;
-  self->draw_event.last_drawn_point.y = self->draw_event.current_mouse_position.y;
-
-  cairo_destroy (cr);
-
-  gtk_widget_queue_draw (GTK_WIDGET (self->drawing_area));
+  self->draw_event.last_drawn_point.y = self->draw_event.current_mouse_position.y;
 }
 
 static void
@@ -471,6 +1537,47 @@ on_gesture_drag_begin (GtkGestureDrag *gesture,
 
   self->draw_event.current_mouse_position.x = start_x;
   self->draw_event.current_mouse_position.y = start_y;
+
+  self->draw_event.precise_position.x = start_x;
+  self->draw_event.precise_position.y = start_y;
+  self->precise_drag_start = self->draw_event.precise_position;
+  self->point_before_last_drawn = self->draw_event.precise_position;
+}
+
+/**
+ * Appends the motion that GTK compressed into event, the positions of the
+ * history are relative to the surface so they are moved by the same amount
+ * as the position of event to get the drag offsets.
+ */
+static void
+append_motion_history (CanvasRegion *self,
+                       GdkEvent     *event,
+                       gdouble       offset_x,
+                       gdouble       offset_y)
+{
+  GdkTimeCoord *history;
+  PrecisePoint offset;
+  gdouble event_x;
+  gdouble event_y;
+  guint history_length;
+
+  if (event == NULL || gdk_event_get_event_type (event) != GDK_MOTION_NOTIFY ||
+      !gdk_event_get_position (event, &event_x, &event_y))
+    return;
+
+  history = gdk_event_get_history (event, &history_length);
+
+  for (guint i = 0; i < history_length; i++)
+    {
+      if (!(history[i].flags & GDK_AXIS_FLAG_X) || !(history[i].flags & GDK_AXIS_FLAG_Y))
+        continue;
+
+      offset.x = offset_x + history[i].axes[GDK_AXIS_X] - event_x;
+      offset.y = offset_y + history[i].axes[GDK_AXIS_Y] - event_y;
+      g_array_append_val (self->pending_samples, offset);
+    }
+
+  g_free (history);
 }
 
 static void
@@ -480,44 +1587,53 @@ on_gesture_drag_update (GtkGestureDrag *gesture,
                         gpointer        user_data)
 {
   CanvasRegion *self;
-  cairo_t *cr;
+  PrecisePoint offset;
 
   self = user_data;
 
   if (self->draw_cb == NULL)
     return;
 
-  if (self->save_while_drawing && self->cairo_surface != NULL)
-    {
-      cairo_surface_destroy (self->cairo_surface_save);
-      self->cairo_surface_save = cairo_clone_surface (self->cairo_surface);
-    }
-  else
-    {
-      destroy_current_surface (self);
-      self->cairo_surface = cairo_clone_surface (self->cairo_surface_save);
-    }
-
-  cr = cairo_create (self->cairo_surface);
-
-  if (self->current_tool_type == ERASER)
-    gdk_cairo_set_source_rgba (cr, &WHITE_COLOR);
-  else
-    gdk_cairo_set_source_rgba (cr, toolbar_get_current_color (self->toolbar));
+  if (self->save_while_drawing)
+    append_motion_history (self,
+                           gtk_event_controller_get_current_event (GTK_EVENT_CONTROLLER (gesture)),
+                           offset_x,
+                           offset_y);
+
+  // Drawing waits for the next frame, so events arriving faster than the display refresh are batched
+  offset.x = offset_x;
+  offset.y = offset_y;
+  g_array_append_val (self->pending_samples, offset);
+
+  if (self->tick_callback_id == 0)
+    self->tick_callback_id = gtk_widget_add_tick_callback (GTK_WIDGET (self->drawing_area),
+                                                           on_drawing_area_tick,
+                                                           self,
+                                                           NULL);
+}
 
-  update_draw_event_from_toolbar (self);
-  self->draw_event.drag_offset.x = offset_x;
-  self->draw_event.drag_offset.y = offset_y;
+/**
+ * Selects the pixels inside the lasso that was just drawn, the last point is
+ * joined to the first one.
+ */
+static void
+select_lasso (CanvasRegion *self)
+{
+  GdkRectangle bounds = { 0, 0, self->width, self->height };
+  SelectionMask *mask;
 
-  self->draw_event.current_mouse_position.x = self->draw_event.drag_start.x + offset_x;
-  self->draw_event.current_mouse_position.y = self->draw_event.drag_start.y + offset_y;
+  if (self->lasso_points == NULL)
+    return;
 
-  self->draw_cb (self, cr, &self->draw_event);
+  mask = selection_mask_new_from_polygon ((Point *) self->lasso_points->data,
+                                          self->lasso_points->len,
+                                          CAIRO_FILL_RULE_WINDING,
+                                          &bounds);
+  g_clear_pointer (&self->lasso_points, g_array_unref);
 
-  self->draw_event.last_drawn_point.x = self->draw_event.current_mouse_position.x;
-  self->draw_event.last_drawn_point.y = self->draw_event.current_mouse_position.y;
+  if (mask != NULL)
+    canvas_region_set_selection_mask (self, mask);
 
-  cairo_destroy (cr);
   gtk_widget_queue_draw (GTK_WIDGET (self->drawing_area));
 }
 
@@ -529,24 +1645,30 @@ on_gesture_drag_end (GtkGestureDrag *gesture,
 {
   CanvasRegion *self = user_data;
 
-  // Nothing changed
-  if (self->current_tool_type == COLOR_PICKER ||
-      (self->current_tool_type == SELECT && !self->draw_event.is_dragging_selection))
-    return;
-
-  self->draw_event.is_dragging_selection = false;
-  set_is_current_file_saved (self, false);
+  flush_pending_samples (self);
+  drop_pending_samples (self);
 
-  if (self->current_tool_type == SELECT)
+  if (self->current_tool_type == LASSO && !self->draw_event.is_dragging_selection)
     {
-      canvas_region_move_selection (self);
-      create_and_save_snapshot (self);
-      gtk_widget_queue_draw (GTK_WIDGET (self->drawing_area));
+      select_lasso (self);
+      return;
     }
-  else
+
+  // Nothing changed, or the fill commits itself when it is done
+  if (self->current_tool_type == COLOR_PICKER ||
+      self->current_tool_type == FILL ||
+      (is_selection_tool (self) && !self->draw_event.is_dragging_selection))
+    return;
+
+  if (is_selection_tool (self))
     {
-      save_and_destroy_current_surface (self);
+      self->draw_event.is_dragging_selection = false;
+      commit_selection_move (self);
+      return;
     }
+
+  set_is_current_file_saved (self, false);
+  commit_current_changes (self);
 }
 
 static void
@@ -557,19 +1679,35 @@ on_motion (GtkEventControllerMotion *controller,
 {
   CanvasRegion *self = user_data;
   Point current_point;
+  SelectionHandle handle;
+  const gchar *cursor_name;
 
   current_point.x = x;
   current_point.y = y;
 
-  if (self->draw_event.is_dragging_selection || 
-          point_is_inside_rectangle (&current_point, &self->selection_rectangle))
-    {
-      gtk_widget_set_cursor_from_name (GTK_WIDGET (self->drawing_area), "move");
-    }
+  if (self->draw_event.is_dragging_selection)
+    handle = self->draw_event.selection_handle;
   else
+    handle = canvas_region_get_selection_handle_at (self, &current_point);
+
+  switch (handle)
     {
-      gtk_widget_set_cursor_from_name (GTK_WIDGET (self->drawing_area), "default");
+    case SELECTION_HANDLE_MOVE:
+      cursor_name = "move";
+      break;
+    case SELECTION_HANDLE_SCALE:
+      cursor_name = "nwse-resize";
+      break;
+    case SELECTION_HANDLE_ROTATE:
+      cursor_name = "grab";
+      break;
+    case SELECTION_HANDLE_NONE:
+    default:
+      cursor_name = "default";
+      break;
     }
+
+  gtk_widget_set_cursor_from_name (GTK_WIDGET (self->drawing_area), cursor_name);
 }
 
 static void
@@ -579,32 +1717,16 @@ on_resize_corner_drag_update (GtkGestureDrag *gesture,
                               gpointer       user_data)
 {
   CanvasRegion *self;
-  cairo_format_t format;
-  cairo_t *cr;
   gint width;
   gint height;
 
   self = user_data;
-  format = cairo_image_surface_get_format (self->cairo_surface_save);
   width = MAX (self->width + offset_x, 1);
   height = MAX (self->height + offset_y, 1);
 
-  destroy_current_surface (self);
-
+  // The tile store is only resized once the drag ends
   update_drawing_area_size (self, width, height);
 
-  self->cairo_surface = cairo_image_surface_create (format, width, height);
-
-  cr = cairo_create (self->cairo_surface);
-
-  cairo_set_source_rgb (cr, 1, 1, 1);
-  cairo_paint (cr);
-
-  cairo_set_source_surface (cr, self->cairo_surface_save, 0.0, 0.0);
-  cairo_paint (cr);
-
-  cairo_destroy (cr);
-
   gtk_widget_queue_draw (GTK_WIDGET (self->drawing_area));
 }
 
@@ -615,8 +1737,28 @@ on_resize_corner_drag_end (GtkGestureDrag *gesture,
                            gpointer        user_data)
 {
   CanvasRegion *self = user_data;
+  TileStore *tile_store_before;
+  CanvasRegionSnapshot *snapshot;
+
   set_is_current_file_saved (self, false);
-  save_and_destroy_current_surface (self);
+
+  // The filled image would not have the new size
+  cancel_fill (self);
+  g_clear_pointer (&self->region_labels, region_labels_dispose);
+
+  if (tile_store_is_changing (self->tile_store))
+    commit_current_changes (self);
+
+  // Both stores share the tiles that the resize does not touch
+  tile_store_before = tile_store_copy (self->tile_store);
+  tile_store_resize (self->tile_store, self->width, self->height);
+
+  snapshot = canvas_region_snapshot_new_from_resize (self->is_current_file_saved,
+                                                     tile_store_before,
+                                                     tile_store_copy (self->tile_store));
+  canvas_region_caretaker_save_snapshot (self->caretaker, snapshot);
+
+  gtk_widget_queue_draw (GTK_WIDGET (self->drawing_area));
 }
 
 static void
@@ -629,7 +1771,7 @@ on_text_popover_close (GtkPopover *popover,
   self = user_data;
   buffer = gtk_entry_get_buffer (self->text_popover_text_entry);
 
-  destroy_current_surface (self);
+  discard_current_changes (self);
   gtk_entry_buffer_set_text (buffer, "", 0);
   gtk_widget_queue_draw (GTK_WIDGET (self->drawing_area));
 }
@@ -639,32 +1781,20 @@ on_text_popover_text_change (GtkEditable *editable,
                              gpointer     user_data)
 {
   CanvasRegion *self;
-  cairo_t *cr;
 
   self = user_data;
 
   if (!gtk_widget_get_visible (GTK_WIDGET (self->text_popover)))
     return;
 
-  destroy_current_surface (self);
-
-  self->cairo_surface = cairo_clone_surface (self->cairo_surface_save);
-
-  cr = cairo_create (self->cairo_surface);
-  gdk_cairo_set_source_rgba (cr, toolbar_get_current_color (self->toolbar));
-
-  self->draw_cb (self, cr, &self->draw_event);
-
-  cairo_destroy (cr);
-
-  gtk_widget_queue_draw (GTK_WIDGET (self->drawing_area));
+  run_draw_callback (self, self->draw_cb);
 }
 
 static void
 on_text_popover_activate (GtkEntry     *entry,
                           CanvasRegion *self)
 {
-  save_and_destroy_current_surface (self);
+  commit_current_changes (self);
   gtk_popover_popdown (self->text_popover);
 }
 
@@ -672,10 +1802,20 @@ static void
 on_text_popover_submit (GtkButton    *button,
                         CanvasRegion *self)
 {
-  save_and_destroy_current_surface (self);
+  commit_current_changes (self);
   gtk_popover_popdown (self->text_popover);
 }
 
+static void
+on_settings_change (GSettings *settings,
+                    gchar     *key,
+                    gpointer   user_data)
+{
+  CanvasRegion *self = user_data;
+
+  apply_undo_history_settings (settings, self->caretaker);
+}
+
 static void
 canvas_region_init (CanvasRegion *self)
 {
@@ -689,21 +1829,28 @@ canvas_region_init (CanvasRegion *self)
   self->current_tool_type = BRUSH;
 
   self->save_while_drawing = true;
-  self->caretaker = canvas_region_caretaker_new ();
-
-
-  self->cairo_surface_save = cairo_image_surface_create (CAIRO_FORMAT_RGB24,
-                                                         self->width, self->height);
+  self->draw_on_preview = false;
+  self->settings = g_settings_new ("org.gnome.paint");
+  self->caretaker = create_caretaker (self);
+  g_signal_connect (self->settings,
+                    "changed",
+                    G_CALLBACK (on_settings_change),
+                    self);
+
+  self->tile_store = tile_store_new (self->width, self->height);
+  self->pending_samples = g_array_new (FALSE, FALSE, sizeof (PrecisePoint));
+  self->tick_callback_id = 0;
 
   self->draw_event.is_dragging_selection = false;
 
-  cairo_whiten_surface (self->cairo_surface_save);
-
   gtk_widget_set_cursor_from_name (GTK_WIDGET (self->resize_corner), "nwse-resize");
 
   set_is_current_file_saved (self, true);
 
-  create_and_save_snapshot (self);
+  canvas_region_caretaker_save_snapshot (self->caretaker,
+                                         canvas_region_snapshot_new (self->width,
+                                                                     self->height,
+                                                                     true));
 
   gtk_drawing_area_set_draw_func (self->drawing_area, drawing_area_draw_function, self, NULL);
 }
@@ -712,8 +1859,21 @@ static void
 canvas_region_dispose (GObject *gobject)
 {
   CanvasRegion *self = (CanvasRegion *) gobject;
+  g_clear_object (&self->settings);
+  cancel_fill (self);
+  g_clear_pointer (&self->region_labels, region_labels_dispose);
+  g_clear_pointer (&self->draw_event.dabs, dab_stroke_dispose);
+  clear_floating_selection (self);
+  g_clear_pointer (&self->selection_mask, selection_mask_dispose);
+  g_clear_pointer (&self->lasso_points, g_array_unref);
   canvas_region_caretaker_dispose (self->caretaker);
-  cairo_surface_destroy (self->cairo_surface_save);
+  tile_store_dispose (self->tile_store);
+
+  if (self->pending_samples != NULL)
+    {
+      drop_pending_samples (self);
+      g_clear_pointer (&self->pending_samples, g_array_unref);
+    }
 
   gtk_widget_dispose_template (GTK_WIDGET (gobject), PAINT_TYPE_CANVAS_REGION);
   G_OBJECT_CLASS (canvas_region_parent_class)->dispose (gobject);
@@ -792,6 +1952,18 @@ canvas_region_class_init (CanvasRegionClass *klass)
                                                      1,
                                                      G_TYPE_INT);
 
+  // The fraction done of the running fill, negative when no fill is running
+  canvas_region_signals[FILL_PROGRESS] = g_signal_new ("fill-progress",
+                                                       G_TYPE_FROM_CLASS (klass),
+                                                       G_SIGNAL_RUN_LAST,
+                                                       0,
+                                                       NULL,
+                                                       NULL,
+                                                       NULL,
+                                                       G_TYPE_NONE,
+                                                       1,
+                                                       G_TYPE_DOUBLE);
+
   /* Dispose */
   G_OBJECT_CLASS (klass)->dispose = canvas_region_dispose;
 }
@@ -903,6 +2075,8 @@ canvas_region_save (CanvasRegion           *self,
 {
   CanvasRegionUserData *cb_data;
 
+  anchor_pasted_selection (self);
+
   if (self->current_filename != NULL)
     {
       save_to_current_file (self);
@@ -926,7 +2100,8 @@ canvas_region_set_selected_tool (CanvasRegion      *self,
   if (tool == self->current_tool_type)
     return;
 
-  destroy_current_surface (self);
+  anchor_pasted_selection (self);
+  discard_current_changes (self);
   reset_selection (self);
   gtk_widget_queue_draw (GTK_WIDGET (self->drawing_area));
 
@@ -938,48 +2113,57 @@ canvas_region_set_selected_tool (CanvasRegion      *self,
     case BRUSH:
     case ERASER:
       self->save_while_drawing = true;
+      self->draw_on_preview = false;
       self->draw_start_click_cb = &on_brush_draw_start_click;
       self->draw_cb = &on_brush_draw;
       break;
 
     case RECTANGLE:
       self->save_while_drawing = false;
+      self->draw_on_preview = true;
       self->draw_start_click_cb = NULL;
       self->draw_cb = &on_rectangle_draw;
       break;
 
     case CIRCLE:
       self->save_while_drawing = false;
+      self->draw_on_preview = true;
       self->draw_start_click_cb = NULL;
       self->draw_cb = &on_circle_draw;
       break;
 
     case LINE:
       self->save_while_drawing = false;
+      self->draw_on_preview = true;
       self->draw_start_click_cb = NULL;
       self->draw_cb = &on_line_draw;
       break;
     
     case TEXT:
       self->save_while_drawing = false;
+      self->draw_on_preview = true;
       self->draw_start_click_cb = &on_text_draw_start_click;
       self->draw_cb = &on_text_draw;
       break;
 
     case COLOR_PICKER:
       self->save_while_drawing = false;
+      self->draw_on_preview = false;
       self->draw_start_click_cb = &on_color_picker_draw_start_click;
       self->draw_cb = NULL;
       break;
 
     case FILL:
       self->save_while_drawing = false;
-      self->draw_start_click_cb = &on_fill_draw_start_click;
+      self->draw_on_preview = false;
+      // The fill runs on a worker thread instead, see start_fill
+      self->draw_start_click_cb = NULL;
       self->draw_cb = NULL;
       break;
 
     case SELECT:
       self->save_while_drawing = false;
+      self->draw_on_preview = false;
       self->draw_start_click_cb = &on_select_draw_start_click;
       self->draw_cb = &on_select_draw;
       self->selection_rectangle.x = 0;
@@ -988,6 +2172,21 @@ canvas_region_set_selected_tool (CanvasRegion      *self,
       self->selection_rectangle.height = 0;
       break;
 
+    case MAGIC_WAND:
+      self->save_while_drawing = false;
+      self->draw_on_preview = false;
+      self->draw_start_click_cb = &on_magic_wand_draw_start_click;
+      self->draw_cb = &on_magic_wand_draw;
+      break;
+
+    // The lasso needs every point of the drag, not only the latest one of each frame
+    case LASSO:
+      self->save_while_drawing = true;
+      self->draw_on_preview = false;
+      self->draw_start_click_cb = &on_lasso_draw_start_click;
+      self->draw_cb = &on_lasso_draw;
+      break;
+
     default:
       g_message ("Unknown tool %d", tool);
       break;
@@ -1019,10 +2218,24 @@ canvas_region_undo (CanvasRegion *self)
 {
   CanvasRegionSnapshot *snapshot;
 
-  snapshot = canvas_region_caretaker_previous_snapshot (self->caretaker);
+  // A paste that still floats is not in the history yet, undo only drops it
+  if (self->is_floating_pasted)
+    {
+      discard_current_changes (self);
+      reset_selection (self);
+      gtk_widget_queue_draw (GTK_WIDGET (self->drawing_area));
+      return;
+    }
+
+  snapshot = canvas_region_caretaker_undo (self->caretaker);
+
+  if (snapshot == NULL)
+    return;
 
-  if (snapshot != NULL)
-    restore_from_snapshot (self, snapshot);
+  discard_current_changes (self);
+  invalidate_region_labels (self, snapshot);
+  canvas_region_snapshot_revert (snapshot, &self->tile_store);
+  update_from_current_snapshot (self);
 }
 
 void
@@ -1030,16 +2243,31 @@ canvas_region_redo (CanvasRegion *self)
 {
   CanvasRegionSnapshot *snapshot;
 
-  snapshot = canvas_region_caretaker_next_snapshot (self->caretaker);
+  snapshot = canvas_region_caretaker_redo (self->caretaker);
+
+  if (snapshot == NULL)
+    return;
+
+  discard_current_changes (self);
+  invalidate_region_labels (self, snapshot);
+  canvas_region_snapshot_apply (snapshot, &self->tile_store);
+  update_from_current_snapshot (self);
+}
 
-  if (snapshot != NULL)
-    restore_from_snapshot (self, snapshot);
+/**
+ * Cancels the fill that is running, if any. The image is left as it was
+ * before the click.
+ */
+void
+canvas_region_cancel_fill (CanvasRegion *self)
+{
+  cancel_fill (self);
 }
 
-cairo_surface_t *
-canvas_region_get_image_surface (CanvasRegion *self)
+TileStore *
+canvas_region_get_tile_store (CanvasRegion *self)
 {
-  return self->cairo_surface_save;
+  return self->tile_store;
 }
 
 void
@@ -1049,6 +2277,144 @@ canvas_region_emit_color_picked_signal (CanvasRegion *self,
   g_signal_emit (self, canvas_region_signals[COLOR_PICKED], 0, color);
 }
 
+/**
+ * Lifts the pixels of the selection into a floating layer, the selection can
+ * then be dragged without touching the image until the move is committed.
+ */
+void
+canvas_region_lift_selection (CanvasRegion *self)
+{
+  GdkRectangle bounds = { 0, 0, self->width, self->height };
+
+  // Pasted pixels are already floating
+  if (self->is_floating_pasted)
+    return;
+
+  clear_floating_selection (self);
+
+  if (!gdk_rectangle_intersect (&self->selection_rectangle, &bounds, &self->floating_source))
+    return;
+
+  self->floating_selection = tile_store_flatten (self->tile_store, &self->floating_source);
+
+  if (self->floating_selection == NULL)
+    {
+      g_message ("The selection is too big to move");
+      damage_reset (&self->floating_source);
+      return;
+    }
+
+  self->selection_destination = self->floating_source;
+
+  if (self->selection_mask != NULL)
+    {
+      self->floating_mask = selection_mask_to_surface (self->selection_mask);
+
+      if (self->floating_mask == NULL)
+        {
+          g_message ("The selection is too big to move");
+          clear_floating_selection (self);
+        }
+    }
+}
+
+/**
+ * Finds the handle of the selection under point, the inside of the selection
+ * moves it.
+ */
+SelectionHandle
+canvas_region_get_selection_handle_at (CanvasRegion *self,
+                                       Point        *point)
+{
+  gdouble x;
+  gdouble y;
+  gdouble handle_x;
+  gdouble handle_y;
+  gint offset_x;
+  gint offset_y;
+  gint i;
+
+  if (damage_is_empty (&self->selection_outline) || damage_is_empty (&self->selection_rectangle))
+    return SELECTION_HANDLE_NONE;
+
+  // Masks of any shape are only moved
+  if (self->selection_mask != NULL)
+    {
+      get_floating_offset (self, &offset_x, &offset_y);
+
+      if (selection_mask_contains (self->selection_mask,
+                                   floor (point->x) - offset_x,
+                                   floor (point->y) - offset_y))
+        return SELECTION_HANDLE_MOVE;
+
+      return SELECTION_HANDLE_NONE;
+    }
+
+  image_to_outline (self, point->x, point->y, &x, &y);
+
+  get_handle_position (self, SELECTION_HANDLE_ROTATE, 0, &handle_x, &handle_y);
+  if (ABS (x - handle_x) <= HANDLE_SIZE && ABS (y - handle_y) <= HANDLE_SIZE)
+    return SELECTION_HANDLE_ROTATE;
+
+  for (i = 0; i < 4; i++)
+    {
+      get_handle_position (self, SELECTION_HANDLE_SCALE, i, &handle_x, &handle_y);
+      if (ABS (x - handle_x) <= HANDLE_SIZE && ABS (y - handle_y) <= HANDLE_SIZE)
+        return SELECTION_HANDLE_SCALE;
+    }
+
+  if (ABS (x) <= self->selection_outline.width / 2.0 &&
+      ABS (y) <= self->selection_outline.height / 2.0)
+    return SELECTION_HANDLE_MOVE;
+
+  return SELECTION_HANDLE_NONE;
+}
+
+/**
+ * Scales the floating selection around the center of its destination, so the
+ * dragged corner follows point.
+ */
+void
+canvas_region_scale_selection (CanvasRegion *self,
+                               Point        *point)
+{
+  GdkRectangle *dest = &self->selection_destination;
+  gdouble center_x;
+  gdouble center_y;
+  gdouble half_width;
+  gdouble half_height;
+
+  center_x = dest->x + dest->width / 2.0;
+  center_y = dest->y + dest->height / 2.0;
+
+  image_to_outline (self, point->x, point->y, &half_width, &half_height);
+  half_width = MAX (ABS (half_width), 1);
+  half_height = MAX (ABS (half_height), 1);
+
+  dest->x = round (center_x - half_width);
+  dest->y = round (center_y - half_height);
+  dest->width = round (center_x + half_width) - dest->x;
+  dest->height = round (center_y + half_height) - dest->y;
+
+  canvas_region_draw_selection_rectangle (self, dest);
+}
+
+/**
+ * Rotates the floating selection around its center so the rotate handle, which
+ * is above the selection, points toward point.
+ */
+void
+canvas_region_rotate_selection (CanvasRegion *self,
+                                Point        *point)
+{
+  GdkRectangle *dest = &self->selection_destination;
+
+  self->selection_angle = atan2 (point->y - (dest->y + dest->height / 2.0),
+                                 point->x - (dest->x + dest->width / 2.0)) + G_PI / 2;
+
+  canvas_region_draw_selection_rectangle (self, dest);
+}
+
 GdkRectangle
 canvas_region_get_selection_rectangle (CanvasRegion *self)
 {
@@ -1064,6 +2430,51 @@ canvas_region_set_selection_rectangle (CanvasRegion *self,
 }
 
 
+/**
+ * Adds a point to the lasso being drawn.
+ */
+void
+canvas_region_add_lasso_point (CanvasRegion *self,
+                               Point        *point)
+{
+  Point *last;
+
+  if (self->lasso_points == NULL)
+    self->lasso_points = g_array_new (FALSE, FALSE, sizeof (Point));
+
+  if (self->lasso_points->len > 0)
+    {
+      last = &g_array_index (self->lasso_points, Point, self->lasso_points->len - 1);
+
+      if (last->x == point->x && last->y == point->y)
+        return;
+    }
+
+  g_array_append_val (self->lasso_points, *point);
+  gtk_widget_queue_draw (GTK_WIDGET (self->drawing_area));
+}
+
+/**
+ * Selects the pixels of mask, taking it.
+ */
+void
+canvas_region_set_selection_mask (CanvasRegion  *self,
+                                  SelectionMask *mask)
+{
+  reset_selection (self);
+
+  self->selection_mask = mask;
+  self->selection_rectangle = selection_mask_get_area (mask);
+  self->selection_destination = self->selection_rectangle;
+  canvas_region_draw_selection_rectangle (self, &self->selection_rectangle);
+}
+
+GdkRectangle
+canvas_region_get_selection_destination (CanvasRegion *self)
+{
+  return self->selection_destination;
+}
+
 void
 canvas_region_set_selection_destination (CanvasRegion *self,
                                          GdkRectangle  dest)
@@ -1075,20 +2486,67 @@ void
 canvas_region_draw_selection_rectangle (CanvasRegion *self,
                                         GdkRectangle *rect)
 {
+  self->selection_outline = *rect;
+  gtk_widget_queue_draw (GTK_WIDGET (self->drawing_area));
+}
+
+/**
+ * Paints color over the selected pixels, only the pixels of the mask when the
+ * selection has one.
+ */
+void
+canvas_region_fill_selection (CanvasRegion  *self,
+                              const GdkRGBA *color)
+{
+  GdkRectangle bounds = { 0, 0, self->width, self->height };
+  GdkRectangle area;
+  cairo_surface_t *recording;
+  cairo_surface_t *mask;
   cairo_t *cr;
 
-  if (self->cairo_surface == NULL)
-    self->cairo_surface = cairo_clone_surface (self->cairo_surface_save);
+  if (self->floating_selection != NULL ||
+      !gdk_rectangle_intersect (&self->selection_rectangle, &bounds, &area))
+    return;
 
-  cr = cairo_create (self->cairo_surface);
+  mask = NULL;
+
+  if (self->selection_mask != NULL)
+    {
+      mask = selection_mask_to_surface (self->selection_mask);
+
+      if (mask == NULL)
+        {
+          g_message ("The selection is too big to fill");
+          return;
+        }
+    }
+
+  recording = cairo_recording_surface_create (CAIRO_CONTENT_COLOR_ALPHA, NULL);
+  cr = cairo_create (recording);
+  gdk_cairo_set_source_rgba (cr, color);
+
+  if (mask != NULL)
+    {
+      cairo_mask_surface (cr, mask, 0, 0);
+      cairo_surface_destroy (mask);
+    }
+  else
+    {
+      gdk_cairo_rectangle (cr, &area);
+      cairo_fill (cr);
+    }
 
-  gdk_cairo_set_source_rgba (cr, &SELECTION_RECTANGLE_COLOR);
-  cairo_set_line_width (cr, SELECTION_LINE_WIDTH);
-  cairo_set_dash (cr, SELECTION_DASH_PATTERN, NUM_DASHES, DASH_OFFSET);
-  cairo_rectangle (cr, rect->x, rect->y, rect->width, rect->height);
-  cairo_stroke (cr);
   cairo_destroy (cr);
 
+  if (!tile_store_is_changing (self->tile_store))
+    begin_change (self);
+
+  tile_store_paint_surface (self->tile_store, recording, &area);
+  damage_add_damage (&self->change_area, &area);
+  cairo_surface_destroy (recording);
+
+  set_is_current_file_saved (self, false);
+  commit_current_changes (self);
   gtk_widget_queue_draw (GTK_WIDGET (self->drawing_area));
 }
 
@@ -1097,13 +2555,102 @@ canvas_region_select_all (CanvasRegion *self)
 {
   // This must be called first because it resets the selection!
   canvas_region_set_selected_tool (self, SELECT);
-  destroy_current_surface (self);
+  discard_current_changes (self);
 
   self->selection_rectangle.x = 0;
   self->selection_rectangle.y = 0;
   self->selection_rectangle.width = self->width;
   self->selection_rectangle.height = self->height;
 
+  canvas_region_draw_selection_rectangle (self, &self->selection_rectangle);
+  g_signal_emit (self, canvas_region_signals[TOOL_CHANGE], 0, SELECT);
+}
+
+/**
+ * Gets the selected pixels as a texture, the pixels outside the mask of the
+ * selection are transparent. The texture wraps the pixels flattened from the
+ * tiles without copying them again. Returns NULL if nothing is selected.
+ */
+GdkTexture *
+canvas_region_copy_selection (CanvasRegion *self)
+{
+  GdkRectangle bounds = { 0, 0, self->width, self->height };
+  GdkRectangle area;
+  cairo_surface_t *surface;
+  GdkTexture *texture;
+  GBytes *bytes;
+  guchar *data;
+  guint32 *row;
+  gint stride;
+
+  anchor_pasted_selection (self);
+
+  if (self->floating_selection != NULL ||
+      !gdk_rectangle_intersect (&self->selection_rectangle, &bounds, &area))
+    return NULL;
+
+  surface = tile_store_flatten (self->tile_store, &area);
+
+  if (surface == NULL)
+    {
+      g_message ("The selection is too big to copy");
+      return NULL;
+    }
+
+  cairo_surface_flush (surface);
+  data = cairo_image_surface_get_data (surface);
+  stride = cairo_image_surface_get_stride (surface);
+
+  // The unused byte of RGB24 pixels is not guaranteed to be opaque
+  for (gint y = 0; y < area.height; y++)
+    {
+      row = (guint32 *) (data + y * stride);
+
+      for (gint x = 0; x < area.width; x++)
+        {
+          if (self->selection_mask == NULL ||
+              selection_mask_contains (self->selection_mask, area.x + x, area.y + y))
+            row[x] |= 0xff000000;
+          else
+            row[x] = 0;
+        }
+    }
+
+  // The bytes keep the surface alive for as long as the texture needs them
+  bytes = g_bytes_new_with_free_func (data, (gsize) stride * area.height,
+                                      (GDestroyNotify) cairo_surface_destroy, surface);
+  texture = gdk_memory_texture_new (area.width, area.height, GDK_MEMORY_DEFAULT, bytes, stride);
+  g_bytes_unref (bytes);
+
+  return texture;
+}
+
+/**
+ * Makes the pasted pixels a floating selection at the top left of the image,
+ * it can be dragged, scaled and rotated before it is painted into the image.
+ * Takes ownership of surface.
+ */
+void
+canvas_region_paste (CanvasRegion    *self,
+                     cairo_surface_t *surface)
+{
+  anchor_pasted_selection (self);
+
+  // This must be called first because it resets the selection!
+  canvas_region_set_selected_tool (self, SELECT);
+  discard_current_changes (self);
+  reset_selection (self);
+
+  self->floating_selection = surface;
+  self->is_floating_pasted = true;
+  self->floating_source.x = 0;
+  self->floating_source.y = 0;
+  self->floating_source.width = cairo_image_surface_get_width (surface);
+  self->floating_source.height = cairo_image_surface_get_height (surface);
+
+  self->selection_rectangle = self->floating_source;
+  self->selection_destination = self->floating_source;
+
   canvas_region_draw_selection_rectangle (self, &self->selection_rectangle);
   g_signal_emit (self, canvas_region_signals[TOOL_CHANGE], 0, SELECT);
 }
\ No newline at end of file
@@ -25,6 +25,8 @@
 #include "draw-event.h"
 #include "drawing-tools/drawing-tool-type.h"
 #include "toolbar.h"
+#include "utils/selection-mask.h"
+#include "utils/tile-store.h"
 
 G_BEGIN_DECLS
 
@@ -66,20 +68,39 @@ gchar              *canvas_region_get_text_popover_text       (CanvasRegion
 
 void                canvas_region_undo                        (CanvasRegion       *self);
 void                canvas_region_redo                        (CanvasRegion       *self);
+void                canvas_region_cancel_fill                 (CanvasRegion       *self);
 
-cairo_surface_t    *canvas_region_get_image_surface           (CanvasRegion       *self);
+TileStore          *canvas_region_get_tile_store              (CanvasRegion       *self);
 void                canvas_region_emit_color_picked_signal    (CanvasRegion       *self,
                                                                GdkRGBA            *color);
 
+void                canvas_region_lift_selection              (CanvasRegion       *self);
+SelectionHandle     canvas_region_get_selection_handle_at     (CanvasRegion       *self,
+                                                               Point              *point);
+void                canvas_region_scale_selection             (CanvasRegion       *self,
+                                                               Point              *point);
+void                canvas_region_rotate_selection            (CanvasRegion       *self,
+                                                               Point              *point);
 GdkRectangle        canvas_region_get_selection_rectangle     (CanvasRegion       *self);
 void                canvas_region_set_selection_rectangle     (CanvasRegion       *self,
                                                                GdkRectangle        rect);
+void                canvas_region_set_selection_mask          (CanvasRegion       *self,
+                                                               SelectionMask      *mask);
+void                canvas_region_add_lasso_point             (CanvasRegion       *self,
+                                                               Point              *point);
+GdkRectangle        canvas_region_get_selection_destination   (CanvasRegion       *self);
 void                canvas_region_set_selection_destination   (CanvasRegion       *self,
                                                                GdkRectangle        dest);
 
 void                canvas_region_draw_selection_rectangle    (CanvasRegion       *self,
                                                                GdkRectangle       *rect);
 
+void                canvas_region_fill_selection              (CanvasRegion       *self,
+                                                               const GdkRGBA      *color);
 void                canvas_region_select_all                  (CanvasRegion       *self);
 
+GdkTexture         *canvas_region_copy_selection              (CanvasRegion       *self);
+void                canvas_region_paste                       (CanvasRegion       *self,
+                                                               cairo_surface_t    *surface);
+
 G_END_DECLS
\ No newline at end of file
@@ -21,17 +21,49 @@
 #pragma once
 
 #include <glib.h>
+#include "utils/dab.h"
 #include "utils/point.h"
 
+/* The part of the selection that a drag changes */
+typedef enum
+{
+  SELECTION_HANDLE_NONE,
+  SELECTION_HANDLE_MOVE,
+  SELECTION_HANDLE_SCALE,
+  SELECTION_HANDLE_ROTATE,
+} SelectionHandle;
+
 typedef struct _DrawEvent
 {
-  Point    drag_start;
-  Point    drag_offset;
-  Point    last_drawn_point;
-  Point    current_mouse_position;
-  gint     draw_size;
+  Point        drag_start;
+  Point        drag_offset;
+  Point        last_drawn_point;
+  Point        current_mouse_position;
+  gint         draw_size;
+
+  /* The mouse position without rounding, for tools that draw between pixels */
+  PrecisePoint precise_position;
+
+  /* The area touched by the last draw call, tools must add to it */
+  GdkRectangle damage;
+
+  /* Stroke of dabs, with the path drawn so far, that tools extend instead of
+   * drawing on the cairo context. The new dabs are blended straight into the
+   * image with the color of the tool. Tools create the stroke when they need
+   * it, it lasts until the change is committed. */
+  DabStroke   *dabs;
+
+  /* Brush and eraser, in percent */
+  gdouble      brush_hardness;
+  gdouble      brush_opacity;
+
+  /* Fill, the tolerance is in percent and the gap in pixels */
+  gdouble      fill_tolerance;
+  gint         fill_gap;
+  gboolean     fill_everywhere;
 
   /* Selection */
-  Point    selection_offset;
-  gboolean is_dragging_selection;
+  Point        selection_offset;
+  gboolean     is_dragging_selection;
+  SelectionHandle selection_handle;
 } DrawEvent;
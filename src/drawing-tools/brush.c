@@ -19,115 +19,19 @@
  */
 
 #include "brush.h"
+#include "utils/dab.h"
 
 /**
- * Returns the next point with distance d from the point (x0, y0) on the line y = mx + b.
+ * Returns the stroke of the draw event, it is created by the first draw call
+ * after a click so overlapping dabs of the whole stroke build up together.
  */
-static gdouble
-get_next_point_on_line_with_distance_d (gdouble m,
-                                        gdouble b,
-                                        gdouble x0,
-                                        gdouble d)
+static DabStroke *
+get_stroke (DrawEvent *draw_event)
 {
-  return (sqrt (m * m + 1) * d + (m * m + 1) * x0) / (m * m + 1);
-}
-
-/**
- * Draws a line of circle from last drawn point. It moves along the x axis.
- */
-static void
-draw_along_x_axis (cairo_t   *cr,
-                   DrawEvent *draw_event)
-{
-  gdouble delta_x;
-  gdouble delta_y;
-
-  gdouble m;
-  gdouble b;
-
-  gdouble x;
-  gdouble y;
-  gdouble end_x;
-  
-  gdouble r;
-
-  delta_x = draw_event->current_mouse_position.x - draw_event->last_drawn_point.x;
-  delta_y = draw_event->current_mouse_position.y - draw_event->last_drawn_point.y;
-
-  m = delta_y / delta_x;
-  b = draw_event->current_mouse_position.y - m * draw_event->current_mouse_position.x;
+  if (draw_event->dabs == NULL)
+    draw_event->dabs = dab_stroke_new (draw_event->draw_size, draw_event->brush_hardness / 100);
 
-  x = draw_event->last_drawn_point.x;
-  y = draw_event->last_drawn_point.y;
-  end_x = draw_event->current_mouse_position.x;
-   
-  r = draw_event->draw_size / 2;
-
-  if (draw_event->last_drawn_point.x > draw_event->current_mouse_position.x)
-    {
-      x = draw_event->current_mouse_position.x;
-      y = draw_event->current_mouse_position.y;
-
-      end_x = draw_event->last_drawn_point.x;
-    }
-
-  while (x <= end_x)
-    {
-      cairo_arc (cr, x, y, r, 0, 2 * G_PI);
-      cairo_fill (cr);
-
-      x = get_next_point_on_line_with_distance_d (m, b, x, r / 2);
-      y = m * x + b;
-    }
-}
-
-/**
- * Draws a line of circle from last drawn point. It moves along the y axis.
- */
-static void
-draw_along_y_axis (cairo_t   *cr,
-                   DrawEvent *draw_event)
-{
-  gdouble delta_x;
-  gdouble delta_y;
-
-  gdouble m;
-  gdouble b;
-
-  gdouble x;
-  gdouble y;
-  gdouble end_y;
-
-  gdouble r;
-
-  delta_x = draw_event->current_mouse_position.x - draw_event->last_drawn_point.x;
-  delta_y = draw_event->current_mouse_position.y - draw_event->last_drawn_point.y;
-
-  m = delta_x / delta_y;
-  b = draw_event->current_mouse_position.x - m * draw_event->current_mouse_position.y;
-
-  x = draw_event->last_drawn_point.x;
-  y = draw_event->last_drawn_point.y;
-  end_y = draw_event->current_mouse_position.y;
-
-  r = draw_event->draw_size / 2;
-
-  if (draw_event->last_drawn_point.y > draw_event->current_mouse_position.y)
-    {
-      x = draw_event->current_mouse_position.x;
-      y = draw_event->current_mouse_position.y;
-
-      end_y = draw_event->last_drawn_point.y;
-    }
-
-  while (y <= end_y)
-    {
-      cairo_arc (cr, x, y, r, 0, 2 * G_PI);
-      cairo_fill (cr);
-
-      y = get_next_point_on_line_with_distance_d (m, b, y, r / 2);
-      x = m * y + b;
-    }
+  return draw_event->dabs;
 }
 
 void
@@ -135,27 +39,21 @@ on_brush_draw_start_click (CanvasRegion *canvas_region,
                            cairo_t      *cr,
                            DrawEvent    *draw_event)
 {
-  cairo_arc (cr,
-             draw_event->current_mouse_position.x,
-             draw_event->current_mouse_position.y,
-             draw_event->draw_size / 2,
-             0, 2 * G_PI);
-  cairo_fill (cr);
+  dab_stroke_move_to (get_stroke (draw_event),
+                      draw_event->precise_position.x,
+                      draw_event->precise_position.y);
 }
 
+/**
+ * Extends the stroke to the mouse position, only the dabs of the new part of
+ * the path are rendered.
+ */
 void
 on_brush_draw (CanvasRegion *canvas_region,
                cairo_t      *cr,
                DrawEvent    *draw_event)
 {
-  gdouble delta_x;
-  gdouble delta_y;
-
-  delta_x = ABS (draw_event->current_mouse_position.x - draw_event->last_drawn_point.x);
-  delta_y = ABS (draw_event->current_mouse_position.y - draw_event->last_drawn_point.y);
-
-  if (delta_x < delta_y)
-    draw_along_y_axis (cr, draw_event);
-  else
-    draw_along_x_axis (cr, draw_event);
+  dab_stroke_line_to (get_stroke (draw_event),
+                      draw_event->precise_position.x,
+                      draw_event->precise_position.y);
 }
@@ -19,6 +19,7 @@
  */
 
 #include "circle.h"
+#include "utils/damage.h"
 
 void
 on_circle_draw (CanvasRegion *canvas_region,
@@ -46,4 +47,10 @@ on_circle_draw (CanvasRegion *canvas_region,
 
   cairo_set_line_width (cr, draw_event->draw_size);
   cairo_stroke (cr);
+
+  damage_add_rectangle (&draw_event->damage,
+                        x - (width + draw_event->draw_size) / 2,
+                        y - (height + draw_event->draw_size) / 2,
+                        width + draw_event->draw_size,
+                        height + draw_event->draw_size);
 }
@@ -29,13 +29,19 @@ on_color_picker_draw_start_click (CanvasRegion *canvas_region,
   guchar *pixels;
   cairo_surface_t *cairo_surface;
   GdkRGBA *color;
+  GdkRectangle pixel_rect;
 
-  cairo_surface = canvas_region_get_image_surface (canvas_region);
+  pixel_rect.x = draw_event->current_mouse_position.x;
+  pixel_rect.y = draw_event->current_mouse_position.y;
+  pixel_rect.width = 1;
+  pixel_rect.height = 1;
+
+  // A single pixel always fits in an image surface
+  cairo_surface = tile_store_flatten (canvas_region_get_tile_store (canvas_region), &pixel_rect);
   pixels = cairo_image_surface_get_data (cairo_surface);
-  color = cairo_get_pixel_color_at (pixels,
-                                    cairo_surface,
-                                    draw_event->current_mouse_position.x,
-                                    draw_event->current_mouse_position.y);
+  color = cairo_get_pixel_color_at (pixels, cairo_surface, 0, 0);
 
   canvas_region_emit_color_picked_signal (canvas_region, color);
+
+  cairo_surface_destroy (cairo_surface);
 }
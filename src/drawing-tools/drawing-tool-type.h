@@ -30,4 +30,6 @@ typedef enum _DRAWING_TOOL {
   TEXT,
   FILL,
   COLOR_PICKER,
+  MAGIC_WAND,
+  LASSO,
 } DRAWING_TOOL_TYPE;
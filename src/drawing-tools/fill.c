@@ -19,138 +19,262 @@
  */
 
 #include "fill.h"
-#include "utils/cairo-utils.h"
-#include "utils/point.h"
+#include "utils/flood-fill.h"
+#include "utils/pixel-kernels.h"
+#include "utils/region-labels.h"
+
+/* Everything the fill needs, copied on the main thread so the worker thread
+ * does not touch the canvas */
+typedef struct _FillTaskData {
+  TileStore         *tile_store;
+  gint               x;
+  gint               y;
+  guint8             tolerance;
+  gint               gap;
+  gboolean           is_everywhere;
+  GdkRGBA            color;
+  FloodFillProgress *progress;
+  GdkRectangle       filled_area;
+
+  /* Lent by the caller and given back when the fill ends, can be NULL */
+  RegionLabels      *region_labels;
+} FillTaskData;
 
 static void
-add_neighbor_if_valid (GQueue          *queue,
-                       gboolean        *added_points,
-                       guchar          *pixels,
-                       cairo_surface_t *cairo_surface,
-                       GdkRGBA         *current_color,
-                       gint             width,
-                       gint             height,
-                       gint             x,
-                       gint             y)
+fill_task_data_free (gpointer data)
 {
-  GdkRGBA *neighbor_color;
-  Point *neighbor;
+  FillTaskData *task_data = data;
 
-  if (x < 0 || y < 0 || x >= width || y >= height || added_points[y * width + x])
-    return;
+  tile_store_dispose (task_data->tile_store);
+  g_clear_pointer (&task_data->region_labels, region_labels_dispose);
+  g_free (task_data->progress);
+  g_free (task_data);
+}
 
-  neighbor_color = cairo_get_pixel_color_at (pixels, cairo_surface, x, y);
+/**
+ * Returns color as the fill functions take it, an RGB24 pixel with the alpha in
+ * its unused byte.
+ */
+static guint32
+get_fill_color (const GdkRGBA *color)
+{
+  return (guint32) round (color->alpha * 255) << 24 |
+         (guint32) round (color->red * 255) << 16 |
+         (guint32) round (color->green * 255) << 8 |
+         (guint32) round (color->blue * 255);
+}
 
-  if (gdk_rgba_equal (current_color, neighbor_color))
-    {
-      neighbor = point_new (x, y);
-      added_points[y * width + x] = true;
-      g_queue_push_tail (queue, neighbor);
-    }
-  
-  g_free (neighbor_color);
+/**
+ * Returns the pixel that results from painting fill_color over original, it is
+ * blended the same way the fill functions blend it.
+ */
+static guint32
+get_fill_pixel (guint32 fill_color,
+                guint32 original)
+{
+  guint32 pixel;
+
+  pixel = original | 0xff000000;
+  pixel_blend_span (&pixel, 1, fill_color | 0xff000000, fill_color >> 24);
+
+  return pixel;
+}
+
+/**
+ * The pixels a fill reads are flattened into one image surface, which has a
+ * smaller size limit than the tile store.
+ */
+static void
+return_too_big_error (GTask *task)
+{
+  g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NO_SPACE, "The image is too big to fill");
 }
 
 static void
-add_valid_surrounding_neighbors (GQueue          *queue,
-                                 gboolean        *added_points,
-                                 guchar          *pixels,
-                                 cairo_surface_t *cairo_surface,
-                                 GdkRGBA         *current_color,
-                                 gint             width,
-                                 gint             height,
-                                 Point           *current_point)
+fill_thread (GTask        *task,
+             gpointer      source_object,
+             gpointer      data,
+             GCancellable *cancellable)
 {
-  for (gint i = -1; i <= 1; i++)
+  FillTaskData *task_data = data;
+  cairo_surface_t *cairo_surface;
+  GdkRectangle bounds;
+  guint32 original_pixel;
+  guint32 fill_color;
+  gboolean is_completed;
+  gboolean can_use_region_labels;
+
+  bounds.x = 0;
+  bounds.y = 0;
+  bounds.width = tile_store_get_width (task_data->tile_store);
+  bounds.height = tile_store_get_height (task_data->tile_store);
+
+  if (task_data->x < 0 || task_data->y < 0 ||
+      task_data->x >= bounds.width || task_data->y >= bounds.height)
+    {
+      g_task_return_pointer (task, NULL, NULL);
+      return;
+    }
+
+  cairo_surface = NULL;
+  fill_color = get_fill_color (&task_data->color);
+
+  // Regions are of one exact color, so they only match fills without tolerance
+  can_use_region_labels = task_data->tolerance == 0 && task_data->gap == 0 && !task_data->is_everywhere;
+
+  if (can_use_region_labels &&
+      (task_data->region_labels == NULL ||
+       !region_labels_lookup (task_data->region_labels, task_data->x, task_data->y,
+                              &original_pixel, &task_data->filled_area)))
+    {
+      // The clicked region changed since the labels were made, all the image is labeled again
+      g_clear_pointer (&task_data->region_labels, region_labels_dispose);
+      cairo_surface = tile_store_flatten (task_data->tile_store, &bounds);
+
+      if (cairo_surface == NULL)
+        {
+          return_too_big_error (task);
+          return;
+        }
+
+      task_data->region_labels = region_labels_new (cairo_surface, task_data->progress);
+
+      if (g_task_return_error_if_cancelled (task))
+        {
+          cairo_surface_destroy (cairo_surface);
+          return;
+        }
+    }
+
+  if (can_use_region_labels && task_data->region_labels != NULL &&
+      region_labels_lookup (task_data->region_labels, task_data->x, task_data->y,
+                            &original_pixel, &task_data->filled_area))
     {
-      for (gint j = -1; j <= 1; j++)
+      // Only the bounding box of the region is needed when the image was not flattened already
+      if (cairo_surface == NULL)
         {
-          if (i == 0 && j == 0)
-            continue;
-
-          add_neighbor_if_valid (queue,
-                                 added_points,
-                                 pixels,
-                                 cairo_surface,
-                                 current_color,
-                                 width, height,
-                                 current_point->x + i, current_point->y + j);
+          cairo_surface = tile_store_flatten (task_data->tile_store, &task_data->filled_area);
+
+          if (cairo_surface == NULL)
+            {
+              return_too_big_error (task);
+              return;
+            }
+
+          cairo_surface_set_device_offset (cairo_surface, -task_data->filled_area.x, -task_data->filled_area.y);
         }
+
+      region_labels_fill (task_data->region_labels, task_data->x, task_data->y,
+                          get_fill_pixel (fill_color, original_pixel), cairo_surface);
+
+      g_task_return_pointer (task, cairo_surface, (GDestroyNotify) cairo_surface_destroy);
+      return;
     }
-}
 
-static void
-fill_surrounding_region_that_has_color (cairo_t         *cr,
-                                        cairo_surface_t *cairo_surface,
-                                        guchar          *pixels,
-                                        GdkRGBA         *color,
-                                        gint             width,
-                                        gint             height,
-                                        gint             start_x,
-                                        gint             start_y)
-{
-  Point *current_point;
-  GQueue *queue;
-  gboolean *added_points;
+  // The search needs all the pixels in one buffer
+  if (cairo_surface == NULL)
+    cairo_surface = tile_store_flatten (task_data->tile_store, &bounds);
 
-  current_point = point_new (start_x, start_y);
-  queue = g_queue_new ();
+  if (cairo_surface == NULL)
+    {
+      return_too_big_error (task);
+      return;
+    }
 
-  added_points = g_malloc0 (height * width * sizeof (gboolean));
-  g_queue_push_tail (queue, current_point);
+  // Each filled pixel is painted over on its own, tolerance lets them differ
+  if (task_data->is_everywhere)
+    is_completed = flood_fill_everywhere (cairo_surface, task_data->x, task_data->y,
+                                          task_data->tolerance, fill_color,
+                                          task_data->progress, &task_data->filled_area);
+  else if (task_data->gap > 0)
+    is_completed = flood_fill_closing_gaps (cairo_surface, task_data->x, task_data->y,
+                                            task_data->tolerance, task_data->gap, fill_color,
+                                            task_data->progress, &task_data->filled_area);
+  else
+    is_completed = flood_fill (cairo_surface, task_data->x, task_data->y,
+                               task_data->tolerance, fill_color,
+                               task_data->progress, &task_data->filled_area);
 
-  while (!g_queue_is_empty (queue))
+  if (!is_completed)
     {
-      current_point = g_queue_pop_head (queue);
-      cairo_rectangle (cr, current_point->x, current_point->y, 1, 1);
-
-      add_valid_surrounding_neighbors (queue,
-                                       added_points,
-                                       pixels,
-                                       cairo_surface,
-                                       color,
-                                       width,
-                                       height,
-                                       current_point);
-
-      point_dispose (current_point);
+      cairo_surface_destroy (cairo_surface);
+      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_CANCELLED, "The fill was cancelled");
+      return;
     }
 
-  cairo_fill (cr);
+  if (task_data->region_labels != NULL)
+    region_labels_invalidate (task_data->region_labels, &task_data->filled_area);
 
-  g_queue_free (queue);
-  g_free (added_points);
+  g_task_return_pointer (task, cairo_surface, (GDestroyNotify) cairo_surface_destroy);
 }
 
+/**
+ * Fills the region clicked in draw_event with color on a worker thread. It
+ * takes tile_store, which should be a copy of the image so the image can keep
+ * changing in the meantime, and progress, which the caller can keep reading
+ * until callback is called. Cancelling the cancellable of progress stops the
+ * fill.
+ *
+ * It also takes region_labels, the labels of tile_store or NULL, and gives them
+ * back up to date from fill_finish. Fills without tolerance use them when the
+ * clicked region did not change since the last fill, then they are only a
+ * lookup and a write of the pixels of the region.
+ */
 void
-on_fill_draw_start_click (CanvasRegion *canvas_region,
-                          cairo_t      *cr,
-                          DrawEvent    *draw_event)
+fill_async (TileStore           *tile_store,
+            RegionLabels        *region_labels,
+            DrawEvent           *draw_event,
+            const GdkRGBA       *color,
+            FloodFillProgress   *progress,
+            gpointer             source_object,
+            GAsyncReadyCallback  callback,
+            gpointer             user_data)
+{
+  FillTaskData *task_data;
+  GTask *task;
+
+  task_data = g_new0 (FillTaskData, 1);
+  task_data->tile_store = tile_store;
+  task_data->x = draw_event->current_mouse_position.x;
+  task_data->y = draw_event->current_mouse_position.y;
+  task_data->tolerance = round (draw_event->fill_tolerance * 255 / 100);
+  task_data->gap = draw_event->fill_gap;
+  task_data->is_everywhere = draw_event->fill_everywhere;
+  task_data->color = *color;
+  task_data->progress = progress;
+  task_data->region_labels = region_labels;
+
+  task = g_task_new (source_object, progress->cancellable, callback, user_data);
+  g_task_set_source_tag (task, fill_async);
+  g_task_set_task_data (task, task_data, fill_task_data_free);
+  g_task_run_in_thread (task, fill_thread);
+  g_object_unref (task);
+}
+
+/**
+ * Returns a surface with the filled region, placed by its device offset, and
+ * sets filled_area to the part of the image that changed, or returns NULL if
+ * the click was outside the image. A cancelled fill always ends with an error,
+ * even if it had time to finish. Unless there is an error, region_labels is set
+ * to the labels of the image with the fill, which can be NULL.
+ */
+cairo_surface_t *
+fill_finish (GAsyncResult  *result,
+             GdkRectangle  *filled_area,
+             RegionLabels **region_labels,
+             GError       **error)
 {
-  guchar *pixels;
+  FillTaskData *task_data;
   cairo_surface_t *cairo_surface;
-  GdkRGBA *original_color;
-  gint height;
-  gint width;
-
-  cairo_surface = canvas_region_get_image_surface (canvas_region);
-
-  width = cairo_image_surface_get_width (cairo_surface);
-  height = cairo_image_surface_get_height (cairo_surface);
-
-  pixels = cairo_image_surface_get_data (cairo_surface);
-  original_color = cairo_get_pixel_color_at (pixels,
-                                             cairo_surface,
-                                             draw_event->current_mouse_position.x, draw_event->current_mouse_position.y);
-
-  fill_surrounding_region_that_has_color (cr,
-                                          cairo_surface,
-                                          pixels,
-                                          original_color,
-                                          width,
-                                          height,
-                                          draw_event->current_mouse_position.x,
-                                          draw_event->current_mouse_position.y);
-
-  g_free (original_color);
+
+  cairo_surface = g_task_propagate_pointer (G_TASK (result), error);
+  task_data = g_task_get_task_data (G_TASK (result));
+
+  if (cairo_surface != NULL)
+    *filled_area = task_data->filled_area;
+
+  if (!g_task_had_error (G_TASK (result)))
+    *region_labels = g_steal_pointer (&task_data->region_labels);
+
+  return cairo_surface;
 }
@@ -20,9 +20,23 @@
 
 #pragma once
 
-#include "canvas-region.h"
+#include <gtk/gtk.h>
+
 #include "draw-event.h"
+#include "utils/flood-fill.h"
+#include "utils/region-labels.h"
+#include "utils/tile-store.h"
+
+void             fill_async  (TileStore           *tile_store,
+                              RegionLabels        *region_labels,
+                              DrawEvent           *draw_event,
+                              const GdkRGBA       *color,
+                              FloodFillProgress   *progress,
+                              gpointer             source_object,
+                              GAsyncReadyCallback  callback,
+                              gpointer             user_data);
 
-void on_fill_draw_start_click (CanvasRegion *canvas_region,
-                               cairo_t      *cr,
-                               DrawEvent    *draw_event);
+cairo_surface_t *fill_finish (GAsyncResult        *result,
+                              GdkRectangle        *filled_area,
+                              RegionLabels       **region_labels,
+                              GError             **error);
@@ -0,0 +1,52 @@
+/* lasso.c
+ *
+ * Copyright 2023 Rami Alkawadri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "lasso.h"
+#include "select.h"
+
+/**
+ * Starts a lasso at the click, the canvas selects what it surrounds when the
+ * drag ends. A click on the selection starts dragging it instead.
+ */
+void
+on_lasso_draw_start_click (CanvasRegion *canvas_region,
+                           cairo_t      *cr,
+                           DrawEvent    *draw_event)
+{
+  if (draw_event->selection_handle != SELECTION_HANDLE_NONE)
+    {
+      on_select_draw_start_click (canvas_region, cr, draw_event);
+      return;
+    }
+
+  draw_event->is_dragging_selection = false;
+  canvas_region_add_lasso_point (canvas_region, &draw_event->current_mouse_position);
+}
+
+void
+on_lasso_draw (CanvasRegion *canvas_region,
+               cairo_t      *cr,
+               DrawEvent    *draw_event)
+{
+  if (draw_event->is_dragging_selection)
+    on_select_draw (canvas_region, cr, draw_event);
+  else
+    canvas_region_add_lasso_point (canvas_region, &draw_event->current_mouse_position);
+}
@@ -19,6 +19,7 @@
  */
 
 #include "line.h"
+#include "utils/damage.h"
 
 void
 on_line_draw (CanvasRegion *canvas_region,
@@ -30,4 +31,11 @@ on_line_draw (CanvasRegion *canvas_region,
 
   cairo_set_line_width (cr, draw_event->draw_size);
   cairo_stroke (cr);
+
+  // The butt caps never go further than half the line width from the end points
+  damage_add_rectangle (&draw_event->damage,
+                        MIN (draw_event->drag_start.x, draw_event->current_mouse_position.x) - draw_event->draw_size / 2.0,
+                        MIN (draw_event->drag_start.y, draw_event->current_mouse_position.y) - draw_event->draw_size / 2.0,
+                        ABS (draw_event->current_mouse_position.x - draw_event->drag_start.x) + draw_event->draw_size,
+                        ABS (draw_event->current_mouse_position.y - draw_event->drag_start.y) + draw_event->draw_size);
 }
@@ -0,0 +1,92 @@
+/* magic-wand.c
+ *
+ * Copyright 2023 Rami Alkawadri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "magic-wand.h"
+#include "select.h"
+#include "utils/flood-fill.h"
+#include "utils/selection-mask.h"
+
+/**
+ * Selects the pixels that a fill at the click would fill, with the tolerance of
+ * the fill. A click on the selection starts dragging it instead.
+ */
+void
+on_magic_wand_draw_start_click (CanvasRegion *canvas_region,
+                                cairo_t      *cr,
+                                DrawEvent    *draw_event)
+{
+  TileStore *tile_store;
+  cairo_surface_t *cairo_surface;
+  GdkRectangle bounds;
+  GdkRectangle selected_area;
+  guint64 *bits;
+  gint x;
+  gint y;
+
+  if (draw_event->selection_handle != SELECTION_HANDLE_NONE)
+    {
+      on_select_draw_start_click (canvas_region, cr, draw_event);
+      return;
+    }
+
+  draw_event->is_dragging_selection = false;
+
+  tile_store = canvas_region_get_tile_store (canvas_region);
+  bounds.x = 0;
+  bounds.y = 0;
+  bounds.width = tile_store_get_width (tile_store);
+  bounds.height = tile_store_get_height (tile_store);
+
+  x = floor (draw_event->current_mouse_position.x);
+  y = floor (draw_event->current_mouse_position.y);
+
+  if (x < 0 || y < 0 || x >= bounds.width || y >= bounds.height)
+    return;
+
+  cairo_surface = tile_store_flatten (tile_store, &bounds);
+
+  if (cairo_surface == NULL)
+    {
+      g_message ("The image is too big to select from");
+      return;
+    }
+
+  bits = flood_fill_select (cairo_surface, x, y,
+                            round (draw_event->fill_tolerance * 255 / 100),
+                            &selected_area);
+
+  canvas_region_set_selection_mask (canvas_region,
+                                    selection_mask_new_from_bits (bits,
+                                                                  (bounds.width + 63) / 64,
+                                                                  &selected_area));
+
+  g_free (bits);
+  cairo_surface_destroy (cairo_surface);
+}
+
+void
+on_magic_wand_draw (CanvasRegion *canvas_region,
+                    cairo_t      *cr,
+                    DrawEvent    *draw_event)
+{
+  // The wand selects on click, drags only move the selection
+  if (draw_event->is_dragging_selection)
+    on_select_draw (canvas_region, cr, draw_event);
+}
@@ -0,0 +1,32 @@
+/* magic-wand.h
+ *
+ * Copyright 2023 Rami Alkawadri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include "canvas-region.h"
+#include "draw-event.h"
+
+void on_magic_wand_draw_start_click (CanvasRegion *canvas_region,
+                                     cairo_t      *cr,
+                                     DrawEvent    *draw_event);
+
+void on_magic_wand_draw             (CanvasRegion *canvas_region,
+                                     cairo_t      *cr,
+                                     DrawEvent    *draw_event);
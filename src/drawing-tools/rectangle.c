@@ -19,6 +19,7 @@
  */
 
 #include "rectangle.h"
+#include "utils/damage.h"
 
 void
 on_rectangle_draw (CanvasRegion *canvas_region,
@@ -44,4 +45,10 @@ on_rectangle_draw (CanvasRegion *canvas_region,
                    height);
   
   cairo_stroke (cr);
+
+  damage_add_rectangle (&draw_event->damage,
+                        start_x - draw_event->draw_size / 2.0,
+                        start_y - draw_event->draw_size / 2.0,
+                        width + draw_event->draw_size,
+                        height + draw_event->draw_size);
 }
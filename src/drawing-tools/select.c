@@ -18,38 +18,24 @@
  * SPDX-License-Identifier: GPL-3.0-or-later
  */
 
-#include "utils/cairo-utils.h"
 #include "select.h"
 #include "cairo.h"
 
+/**
+ * Moves the lifted selection to follow the mouse. The canvas draws it at its
+ * destination, the image is only changed when the move is committed.
+ */
 static void
 move_selection (CanvasRegion *canvas_region,
                 cairo_t      *cr,
                 DrawEvent    *draw_event)
 {
-  GdkRectangle selection_rect;
   GdkRectangle dest_rect;
-  cairo_surface_t *cr_surface;
-  gint surface_width;
-  gint surface_height;
-
-  selection_rect = canvas_region_get_selection_rectangle (canvas_region);
-  cr_surface = canvas_region_get_image_surface (canvas_region);
-  surface_width = cairo_image_surface_get_width (cr_surface);
-  surface_height = cairo_image_surface_get_height (cr_surface);
 
+  dest_rect = canvas_region_get_selection_destination (canvas_region);
   dest_rect.x = draw_event->current_mouse_position.x - draw_event->selection_offset.x;
   dest_rect.y = draw_event->current_mouse_position.y - draw_event->selection_offset.y;
 
-  // Avoid going out of bounds
-  dest_rect.width = selection_rect.width + selection_rect.x > surface_width ?
-    surface_width - selection_rect.x : selection_rect.width;
-
-  dest_rect.height = selection_rect.height + selection_rect.y > surface_height ?
-    surface_height - selection_rect.y : selection_rect.height;
-
-  cairo_move_rectangle (cr_surface, cr, &selection_rect, &dest_rect);
-
   canvas_region_draw_selection_rectangle (canvas_region, &dest_rect);
 
   canvas_region_set_selection_destination (canvas_region, dest_rect);
@@ -60,15 +46,20 @@ on_select_draw_start_click (CanvasRegion *canvas_region,
                             cairo_t      *cr,
                             DrawEvent    *draw_event)
 {
-    GdkRectangle selection_rect = canvas_region_get_selection_rectangle (canvas_region);
+    GdkRectangle dest_rect;
 
+    // The canvas finds the handle under the click
     draw_event->is_dragging_selection =
-        point_is_inside_rectangle (&draw_event->current_mouse_position, &selection_rect);
+        draw_event->selection_handle != SELECTION_HANDLE_NONE;
 
     if (draw_event->is_dragging_selection)
       {
-        draw_event->selection_offset.x = draw_event->current_mouse_position.x - selection_rect.x;
-        draw_event->selection_offset.y = draw_event->current_mouse_position.y - selection_rect.y;
+        canvas_region_lift_selection (canvas_region);
+        dest_rect = canvas_region_get_selection_destination (canvas_region);
+        canvas_region_draw_selection_rectangle (canvas_region, &dest_rect);
+
+        draw_event->selection_offset.x = draw_event->current_mouse_position.x - dest_rect.x;
+        draw_event->selection_offset.y = draw_event->current_mouse_position.y - dest_rect.y;
       }
 }
 
@@ -95,7 +86,20 @@ on_select_draw (CanvasRegion *canvas_region,
 
   if (draw_event->is_dragging_selection)
     {
-      move_selection (canvas_region, cr, draw_event);
+      switch (draw_event->selection_handle)
+        {
+        case SELECTION_HANDLE_SCALE:
+          canvas_region_scale_selection (canvas_region, &draw_event->current_mouse_position);
+          break;
+        case SELECTION_HANDLE_ROTATE:
+          canvas_region_rotate_selection (canvas_region, &draw_event->current_mouse_position);
+          break;
+        case SELECTION_HANDLE_MOVE:
+        case SELECTION_HANDLE_NONE:
+        default:
+          move_selection (canvas_region, cr, draw_event);
+          break;
+        }
     }
   // Selection rectangle cannot be too small!
   else if (selection_rect.width > 5 || selection_rect.height > 5)
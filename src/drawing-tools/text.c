@@ -19,6 +19,7 @@
  */
 
 #include "text.h"
+#include "utils/damage.h"
 
 void
 on_text_draw_start_click (CanvasRegion *canvas_region,
@@ -39,9 +40,17 @@ on_text_draw (CanvasRegion *canvas_region,
               cairo_t      *cr,
               DrawEvent    *draw_event)
 {
+  cairo_text_extents_t extents;
   gchar *text = canvas_region_get_text_popover_text (canvas_region);
 
   cairo_set_font_size (cr, draw_event->draw_size * 1.33);
   cairo_move_to (cr, draw_event->current_mouse_position.x, draw_event->current_mouse_position.y);
   cairo_show_text (cr, text);
+
+  cairo_text_extents (cr, text, &extents);
+  damage_add_rectangle (&draw_event->damage,
+                        draw_event->current_mouse_position.x + extents.x_bearing,
+                        draw_event->current_mouse_position.y + extents.y_bearing,
+                        extents.width,
+                        extents.height);
 }
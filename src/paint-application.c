@@ -127,6 +127,30 @@ paint_application_init (PaintApplication *self)
                                          "win.select-all",
                                          (const char *[]){"<primary>a", NULL});
 
+  gtk_application_set_accels_for_action (GTK_APPLICATION (self),
+                                         "win.delete-selection",
+                                         (const char *[]){"Delete", NULL});
+
+  gtk_application_set_accels_for_action (GTK_APPLICATION (self),
+                                         "win.fill-selection",
+                                         (const char *[]){"<alt>BackSpace", NULL});
+
+  gtk_application_set_accels_for_action (GTK_APPLICATION (self),
+                                         "win.copy",
+                                         (const char *[]){"<primary>c", NULL});
+
+  gtk_application_set_accels_for_action (GTK_APPLICATION (self),
+                                         "win.cut",
+                                         (const char *[]){"<primary>x", NULL});
+
+  gtk_application_set_accels_for_action (GTK_APPLICATION (self),
+                                         "win.paste",
+                                         (const char *[]){"<primary>v", NULL});
+
+  gtk_application_set_accels_for_action (GTK_APPLICATION (self),
+                                         "win.cancel",
+                                         (const char *[]){"Escape", NULL});
+
   gtk_application_set_accels_for_action (GTK_APPLICATION (self),
                                          "app.exit",
                                          (const char *[]){"<primary>w", NULL});
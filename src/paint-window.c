@@ -23,6 +23,7 @@
 #include "toolbar.h"
 
 #include "drawing-tools/drawing-tool-type.h"
+#include "utils/clipboard-image.h"
 
 struct _PaintWindow
 {
@@ -33,6 +34,7 @@ struct _PaintWindow
   Toolbar             *toolbar;
   CanvasRegion        *canvas_region;
   GtkLabel            *size_label;
+  GtkProgressBar      *fill_progress_bar;
 
   /* Metadata */
   gboolean             force_close;
@@ -160,6 +162,18 @@ on_canvas_region_resize (CanvasRegion *canvas_region,
   gtk_label_set_label (self->size_label, text);
 }
 
+static void
+on_canvas_region_fill_progress (CanvasRegion *canvas_region,
+                                gdouble       fraction,
+                                gpointer      user_data)
+{
+  PaintWindow *self = user_data;
+
+  // A negative fraction means that no fill is running
+  gtk_widget_set_visible (GTK_WIDGET (self->fill_progress_bar), fraction >= 0);
+  gtk_progress_bar_set_fraction (self->fill_progress_bar, MAX (fraction, 0));
+}
+
 static void
 on_canvas_region_tool_change (CanvasRegion     *canvas_region,
                               DRAWING_TOOL_TYPE selected_tool,
@@ -214,6 +228,106 @@ select_all (GtkWidget  *widget,
   canvas_region_select_all (self->canvas_region);
 }
 
+static void
+delete_selection_activated (GtkWidget  *widget,
+                            const char *action_name,
+                            GVariant   *parameter)
+{
+  PaintWindow *self = PAINT_WINDOW (widget);
+  GdkRGBA white = { 1, 1, 1, 1 };
+
+  canvas_region_fill_selection (self->canvas_region, &white);
+}
+
+static void
+fill_selection_activated (GtkWidget  *widget,
+                          const char *action_name,
+                          GVariant   *parameter)
+{
+  PaintWindow *self = PAINT_WINDOW (widget);
+
+  canvas_region_fill_selection (self->canvas_region,
+                                toolbar_get_current_color (self->toolbar));
+}
+
+/**
+ * Puts the selected pixels in the clipboard, returns whether there was a
+ * selection to copy.
+ */
+static gboolean
+copy_selection (PaintWindow *self)
+{
+  g_autoptr (GdkTexture) texture = NULL;
+
+  texture = canvas_region_copy_selection (self->canvas_region);
+
+  if (texture == NULL)
+    return false;
+
+  gdk_clipboard_set_texture (gtk_widget_get_clipboard (GTK_WIDGET (self)), texture);
+  return true;
+}
+
+static void
+copy_activated (GtkWidget  *widget,
+                const char *action_name,
+                GVariant   *parameter)
+{
+  PaintWindow *self = PAINT_WINDOW (widget);
+  copy_selection (self);
+}
+
+static void
+cut_activated (GtkWidget  *widget,
+               const char *action_name,
+               GVariant   *parameter)
+{
+  PaintWindow *self = PAINT_WINDOW (widget);
+  GdkRGBA white = { 1, 1, 1, 1 };
+
+  if (copy_selection (self))
+    canvas_region_fill_selection (self->canvas_region, &white);
+}
+
+static void
+on_clipboard_image_read (GObject      *source_object,
+                         GAsyncResult *result,
+                         gpointer      user_data)
+{
+  PaintWindow *self = user_data;
+  cairo_surface_t *surface;
+  g_autoptr (GError) error = NULL;
+
+  surface = clipboard_image_read_finish (GDK_CLIPBOARD (source_object), result, &error);
+
+  if (surface == NULL)
+    g_message ("Error pasting image: %s", error->message);
+  else
+    canvas_region_paste (self->canvas_region, surface);
+
+  g_object_unref (self);
+}
+
+static void
+paste_activated (GtkWidget  *widget,
+                 const char *action_name,
+                 GVariant   *parameter)
+{
+  PaintWindow *self = PAINT_WINDOW (widget);
+
+  clipboard_image_read_async (gtk_widget_get_clipboard (widget), NULL,
+                              on_clipboard_image_read, g_object_ref (self));
+}
+
+static void
+cancel_activated (GtkWidget  *widget,
+                  const char *action_name,
+                  GVariant   *parameter)
+{
+  PaintWindow *self = PAINT_WINDOW (widget);
+  canvas_region_cancel_fill (self->canvas_region);
+}
+
 static void
 paint_window_class_init (PaintWindowClass *klass)
 {
@@ -227,6 +341,7 @@ paint_window_class_init (PaintWindowClass *klass)
   gtk_widget_class_bind_template_child (widget_class, PaintWindow, toolbar);
   gtk_widget_class_bind_template_child (widget_class, PaintWindow, canvas_region);
   gtk_widget_class_bind_template_child (widget_class, PaintWindow, size_label);
+  gtk_widget_class_bind_template_child (widget_class, PaintWindow, fill_progress_bar);
 
   /* Callback */
   gtk_widget_class_bind_template_callback (widget_class, on_close_request);
@@ -237,6 +352,7 @@ paint_window_class_init (PaintWindowClass *klass)
   gtk_widget_class_bind_template_callback (widget_class, on_canvas_region_color_picked);
   gtk_widget_class_bind_template_callback (widget_class, on_canvas_region_resize);
   gtk_widget_class_bind_template_callback (widget_class, on_canvas_region_tool_change);
+  gtk_widget_class_bind_template_callback (widget_class, on_canvas_region_fill_progress);
 
   /* Actions */
   gtk_widget_class_install_action (widget_class, "win.undo", NULL, undo_activated);
@@ -244,6 +360,12 @@ paint_window_class_init (PaintWindowClass *klass)
   gtk_widget_class_install_action (widget_class, "win.save", NULL, save_activated);
   gtk_widget_class_install_action (widget_class, "win.open", NULL, open_activated);
   gtk_widget_class_install_action (widget_class, "win.select-all", NULL, select_all);
+  gtk_widget_class_install_action (widget_class, "win.delete-selection", NULL, delete_selection_activated);
+  gtk_widget_class_install_action (widget_class, "win.fill-selection", NULL, fill_selection_activated);
+  gtk_widget_class_install_action (widget_class, "win.copy", NULL, copy_activated);
+  gtk_widget_class_install_action (widget_class, "win.cut", NULL, cut_activated);
+  gtk_widget_class_install_action (widget_class, "win.paste", NULL, paste_activated);
+  gtk_widget_class_install_action (widget_class, "win.cancel", NULL, cancel_activated);
 
   /* Types */
   g_type_ensure (PAINT_TYPE_CANVAS_REGION);
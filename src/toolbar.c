@@ -34,6 +34,11 @@ struct _Toolbar
   GtkBox                parent_type;
   GtkColorDialogButton *color_button;
   GtkSpinButton        *drawing_size_spin_button;
+  GtkSpinButton        *brush_hardness_spin_button;
+  GtkSpinButton        *brush_opacity_spin_button;
+  GtkSpinButton        *fill_tolerance_spin_button;
+  GtkSpinButton        *fill_gap_spin_button;
+  GtkCheckButton       *fill_everywhere_check_button;
 
   /* Drawing tools buttons */
   GtkButton            *currently_selected_button;
@@ -47,6 +52,8 @@ struct _Toolbar
   GtkButton            *fill_button;
   GtkButton            *color_picker_button;
   GtkButton            *select_button;
+  GtkButton            *magic_wand_button;
+  GtkButton            *lasso_button;
 };
 
 G_DEFINE_FINAL_TYPE (Toolbar, toolbar, GTK_TYPE_BOX);
@@ -159,6 +166,22 @@ on_select_button_click (GtkButton *button,
   update_current_selected_tool (self, self->select_button, SELECT);
 }
 
+static void
+on_magic_wand_button_click (GtkButton *button,
+                            gpointer   user_data)
+{
+  Toolbar *self = user_data;
+  update_current_selected_tool (self, self->magic_wand_button, MAGIC_WAND);
+}
+
+static void
+on_lasso_button_click (GtkButton *button,
+                       gpointer   user_data)
+{
+  Toolbar *self = user_data;
+  update_current_selected_tool (self, self->lasso_button, LASSO);
+}
+
 static void
 toolbar_init (Toolbar *self)
 {
@@ -186,6 +209,11 @@ toolbar_class_init (ToolbarClass *klass)
   /* Widgets */
   gtk_widget_class_bind_template_child (widget_class, Toolbar, color_button);
   gtk_widget_class_bind_template_child (widget_class, Toolbar, drawing_size_spin_button);
+  gtk_widget_class_bind_template_child (widget_class, Toolbar, brush_hardness_spin_button);
+  gtk_widget_class_bind_template_child (widget_class, Toolbar, brush_opacity_spin_button);
+  gtk_widget_class_bind_template_child (widget_class, Toolbar, fill_tolerance_spin_button);
+  gtk_widget_class_bind_template_child (widget_class, Toolbar, fill_gap_spin_button);
+  gtk_widget_class_bind_template_child (widget_class, Toolbar, fill_everywhere_check_button);
   gtk_widget_class_bind_template_child (widget_class, Toolbar, brush_button);
   gtk_widget_class_bind_template_child (widget_class, Toolbar, eraser_button);
   gtk_widget_class_bind_template_child (widget_class, Toolbar, rectangle_button);
@@ -195,6 +223,8 @@ toolbar_class_init (ToolbarClass *klass)
   gtk_widget_class_bind_template_child (widget_class, Toolbar, fill_button);
   gtk_widget_class_bind_template_child (widget_class, Toolbar, color_picker_button);
   gtk_widget_class_bind_template_child (widget_class, Toolbar, select_button);
+  gtk_widget_class_bind_template_child (widget_class, Toolbar, magic_wand_button);
+  gtk_widget_class_bind_template_child (widget_class, Toolbar, lasso_button);
 
   /* Callbacks */
   gtk_widget_class_bind_template_callback (widget_class, on_open_button_click);
@@ -208,6 +238,8 @@ toolbar_class_init (ToolbarClass *klass)
   gtk_widget_class_bind_template_callback (widget_class, on_fill_button_click);
   gtk_widget_class_bind_template_callback (widget_class, on_color_picker_button_click);
   gtk_widget_class_bind_template_callback (widget_class, on_select_button_click);
+  gtk_widget_class_bind_template_callback (widget_class, on_magic_wand_button_click);
+  gtk_widget_class_bind_template_callback (widget_class, on_lasso_button_click);
 
   /* Signals */
   toolbar_signals[OPEN_FILE] = g_signal_new ("open-file",
@@ -257,6 +289,36 @@ toolbar_get_draw_size (Toolbar *self)
   return gtk_spin_button_get_value (self->drawing_size_spin_button);
 }
 
+gdouble
+toolbar_get_brush_hardness (Toolbar *self)
+{
+  return gtk_spin_button_get_value (self->brush_hardness_spin_button);
+}
+
+gdouble
+toolbar_get_brush_opacity (Toolbar *self)
+{
+  return gtk_spin_button_get_value (self->brush_opacity_spin_button);
+}
+
+gdouble
+toolbar_get_fill_tolerance (Toolbar *self)
+{
+  return gtk_spin_button_get_value (self->fill_tolerance_spin_button);
+}
+
+gint
+toolbar_get_fill_gap (Toolbar *self)
+{
+  return gtk_spin_button_get_value_as_int (self->fill_gap_spin_button);
+}
+
+gboolean
+toolbar_get_fill_everywhere (Toolbar *self)
+{
+  return gtk_check_button_get_active (self->fill_everywhere_check_button);
+}
+
 void
 toolbar_set_selected_color (Toolbar *self,
                             GdkRGBA *color)
@@ -301,6 +363,12 @@ toolbar_set_selected_tool (Toolbar          *self,
     case COLOR_PICKER:
       selected_tool = self->color_picker_button;
       break;
+    case MAGIC_WAND:
+      selected_tool = self->magic_wand_button;
+      break;
+    case LASSO:
+      selected_tool = self->lasso_button;
+      break;
     default:
       g_message ("Unknown tool %d", tool);
       break;
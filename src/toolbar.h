@@ -32,6 +32,11 @@ G_DECLARE_FINAL_TYPE (Toolbar, toolbar, PAINT, TOOLBAR, GtkBox)
 const GdkRGBA *toolbar_get_current_color       (Toolbar          *self);
 
 gdouble        toolbar_get_draw_size           (Toolbar          *self);
+gdouble        toolbar_get_brush_hardness      (Toolbar          *self);
+gdouble        toolbar_get_brush_opacity       (Toolbar          *self);
+gdouble        toolbar_get_fill_tolerance      (Toolbar          *self);
+gint           toolbar_get_fill_gap            (Toolbar          *self);
+gboolean       toolbar_get_fill_everywhere     (Toolbar          *self);
 void           toolbar_set_selected_color      (Toolbar          *self,
                                                 GdkRGBA          *color);
 
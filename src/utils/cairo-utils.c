@@ -78,43 +78,72 @@ cairo_get_pixel_color_at (guchar          *pixels,
 }
 
 
-/* The moving work by making a new surface that copies the rectangle
- * and then repaint in the new position */
+/* The moving works by whitening the original rectangle and then painting
+ * the copied pixels of the rectangle in the new position */
 void
-cairo_move_rectangle (cairo_surface_t *src_surface,
+cairo_move_rectangle (cairo_surface_t *copy_surface,
                       cairo_t         *cr,
                       GdkRectangle    *from,
                       GdkRectangle    *to)
 {
-  cairo_surface_t *copy_surface;
-  cairo_t *copy_cr;
   gint copy_area_width;
   gint copy_area_height;
 
-  // To not copy anything outside the surface
-  copy_area_width = from->width + from->x > cairo_image_surface_get_width (src_surface) ?
-      cairo_image_surface_get_width (src_surface) - from->x : from->width;
-
-  copy_area_height = from->height + from->y > cairo_image_surface_get_height (src_surface) ?
-      cairo_image_surface_get_height (src_surface) - from->y : from->height;
-  
-  copy_surface = cairo_image_surface_create (cairo_image_surface_get_format (src_surface),
-                                             copy_area_width, copy_area_height);
-  
-  copy_cr = cairo_create (copy_surface);
-  cairo_set_source_surface (copy_cr, src_surface, -from->x, -from->y);
-  
-  cairo_paint (copy_cr);
+  copy_area_width = cairo_image_surface_get_width (copy_surface);
+  copy_area_height = cairo_image_surface_get_height (copy_surface);
+
+  cairo_save (cr);
 
   // Whitening the original rectangle
   cairo_rectangle (cr, from->x, from->y, copy_area_width, copy_area_height);
   cairo_set_source_rgb (cr, 1, 1, 1);
   cairo_fill (cr);
-  
+
   cairo_set_source_surface (cr, copy_surface, to->x, to->y);
-  
   cairo_paint (cr);
-  
-  cairo_surface_destroy (copy_surface);
-  cairo_destroy (copy_cr);
+
+  cairo_restore (cr);
+}
+
+/* Copies the pixels inside rect from src to the same position in dst,
+ * both surfaces must have the same format. Returns the number of bytes copied. */
+gsize
+cairo_copy_rectangle (cairo_surface_t *src,
+                      cairo_surface_t *dst,
+                      GdkRectangle    *rect)
+{
+  GdkRectangle area;
+  guchar *src_pixels;
+  guchar *dst_pixels;
+  gint src_stride;
+  gint dst_stride;
+  gsize row_size;
+
+  area.x = 0;
+  area.y = 0;
+  area.width = MIN (cairo_image_surface_get_width (src), cairo_image_surface_get_width (dst));
+  area.height = MIN (cairo_image_surface_get_height (src), cairo_image_surface_get_height (dst));
+
+  if (!gdk_rectangle_intersect (&area, rect, &area))
+    return 0;
+
+  cairo_surface_flush (src);
+  cairo_surface_flush (dst);
+
+  src_stride = cairo_image_surface_get_stride (src);
+  dst_stride = cairo_image_surface_get_stride (dst);
+  src_pixels = cairo_image_surface_get_data (src) + area.y * src_stride + area.x * 4;
+  dst_pixels = cairo_image_surface_get_data (dst) + area.y * dst_stride + area.x * 4;
+  row_size = area.width * 4;
+
+  for (gint y = 0; y < area.height; y++)
+    {
+      memcpy (dst_pixels, src_pixels, row_size);
+      src_pixels += src_stride;
+      dst_pixels += dst_stride;
+    }
+
+  cairo_surface_mark_dirty_rectangle (dst, area.x, area.y, area.width, area.height);
+
+  return row_size * area.height;
 }
@@ -28,7 +28,11 @@ GdkRGBA         *cairo_get_pixel_color_at (guchar          *pixels,
                                            gint             x,
                                            gint             y);
 
-void             cairo_move_rectangle     (cairo_surface_t *src,
+void             cairo_move_rectangle     (cairo_surface_t *copy_surface,
                                            cairo_t         *cr,
                                            GdkRectangle    *from,
                                            GdkRectangle    *to);
+
+gsize            cairo_copy_rectangle     (cairo_surface_t *src,
+                                           cairo_surface_t *dst,
+                                           GdkRectangle    *rect);
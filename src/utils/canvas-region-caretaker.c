@@ -32,9 +32,23 @@ struct _CanvasRegionCaretaker {
   SnapshotNode *current;
   SnapshotNode *head;
   gint          length;
-};
 
-static const gint MAX_NUMBER_OF_SNAPSHOTS = 16;
+  /* Sum of the sizes of the snapshots kept in memory, in bytes */
+  gsize         size;
+  gsize         max_size;
+
+  /* Snapshots older than the last resident_count ones are spilled, zero turns
+   * spilling off. The file is created for the first spilled snapshot and closed
+   * when there are none left. */
+  SpillFile    *spill_file;
+  gchar        *spill_directory;
+  guint         resident_count;
+  gint          spilled_count;
+
+  /* Sum of the sizes of the snapshots in the spill file, in bytes */
+  gsize         spilled_size;
+  gsize         max_spilled_size;
+};
 
 static SnapshotNode *
 snapshot_node_new (void)
@@ -53,31 +67,176 @@ snapshot_node_dispose (SnapshotNode *node)
   g_free (node);
 }
 
+static void
+remove_node (CanvasRegionCaretaker *self,
+             SnapshotNode          *node)
+{
+  self->size -= node->snapshot->size;
+  self->spilled_size -= canvas_region_snapshot_get_spill_size (node->snapshot);
+  self->length -= 1;
+
+  if (node->snapshot->spill_file != NULL)
+    self->spilled_count -= 1;
+
+  snapshot_node_dispose (node);
+
+  if (self->spilled_count == 0)
+    g_clear_pointer (&self->spill_file, spill_file_dispose);
+}
+
 /**
  * Passed node is not included
  */
 static void
-free_all_next_nodes (SnapshotNode *node)
+free_all_next_nodes (CanvasRegionCaretaker *self,
+                     SnapshotNode          *node)
 {
   SnapshotNode *current, *temp;
   current = node->next;
+  node->next = NULL;
   
   while (current != NULL)
     {
       temp = current->next;
-      snapshot_node_dispose (current);
+      remove_node (self, current);
       current = temp;
     }
 }
 
+/**
+ * Spills the snapshots older than the resident ones, stopping at the first one
+ * that is already spilled since the older ones are too.
+ */
+static void
+spill_old_nodes (CanvasRegionCaretaker *self)
+{
+  SnapshotNode *node;
+  gsize size;
+
+  if (self->resident_count == 0)
+    return;
+
+  node = self->current;
+
+  for (guint i = 0; node != NULL && i < self->resident_count; i++)
+    node = node->previous;
+
+  for (; node != NULL && node->snapshot->spill_file == NULL; node = node->previous)
+    {
+      if (!canvas_region_snapshot_can_spill (node->snapshot))
+        continue;
+
+      if (self->spill_file == NULL)
+        self->spill_file = spill_file_new (self->spill_directory);
+
+      if (self->spill_file == NULL)
+        return;
+
+      size = node->snapshot->size;
+
+      if (!canvas_region_snapshot_spill (node->snapshot, self->spill_file))
+        return;
+
+      self->size -= size - node->snapshot->size;
+      self->spilled_size += canvas_region_snapshot_get_spill_size (node->snapshot);
+      self->spilled_count += 1;
+    }
+}
+
+/**
+ * Drops the oldest snapshots until the history fits in max_size and the spilled
+ * ones fit in max_spilled_size, the current snapshot is always kept.
+ */
+static void
+free_oldest_nodes_over_max_size (CanvasRegionCaretaker *self)
+{
+  SnapshotNode *temp;
+
+  while ((self->size > self->max_size || self->spilled_size > self->max_spilled_size) &&
+         self->head != self->current)
+    {
+      temp = self->head->next;
+      temp->previous = NULL;
+      remove_node (self, self->head);
+      self->head = temp;
+    }
+}
+
+/**
+ * Rewrites the spilled snapshots to a new file once most of the file is taken by
+ * dropped snapshots, which only give their space back when they were at the end
+ * of the file. Each byte is rewritten at most as many times as dropped bytes
+ * were written, so the rewrite stays cheap over time.
+ */
+static void
+compact_spill_file (CanvasRegionCaretaker *self)
+{
+  SpillFile *spill_file;
+  SnapshotNode *node;
+  goffset *offsets;
+  gint i;
+
+  if (self->spill_file == NULL ||
+      spill_file_get_length (self->spill_file) <= 2 * spill_file_get_live_length (self->spill_file))
+    return;
+
+  spill_file = spill_file_new (self->spill_directory);
+
+  if (spill_file == NULL)
+    return;
+
+  // The snapshots only move once all of them are copied, a failed copy keeps the old file
+  offsets = g_new (goffset, 2 * self->spilled_count);
+  i = 0;
+
+  for (node = self->head; node != NULL; node = node->next)
+    {
+      if (node->snapshot->spill_file == NULL)
+        continue;
+
+      if (!canvas_region_snapshot_copy_spill (node->snapshot, spill_file, &offsets[i], &offsets[i + 1]))
+        {
+          spill_file_dispose (spill_file);
+          g_free (offsets);
+          return;
+        }
+
+      i += 2;
+    }
+
+  i = 0;
+
+  for (node = self->head; node != NULL; node = node->next)
+    {
+      if (node->snapshot->spill_file == NULL)
+        continue;
+
+      node->snapshot->spill_file = spill_file;
+      node->snapshot->before_offset = offsets[i];
+      node->snapshot->after_offset = offsets[i + 1];
+      i += 2;
+    }
+
+  spill_file_dispose (self->spill_file);
+  self->spill_file = spill_file;
+  g_free (offsets);
+}
 
 CanvasRegionCaretaker *
-canvas_region_caretaker_new (void)
+canvas_region_caretaker_new (gsize max_size)
 {
   CanvasRegionCaretaker *obj = g_malloc (sizeof (CanvasRegionCaretaker));
   obj->current = NULL;
   obj->head = NULL;
   obj->length = 0;
+  obj->size = 0;
+  obj->max_size = max_size;
+  obj->spill_file = NULL;
+  obj->spill_directory = NULL;
+  obj->resident_count = 0;
+  obj->spilled_count = 0;
+  obj->spilled_size = 0;
+  obj->max_spilled_size = G_MAXSIZE;
   return obj;
 }
 
@@ -86,10 +245,12 @@ canvas_region_caretaker_dispose (CanvasRegionCaretaker *self)
 {
   if (self->head != NULL)
     {
-      free_all_next_nodes (self->head);
-      snapshot_node_dispose (self->head);
+      free_all_next_nodes (self, self->head);
+      remove_node (self, self->head);
     }
 
+  g_clear_pointer (&self->spill_file, spill_file_dispose);
+  g_free (self->spill_directory);
   g_free (self);
 }
 
@@ -97,7 +258,6 @@ void
 canvas_region_caretaker_save_snapshot (CanvasRegionCaretaker *self,
                                        CanvasRegionSnapshot  *snapshot)
 {
-  SnapshotNode *temp;
   SnapshotNode *node;
 
   node = snapshot_node_new ();
@@ -105,43 +265,53 @@ canvas_region_caretaker_save_snapshot (CanvasRegionCaretaker *self,
 
   if (self->head == NULL)
     {
+      self->size = snapshot->size;
       self->head = node;
       self->current = node;
       self->length = 1;
       return;
     }
 
-  if (self->length == MAX_NUMBER_OF_SNAPSHOTS)
-    {
-      temp = self->head->next;
-      temp->previous = NULL;
-      snapshot_node_dispose (self->head);
-      self->head = temp;
-    }
-  else
-    {
-      self->length += 1;
-    }
+  free_all_next_nodes (self, self->current);
 
-  free_all_next_nodes (self->current);
+  self->size += snapshot->size;
+  self->length += 1;
 
   node->previous = self->current;
   self->current->next = node;
   self->current = node;
+
+  spill_old_nodes (self);
+  free_oldest_nodes_over_max_size (self);
+  compact_spill_file (self);
+
+  g_debug ("Undo history has %d snapshots using %" G_GSIZE_FORMAT " bytes and %" G_GSIZE_FORMAT
+           " bytes spilled", self->length, self->size, self->spilled_size);
 }
 
+/**
+ * Moves to the previous snapshot, returns the snapshot that has to be reverted
+ * or NULL if there is nothing to undo.
+ */
 CanvasRegionSnapshot *
-canvas_region_caretaker_previous_snapshot (CanvasRegionCaretaker *self)
+canvas_region_caretaker_undo (CanvasRegionCaretaker *self)
 {
+  CanvasRegionSnapshot *snapshot;
+
   if (self->current == NULL || self->current->previous == NULL)
     return NULL;
   
+  snapshot = self->current->snapshot;
   self->current = self->current->previous;
-  return self->current->snapshot;
+  return snapshot;
 }
 
+/**
+ * Moves to the next snapshot, returns the snapshot that has to be applied or
+ * NULL if there is nothing to redo.
+ */
 CanvasRegionSnapshot *
-canvas_region_caretaker_next_snapshot (CanvasRegionCaretaker *self)
+canvas_region_caretaker_redo (CanvasRegionCaretaker *self)
 {
   if (self->current == NULL || self->current->next == NULL)
     return NULL;
@@ -150,6 +320,12 @@ canvas_region_caretaker_next_snapshot (CanvasRegionCaretaker *self)
   return self->current->snapshot;
 }
 
+CanvasRegionSnapshot *
+canvas_region_caretaker_get_current_snapshot (CanvasRegionCaretaker *self)
+{
+  return self->current == NULL ? NULL : self->current->snapshot;
+}
+
 void
 canvas_region_mark_current_snapshot_as_saved (CanvasRegionCaretaker *self)
 {
@@ -171,3 +347,40 @@ canvas_region_mark_current_snapshot_as_saved (CanvasRegionCaretaker *self)
   
   self->current->snapshot->is_current_file_saved = true;
 }
+
+gsize
+canvas_region_caretaker_get_size (CanvasRegionCaretaker *self)
+{
+  return self->size;
+}
+
+void
+canvas_region_caretaker_set_max_size (CanvasRegionCaretaker *self,
+                                      gsize                  max_size)
+{
+  self->max_size = max_size;
+  free_oldest_nodes_over_max_size (self);
+  compact_spill_file (self);
+}
+
+/**
+ * Spilled snapshots are written to an unlinked file in directory, the temporary
+ * directory is used if it is NULL or empty. A new directory is used the next time
+ * the file is created. The oldest snapshots are dropped when the spilled ones take
+ * more than max_spilled_size bytes.
+ */
+void
+canvas_region_caretaker_set_spill_options (CanvasRegionCaretaker *self,
+                                           const gchar           *directory,
+                                           guint                  resident_count,
+                                           gsize                  max_spilled_size)
+{
+  g_free (self->spill_directory);
+  self->spill_directory = g_strdup (directory);
+  self->resident_count = resident_count;
+  self->max_spilled_size = max_spilled_size;
+
+  spill_old_nodes (self);
+  free_oldest_nodes_over_max_size (self);
+  compact_spill_file (self);
+}
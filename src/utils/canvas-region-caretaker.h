@@ -26,13 +26,22 @@ struct _CanvasRegionCaretaker;
 
 typedef struct _CanvasRegionCaretaker CanvasRegionCaretaker;
 
-CanvasRegionCaretaker *canvas_region_caretaker_new                  (void);
+CanvasRegionCaretaker *canvas_region_caretaker_new                  (gsize                  max_size);
 void                   canvas_region_caretaker_dispose              (CanvasRegionCaretaker *self);
 
 void                   canvas_region_caretaker_save_snapshot        (CanvasRegionCaretaker *self,
                                                                      CanvasRegionSnapshot  *snapshot);
 
-CanvasRegionSnapshot  *canvas_region_caretaker_previous_snapshot    (CanvasRegionCaretaker *self);
-CanvasRegionSnapshot  *canvas_region_caretaker_next_snapshot        (CanvasRegionCaretaker *self);
+CanvasRegionSnapshot  *canvas_region_caretaker_undo                 (CanvasRegionCaretaker *self);
+CanvasRegionSnapshot  *canvas_region_caretaker_redo                 (CanvasRegionCaretaker *self);
+CanvasRegionSnapshot  *canvas_region_caretaker_get_current_snapshot (CanvasRegionCaretaker *self);
 
 void                   canvas_region_mark_current_snapshot_as_saved (CanvasRegionCaretaker *self);
+
+gsize                  canvas_region_caretaker_get_size             (CanvasRegionCaretaker *self);
+void                   canvas_region_caretaker_set_max_size         (CanvasRegionCaretaker *self,
+                                                                     gsize                  max_size);
+void                   canvas_region_caretaker_set_spill_options    (CanvasRegionCaretaker *self,
+                                                                     const gchar           *directory,
+                                                                     guint                  resident_count,
+                                                                     gsize                  max_spilled_size);
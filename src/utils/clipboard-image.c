@@ -0,0 +1,190 @@
+/* clipboard-image.c
+ *
+ * Copyright 2023 Rami Alkawadri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+
+#include "clipboard-image.h"
+
+/* The formats GdkTexture can decode, in order of preference */
+static const gchar *IMAGE_MIME_TYPES[] = { "image/png", "image/tiff", "image/jpeg", NULL };
+
+/* The image as it was read from the clipboard, only one of them is set */
+typedef struct _ClipboardImageTaskData {
+  GBytes     *bytes;
+  GdkTexture *texture;
+} ClipboardImageTaskData;
+
+static void
+clipboard_image_task_data_free (gpointer data)
+{
+  ClipboardImageTaskData *task_data = data;
+
+  g_clear_pointer (&task_data->bytes, g_bytes_unref);
+  g_clear_object (&task_data->texture);
+  g_free (task_data);
+}
+
+/**
+ * Decodes the image into an ARGB32 surface, it keeps its transparency so it can
+ * be painted over the image. Pixels that are outside of a copied mask stay
+ * transparent this way.
+ */
+static void
+decode_thread (GTask        *task,
+               gpointer      source_object,
+               gpointer      data,
+               GCancellable *cancellable)
+{
+  ClipboardImageTaskData *task_data = data;
+  cairo_surface_t *surface;
+  GError *error = NULL;
+  gint width;
+  gint height;
+
+  if (task_data->texture == NULL)
+    {
+      task_data->texture = gdk_texture_new_from_bytes (task_data->bytes, &error);
+
+      if (task_data->texture == NULL)
+        {
+          g_task_return_error (task, error);
+          return;
+        }
+    }
+
+  width = gdk_texture_get_width (task_data->texture);
+  height = gdk_texture_get_height (task_data->texture);
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+
+  if (cairo_surface_status (surface) != CAIRO_STATUS_SUCCESS)
+    {
+      cairo_surface_destroy (surface);
+      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NO_SPACE, "The image is too big to paste");
+      return;
+    }
+
+  // Downloaded pixels are premultiplied, like ARGB32 surfaces
+  gdk_texture_download (task_data->texture,
+                        cairo_image_surface_get_data (surface),
+                        cairo_image_surface_get_stride (surface));
+  cairo_surface_mark_dirty (surface);
+  g_task_return_pointer (task, surface, (GDestroyNotify) cairo_surface_destroy);
+}
+
+static void
+on_clipboard_spliced (GObject      *source_object,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+  GTask *task = user_data;
+  ClipboardImageTaskData *task_data;
+  GError *error = NULL;
+
+  if (g_output_stream_splice_finish (G_OUTPUT_STREAM (source_object), result, &error) < 0)
+    {
+      g_task_return_error (task, error);
+      g_object_unref (task);
+      return;
+    }
+
+  task_data = g_task_get_task_data (task);
+  task_data->bytes = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (source_object));
+  g_task_run_in_thread (task, decode_thread);
+  g_object_unref (task);
+}
+
+static void
+on_clipboard_read (GObject      *source_object,
+                   GAsyncResult *result,
+                   gpointer      user_data)
+{
+  GTask *task = user_data;
+  GInputStream *stream;
+  GOutputStream *output;
+  GError *error = NULL;
+
+  stream = gdk_clipboard_read_finish (GDK_CLIPBOARD (source_object), result, NULL, &error);
+
+  if (stream == NULL)
+    {
+      g_task_return_error (task, error);
+      g_object_unref (task);
+      return;
+    }
+
+  output = g_memory_output_stream_new_resizable ();
+  g_output_stream_splice_async (output, stream,
+                                G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE | G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                                G_PRIORITY_DEFAULT, g_task_get_cancellable (task),
+                                on_clipboard_spliced, task);
+  g_object_unref (output);
+  g_object_unref (stream);
+}
+
+/**
+ * Reads the image in the clipboard. An image copied from this application is
+ * already a texture and is used as is, others are read as encoded bytes first.
+ */
+void
+clipboard_image_read_async (GdkClipboard        *clipboard,
+                            GCancellable        *cancellable,
+                            GAsyncReadyCallback  callback,
+                            gpointer             user_data)
+{
+  ClipboardImageTaskData *task_data;
+  GdkContentProvider *content;
+  GValue value = G_VALUE_INIT;
+  GTask *task;
+
+  task_data = g_new0 (ClipboardImageTaskData, 1);
+
+  task = g_task_new (clipboard, cancellable, callback, user_data);
+  g_task_set_source_tag (task, clipboard_image_read_async);
+  g_task_set_task_data (task, task_data, clipboard_image_task_data_free);
+
+  content = gdk_clipboard_get_content (clipboard);
+  g_value_init (&value, GDK_TYPE_TEXTURE);
+
+  if (content != NULL && gdk_content_provider_get_value (content, &value, NULL))
+    {
+      task_data->texture = g_value_dup_object (&value);
+      g_value_unset (&value);
+      g_task_run_in_thread (task, decode_thread);
+      g_object_unref (task);
+      return;
+    }
+
+  g_value_unset (&value);
+  gdk_clipboard_read_async (clipboard, IMAGE_MIME_TYPES, G_PRIORITY_DEFAULT,
+                            cancellable, on_clipboard_read, task);
+}
+
+/**
+ * Returns an ARGB32 surface with the image in the clipboard, or NULL if there
+ * is no image that can be read.
+ */
+cairo_surface_t *
+clipboard_image_read_finish (GdkClipboard  *clipboard,
+                             GAsyncResult  *result,
+                             GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, clipboard), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
@@ -0,0 +1,36 @@
+/* clipboard-image.h
+ *
+ * Copyright 2023 Rami Alkawadri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+/* Reading of images from the clipboard. The image is decoded on a worker thread
+ * so a big paste does not stall the window. */
+
+void             clipboard_image_read_async  (GdkClipboard         *clipboard,
+                                              GCancellable         *cancellable,
+                                              GAsyncReadyCallback   callback,
+                                              gpointer              user_data);
+
+cairo_surface_t *clipboard_image_read_finish (GdkClipboard         *clipboard,
+                                              GAsyncResult         *result,
+                                              GError              **error);
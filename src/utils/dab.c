@@ -0,0 +1,509 @@
+/* dab.c
+ *
+ * Copyright 2023 Rami Alkawadri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "utils/dab.h"
+#include "utils/pixel-kernels.h"
+
+/* Dab centers are rounded to a fraction 1 / SUBPIXEL_STEPS of a pixel, small
+ * brushes would wobble if they were rounded to whole pixels */
+#define SUBPIXEL_STEPS 4
+
+// Enough for all the positions of two sizes, brushes rarely change size in a stroke
+#define DAB_CACHE_SIZE (2 * SUBPIXEL_STEPS * SUBPIXEL_STEPS)
+
+// Resolution of the falloff of a stroke, in entries per pixel of distance
+#define FALLOFF_STEPS_PER_PIXEL 16
+
+/* The coverage of a stroke is kept in square chunks, allocated the first time
+ * a dab reaches them */
+#define CHUNK_SIZE 64
+
+// Dabs are a quarter of their size apart, but not closer than this
+#define MIN_SPACING 0.5
+
+typedef struct _Dab {
+  gdouble  size;
+  gdouble  hardness;
+  gint     step_x;
+  gint     step_y;
+
+  /* Coverage of the (2 * reach + 1)² pixels around the pixel of the center */
+  gint     reach;
+  guint8  *coverage;
+} Dab;
+
+typedef struct _DabPosition {
+  gint pixel_x;
+  gint pixel_y;
+  gint step_x;
+  gint step_y;
+} DabPosition;
+
+/* A straight piece of the path of a stroke, positions along it are found by
+ * their arc length from the start of the path */
+typedef struct _PathSegment {
+  gdouble start_x;
+  gdouble start_y;
+  gdouble end_x;
+  gdouble end_y;
+  gdouble start_length;
+  gdouble length;
+} PathSegment;
+
+struct _DabStroke {
+  gdouble     size;
+  gdouble     hardness;
+
+  /* Dabs added since the last render */
+  GArray     *positions;
+
+  /* Path, the segments from the one of the next dab on are kept. Dabs are
+   * spacing apart along the path, segment boundaries included. */
+  GArray     *segments;
+  gboolean    has_path;
+  gdouble     path_length;
+  gdouble     next_dab_length;
+  gdouble     spacing;
+  gdouble     last_x;
+  gdouble     last_y;
+
+  /* Coverage by distance from the center of a dab, the last entry is 0 */
+  guint8     *falloff;
+  gint        falloff_length;
+
+  /* Coverage of the dabs rendered so far, from chunk keys to chunks */
+  GHashTable *chunks;
+};
+
+// Most recently used first
+static Dab *dab_cache[DAB_CACHE_SIZE];
+
+/**
+ * Returns the coverage of a pixel at distance from the center of a dab of the
+ * given radius. The edge fades over one pixel for hard dabs and over the soft
+ * part of the radius for the others, easing in and out of the fade.
+ */
+static guint8
+get_coverage (gdouble distance,
+              gdouble radius,
+              gdouble hardness)
+{
+  gdouble fade;
+  gdouble t;
+
+  fade = MAX (radius * (1 - hardness), 1);
+  t = CLAMP ((radius + 0.5 - distance) / fade, 0, 1);
+
+  return round (t * t * (3 - 2 * t) * 255);
+}
+
+static Dab *
+dab_new (DabStroke *stroke,
+         gint       step_x,
+         gint       step_y)
+{
+  Dab *self;
+  gdouble center_x;
+  gdouble center_y;
+  gdouble delta_x;
+  gdouble delta_y;
+  gint step;
+  gint width;
+
+  self = g_new (Dab, 1);
+  self->size = stroke->size;
+  self->hardness = stroke->hardness;
+  self->step_x = step_x;
+  self->step_y = step_y;
+
+  self->reach = ceil (stroke->size / 2) + 1;
+  width = 2 * self->reach + 1;
+  self->coverage = g_malloc (width * width);
+
+  // Relative to the top left corner of the pixel of the center
+  center_x = (step_x + 0.5) / SUBPIXEL_STEPS;
+  center_y = (step_y + 0.5) / SUBPIXEL_STEPS;
+
+  for (gint y = 0; y < width; y++)
+    {
+      delta_y = y - self->reach + 0.5 - center_y;
+
+      for (gint x = 0; x < width; x++)
+        {
+          delta_x = x - self->reach + 0.5 - center_x;
+          step = sqrt (delta_x * delta_x + delta_y * delta_y) * FALLOFF_STEPS_PER_PIXEL + 0.5;
+          self->coverage[y * width + x] = stroke->falloff[MIN (step, stroke->falloff_length - 1)];
+        }
+    }
+
+  return self;
+}
+
+static void
+dab_dispose (Dab *self)
+{
+  g_free (self->coverage);
+  g_free (self);
+}
+
+/**
+ * Returns the cached dab of the stroke for the position inside a pixel,
+ * computing it if needed. The dab stays valid until the next call.
+ */
+static Dab *
+get_dab (DabStroke *stroke,
+         gint       step_x,
+         gint       step_y)
+{
+  Dab *dab;
+  gint index;
+
+  for (index = 0; index < DAB_CACHE_SIZE && dab_cache[index] != NULL; index++)
+    {
+      dab = dab_cache[index];
+
+      if (dab->size == stroke->size && dab->hardness == stroke->hardness &&
+          dab->step_x == step_x && dab->step_y == step_y)
+        break;
+    }
+
+  if (index < DAB_CACHE_SIZE && dab_cache[index] != NULL)
+    {
+      dab = dab_cache[index];
+    }
+  else
+    {
+      // The least recently used dab makes room for the new one
+      index = MIN (index, DAB_CACHE_SIZE - 1);
+      g_clear_pointer (&dab_cache[index], dab_dispose);
+      dab = dab_new (stroke, step_x, step_y);
+    }
+
+  memmove (&dab_cache[1], &dab_cache[0], index * sizeof (Dab *));
+  dab_cache[0] = dab;
+
+  return dab;
+}
+
+static gint
+get_chunk_index (gint coordinate)
+{
+  return coordinate >= 0 ? coordinate / CHUNK_SIZE : (coordinate - CHUNK_SIZE + 1) / CHUNK_SIZE;
+}
+
+static gpointer
+get_chunk_key (gint chunk_x,
+               gint chunk_y)
+{
+  // 16 bits per coordinate reach millions of pixels away
+  return GUINT_TO_POINTER ((guint) (chunk_y & 0xffff) << 16 | (guint) (chunk_x & 0xffff));
+}
+
+/**
+ * Copies the coverage of area between the chunks and rows, rows start at the
+ * top left corner of area. Missing chunks have no coverage, they are created
+ * when copying to the chunks.
+ */
+static void
+copy_coverage (DabStroke    *self,
+               guint8       *rows,
+               gint          stride,
+               GdkRectangle *area,
+               gboolean      to_chunks)
+{
+  GdkRectangle chunk_rect;
+  GdkRectangle part;
+  guint8 *chunk;
+  guint8 *chunk_row;
+  guint8 *row;
+
+  chunk_rect.width = CHUNK_SIZE;
+  chunk_rect.height = CHUNK_SIZE;
+
+  for (gint chunk_y = get_chunk_index (area->y);
+       chunk_y <= get_chunk_index (area->y + area->height - 1);
+       chunk_y++)
+    {
+      for (gint chunk_x = get_chunk_index (area->x);
+           chunk_x <= get_chunk_index (area->x + area->width - 1);
+           chunk_x++)
+        {
+          chunk = g_hash_table_lookup (self->chunks, get_chunk_key (chunk_x, chunk_y));
+
+          if (chunk == NULL)
+            {
+              if (!to_chunks)
+                continue;
+
+              chunk = g_malloc0 (CHUNK_SIZE * CHUNK_SIZE);
+              g_hash_table_insert (self->chunks, get_chunk_key (chunk_x, chunk_y), chunk);
+            }
+
+          chunk_rect.x = chunk_x * CHUNK_SIZE;
+          chunk_rect.y = chunk_y * CHUNK_SIZE;
+          gdk_rectangle_intersect (&chunk_rect, area, &part);
+
+          for (gint y = part.y; y < part.y + part.height; y++)
+            {
+              chunk_row = chunk + (y - chunk_rect.y) * CHUNK_SIZE + part.x - chunk_rect.x;
+              row = rows + (y - area->y) * stride + part.x - area->x;
+
+              if (to_chunks)
+                memcpy (chunk_row, row, part.width);
+              else
+                memcpy (row, chunk_row, part.width);
+            }
+        }
+    }
+}
+
+/**
+ * Creates a stroke of dabs of size pixels across, hardness goes from 0 for
+ * dabs that fade from their center to 1 for dabs with a sharp edge. The
+ * falloff is computed once here, the dabs only look it up.
+ */
+DabStroke *
+dab_stroke_new (gdouble size,
+                gdouble hardness)
+{
+  DabStroke *self;
+  gdouble radius;
+
+  self = g_new (DabStroke, 1);
+  self->size = size;
+  self->hardness = CLAMP (hardness, 0, 1);
+  self->positions = g_array_new (FALSE, FALSE, sizeof (DabPosition));
+  self->segments = g_array_new (FALSE, FALSE, sizeof (PathSegment));
+  self->has_path = false;
+  self->path_length = 0;
+  self->next_dab_length = 0;
+  self->spacing = MAX (size / 4, MIN_SPACING);
+  self->chunks = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+
+  radius = size / 2;
+  self->falloff_length = ceil ((radius + 0.5) * FALLOFF_STEPS_PER_PIXEL) + 1;
+  self->falloff = g_malloc (self->falloff_length);
+
+  for (gint i = 0; i < self->falloff_length; i++)
+    self->falloff[i] = get_coverage ((gdouble) i / FALLOFF_STEPS_PER_PIXEL, radius, self->hardness);
+
+  return self;
+}
+
+void
+dab_stroke_dispose (DabStroke *self)
+{
+  g_array_unref (self->positions);
+  g_array_unref (self->segments);
+  g_hash_table_unref (self->chunks);
+  g_free (self->falloff);
+  g_free (self);
+}
+
+/**
+ * Adds a dab centered at (x, y).
+ */
+static void
+add_dab (DabStroke *self,
+         gdouble    x,
+         gdouble    y)
+{
+  DabPosition position;
+
+  position.pixel_x = floor (x);
+  position.pixel_y = floor (y);
+  position.step_x = MIN ((x - position.pixel_x) * SUBPIXEL_STEPS, SUBPIXEL_STEPS - 1);
+  position.step_y = MIN ((y - position.pixel_y) * SUBPIXEL_STEPS, SUBPIXEL_STEPS - 1);
+
+  g_array_append_val (self->positions, position);
+}
+
+/**
+ * Adds the dabs that fall on the path up to its end, then drops the segments
+ * that end before the next dab.
+ */
+static void
+place_dabs (DabStroke *self)
+{
+  PathSegment *segment;
+  gdouble t;
+  guint index;
+
+  index = 0;
+
+  while (self->next_dab_length <= self->path_length)
+    {
+      segment = &g_array_index (self->segments, PathSegment, index);
+
+      if (self->next_dab_length > segment->start_length + segment->length)
+        {
+          index++;
+          continue;
+        }
+
+      t = (self->next_dab_length - segment->start_length) / segment->length;
+      add_dab (self,
+               segment->start_x + (segment->end_x - segment->start_x) * t,
+               segment->start_y + (segment->end_y - segment->start_y) * t);
+
+      self->next_dab_length += self->spacing;
+    }
+
+  while (index < self->segments->len)
+    {
+      segment = &g_array_index (self->segments, PathSegment, index);
+
+      if (segment->start_length + segment->length >= self->next_dab_length)
+        break;
+
+      index++;
+    }
+
+  g_array_remove_range (self->segments, 0, index);
+}
+
+/**
+ * Starts the path of the stroke at (x, y), with a dab there.
+ */
+void
+dab_stroke_move_to (DabStroke *self,
+                    gdouble    x,
+                    gdouble    y)
+{
+  g_array_set_size (self->segments, 0);
+  self->has_path = true;
+  self->path_length = 0;
+  self->last_x = x;
+  self->last_y = y;
+
+  add_dab (self, x, y);
+  self->next_dab_length = self->spacing;
+}
+
+/**
+ * Extends the path of the stroke with a straight segment to (x, y) and adds
+ * the dabs that fall on it. The spacing is measured along the whole path, so
+ * short segments may get no dab at all.
+ */
+void
+dab_stroke_line_to (DabStroke *self,
+                    gdouble    x,
+                    gdouble    y)
+{
+  PathSegment segment;
+
+  if (!self->has_path)
+    {
+      dab_stroke_move_to (self, x, y);
+      return;
+    }
+
+  segment.start_x = self->last_x;
+  segment.start_y = self->last_y;
+  segment.end_x = x;
+  segment.end_y = y;
+  segment.start_length = self->path_length;
+  segment.length = hypot (x - self->last_x, y - self->last_y);
+
+  if (segment.length == 0)
+    return;
+
+  g_array_append_val (self->segments, segment);
+  self->path_length += segment.length;
+  self->last_x = x;
+  self->last_y = y;
+
+  place_dabs (self);
+}
+
+/**
+ * Blends the dabs added since the last render into the coverage of the stroke
+ * and returns a mask with that coverage over the bounding box of those dabs,
+ * which is stored in area. Where dabs overlap, also with the dabs of earlier
+ * renders, the coverage builds up with the OVER operator and never goes over
+ * full, so the mask is meant to be blended over the pixels from before the
+ * stroke. Returns NULL if no dabs were added.
+ */
+cairo_surface_t *
+dab_stroke_render (DabStroke    *self,
+                   GdkRectangle *area)
+{
+  cairo_surface_t *mask;
+  DabPosition *position;
+  Dab *dab;
+  guint8 *mask_data;
+  gint reach;
+  gint dab_width;
+  gint stride;
+  gint min_x;
+  gint min_y;
+  gint max_x;
+  gint max_y;
+
+  if (self->positions->len == 0)
+    return NULL;
+
+  // All the dabs of a stroke have the same reach
+  reach = ceil (self->size / 2) + 1;
+  dab_width = 2 * reach + 1;
+
+  min_x = min_y = G_MAXINT;
+  max_x = max_y = G_MININT;
+
+  for (guint i = 0; i < self->positions->len; i++)
+    {
+      position = &g_array_index (self->positions, DabPosition, i);
+      min_x = MIN (min_x, position->pixel_x - reach);
+      min_y = MIN (min_y, position->pixel_y - reach);
+      max_x = MAX (max_x, position->pixel_x + reach);
+      max_y = MAX (max_y, position->pixel_y + reach);
+    }
+
+  area->x = min_x;
+  area->y = min_y;
+  area->width = max_x - min_x + 1;
+  area->height = max_y - min_y + 1;
+
+  mask = cairo_image_surface_create (CAIRO_FORMAT_A8, area->width, area->height);
+  mask_data = cairo_image_surface_get_data (mask);
+  stride = cairo_image_surface_get_stride (mask);
+
+  copy_coverage (self, mask_data, stride, area, false);
+
+  for (guint i = 0; i < self->positions->len; i++)
+    {
+      position = &g_array_index (self->positions, DabPosition, i);
+      dab = get_dab (self, position->step_x, position->step_y);
+
+      // Same as painting the dab over the mask with the OVER operator
+      for (gint y = 0; y < dab_width; y++)
+        pixel_blend_coverage (mask_data + (position->pixel_y - reach - min_y + y) * stride +
+                              position->pixel_x - reach - min_x,
+                              dab->coverage + y * dab_width,
+                              dab_width);
+    }
+
+  copy_coverage (self, mask_data, stride, area, true);
+  g_array_set_size (self->positions, 0);
+
+  cairo_surface_mark_dirty (mask);
+
+  return mask;
+}
@@ -0,0 +1,47 @@
+/* dab.h
+ *
+ * Copyright 2023 Rami Alkawadri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+/* A dab is the round mark a brush leaves at one point of a stroke. The
+ * coverage of a dab only depends on its size, its hardness and where its
+ * center falls inside a pixel, so it is computed once and cached. A stroke
+ * places its dabs at even spacing along its path and keeps the coverage of all
+ * of them. Each render blends the new dabs into it and returns the part they
+ * touched as one mask, which is then blended into the image with the color of
+ * the stroke in a single operation. */
+struct _DabStroke;
+
+typedef struct _DabStroke DabStroke;
+
+DabStroke       *dab_stroke_new     (gdouble       size,
+                                     gdouble       hardness);
+void             dab_stroke_dispose (DabStroke    *self);
+
+void             dab_stroke_move_to (DabStroke    *self,
+                                     gdouble       x,
+                                     gdouble       y);
+void             dab_stroke_line_to (DabStroke    *self,
+                                     gdouble       x,
+                                     gdouble       y);
+cairo_surface_t *dab_stroke_render  (DabStroke    *self,
+                                     GdkRectangle *area);
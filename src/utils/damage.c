@@ -0,0 +1,96 @@
+/* damage.c
+ *
+ * Copyright 2023 Rami Alkawadri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "utils/damage.h"
+
+/* Extra pixels added around every damage to cover antialiasing */
+static const gint ANTIALIAS_MARGIN = 1;
+
+void
+damage_reset (GdkRectangle *damage)
+{
+  damage->x = 0;
+  damage->y = 0;
+  damage->width = 0;
+  damage->height = 0;
+}
+
+gboolean
+damage_is_empty (GdkRectangle *damage)
+{
+  return damage->width <= 0 || damage->height <= 0;
+}
+
+void
+damage_add_rectangle (GdkRectangle *damage,
+                      gdouble       x,
+                      gdouble       y,
+                      gdouble       width,
+                      gdouble       height)
+{
+  GdkRectangle rect;
+  gint x1;
+  gint y1;
+
+  rect.x = floor (MIN (x, x + width)) - ANTIALIAS_MARGIN;
+  rect.y = floor (MIN (y, y + height)) - ANTIALIAS_MARGIN;
+  x1 = ceil (MAX (x, x + width)) + ANTIALIAS_MARGIN;
+  y1 = ceil (MAX (y, y + height)) + ANTIALIAS_MARGIN;
+  rect.width = x1 - rect.x;
+  rect.height = y1 - rect.y;
+
+  damage_add_damage (damage, &rect);
+}
+
+void
+damage_add_circle (GdkRectangle *damage,
+                   gdouble       x,
+                   gdouble       y,
+                   gdouble       radius)
+{
+  damage_add_rectangle (damage, x - radius, y - radius, 2 * radius, 2 * radius);
+}
+
+void
+damage_add_damage (GdkRectangle *damage,
+                   GdkRectangle *other)
+{
+  if (damage_is_empty (other))
+    return;
+
+  if (damage_is_empty (damage))
+    *damage = *other;
+  else
+    gdk_rectangle_union (damage, other, damage);
+}
+
+/**
+ * Limits the damage to a surface of the given size.
+ */
+void
+damage_clip (GdkRectangle *damage,
+             gint          width,
+             gint          height)
+{
+  GdkRectangle bounds = { 0, 0, width, height };
+
+  if (!gdk_rectangle_intersect (damage, &bounds, damage))
+    damage_reset (damage);
+}
@@ -0,0 +1,45 @@
+/* damage.h
+ *
+ * Copyright 2023 Rami Alkawadri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gdk/gdk.h>
+
+/* A damage is the bounding box of the pixels touched by a draw call,
+ * an empty damage has a width or height of zero. */
+
+void     damage_reset         (GdkRectangle *damage);
+gboolean damage_is_empty      (GdkRectangle *damage);
+
+void     damage_add_rectangle (GdkRectangle *damage,
+                               gdouble       x,
+                               gdouble       y,
+                               gdouble       width,
+                               gdouble       height);
+void     damage_add_circle    (GdkRectangle *damage,
+                               gdouble       x,
+                               gdouble       y,
+                               gdouble       radius);
+void     damage_add_damage    (GdkRectangle *damage,
+                               GdkRectangle *other);
+
+void     damage_clip          (GdkRectangle *damage,
+                               gint          width,
+                               gint          height);
@@ -0,0 +1,1263 @@
+/* flood-fill.c
+ *
+ * Copyright 2023 Rami Alkawadri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+
+#include "utils/flood-fill.h"
+#include "utils/pixel-kernels.h"
+#include "utils/point.h"
+
+/* Both bit maps have a row of whole 64 bit words per image row, the matching
+ * pixels of a row are only found the first time the fill reaches it */
+typedef struct _FillState {
+  guchar   *data;
+  gint      stride;
+  gint      width;
+  gint      height;
+  gsize     words_per_row;
+  guint32   target;
+  guint8    tolerance;
+  guint64  *matches;
+  gboolean *is_row_matched;
+  guint64  *visited;
+
+  /* Rows done so far out of total_rows, bands add to it from several threads */
+  FloodFillProgress *progress;
+  gint               rows_done;
+  gint               total_rows;
+} FillState;
+
+/* The serial fill pops a seed per span, looking at the cancellable for each one
+ * would cost more than the spans on images with many small ones */
+static const guint SEEDS_PER_CANCEL_CHECK = 4096;
+
+static inline gboolean
+is_bit_set (guint64 *bits,
+            gint     x)
+{
+  return (bits[x / 64] >> (x % 64)) & 1;
+}
+
+static inline void
+set_bit (guint64 *bits,
+         gint     x)
+{
+  bits[x / 64] |= G_GUINT64_CONSTANT (1) << (x % 64);
+}
+
+/**
+ * Adds count rows to the rows done and publishes the new progress, if anyone
+ * is watching.
+ */
+static void
+add_rows_done (FillState *state,
+               gint       count)
+{
+  gint rows_done;
+
+  if (state->progress == NULL)
+    return;
+
+  rows_done = g_atomic_int_add (&state->rows_done, count) + count;
+  g_atomic_int_set (&state->progress->permille,
+                    (gint) ((gint64) MIN (rows_done, state->total_rows) * 1000 / state->total_rows));
+}
+
+/**
+ * Paints fill_color over a span of pixels. It has the alpha in its unused byte,
+ * translucent colors are blended over each pixel on its own.
+ */
+static inline void
+paint_span (guint32 *pixels,
+            gint     length,
+            guint32  fill_color)
+{
+  if (fill_color >> 24 == 0xff)
+    pixel_fill_span (pixels, length, fill_color);
+  else
+    pixel_blend_span (pixels, length, fill_color | 0xff000000, fill_color >> 24);
+}
+
+static gboolean
+is_cancelled (FillState *state)
+{
+  return state->progress != NULL && g_cancellable_is_cancelled (state->progress->cancellable);
+}
+
+/**
+ * Fills the fields shared by all the kinds of fill.
+ */
+static void
+init_fill_state (FillState         *state,
+                 cairo_surface_t   *surface,
+                 gint               start_x,
+                 gint               start_y,
+                 guint8             tolerance,
+                 FloodFillProgress *progress,
+                 gint               total_rows)
+{
+  cairo_surface_flush (surface);
+  state->data = cairo_image_surface_get_data (surface);
+  state->stride = cairo_image_surface_get_stride (surface);
+  state->width = cairo_image_surface_get_width (surface);
+  state->height = cairo_image_surface_get_height (surface);
+  state->words_per_row = (state->width + 63) / 64;
+  state->target = ((guint32 *) (state->data + start_y * state->stride))[start_x];
+  state->tolerance = tolerance;
+  state->matches = NULL;
+  state->is_row_matched = NULL;
+  state->visited = NULL;
+  state->progress = progress;
+  state->rows_done = 0;
+  state->total_rows = MAX (total_rows, 1);
+}
+
+static inline guint32 *
+get_row (FillState *state,
+         gint       y)
+{
+  return (guint32 *) (state->data + y * state->stride);
+}
+
+/**
+ * Returns the matching pixels of row y, finding them if needed. It has to be
+ * called before anything is written to the row.
+ */
+static guint64 *
+get_row_matches (FillState *state,
+                 gint       y)
+{
+  guint64 *matches;
+
+  matches = state->matches + y * state->words_per_row;
+
+  if (!state->is_row_matched[y])
+    {
+      pixel_match_row (get_row (state, y), state->width, state->target, state->tolerance, matches);
+      state->is_row_matched[y] = true;
+
+      // The region is unknown until it is filled, the rows it reached are the best guess
+      add_rows_done (state, 1);
+    }
+
+  return matches;
+}
+
+static inline gboolean
+can_fill (guint64 *matches,
+          guint64 *visited,
+          gint     x)
+{
+  return is_bit_set (matches, x) && !is_bit_set (visited, x);
+}
+
+/**
+ * Pushes the first pixel of every run of fillable pixels of row y between left
+ * and right, both included.
+ */
+static void
+push_runs (FillState *state,
+           GArray    *seeds,
+           gint       y,
+           gint       left,
+           gint       right)
+{
+  guint64 *matches;
+  guint64 *visited;
+  Point seed;
+  gboolean is_in_run;
+  gboolean is_fillable;
+
+  matches = get_row_matches (state, y);
+  visited = state->visited + y * state->words_per_row;
+  is_in_run = false;
+  seed.y = y;
+
+  for (gint x = left; x <= right; x++)
+    {
+      is_fillable = can_fill (matches, visited, x);
+
+      if (is_fillable && !is_in_run)
+        {
+          seed.x = x;
+          g_array_append_val (seeds, seed);
+        }
+
+      is_in_run = is_fillable;
+    }
+}
+
+/**
+ * Marks the 8-connected region of matching pixels around (start_x, start_y) as
+ * visited one horizontal span at a time, painting fill_color over its pixels if
+ * write_pixels is set. The visited bits keep track of what was already filled
+ * in case the filled pixels match too. Only the rows the fill reaches are matched.
+ * Returns false if the fill was cancelled, area is set to the bounding box of
+ * the region otherwise.
+ */
+static gboolean
+fill_spans (FillState    *state,
+            gint          start_x,
+            gint          start_y,
+            gboolean      write_pixels,
+            guint32       fill_color,
+            GdkRectangle *area)
+{
+  guint32 *row;
+  guint64 *matches;
+  guint64 *visited;
+  GArray *seeds;
+  Point seed;
+  gboolean is_completed;
+  guint popped_count;
+  gint left;
+  gint right;
+  gint min_x;
+  gint min_y;
+  gint max_x;
+  gint max_y;
+
+  seeds = g_array_new (FALSE, FALSE, sizeof (Point));
+
+  min_x = max_x = start_x;
+  min_y = max_y = start_y;
+  is_completed = true;
+  popped_count = 0;
+
+  seed.x = start_x;
+  seed.y = start_y;
+  g_array_append_val (seeds, seed);
+
+  while (seeds->len > 0)
+    {
+      if (++popped_count % SEEDS_PER_CANCEL_CHECK == 0 && is_cancelled (state))
+        {
+          is_completed = false;
+          break;
+        }
+
+      seed = g_array_index (seeds, Point, seeds->len - 1);
+      g_array_set_size (seeds, seeds->len - 1);
+
+      row = get_row (state, seed.y);
+      matches = get_row_matches (state, seed.y);
+      visited = state->visited + seed.y * state->words_per_row;
+
+      // Filled by another span since it was pushed
+      if (is_bit_set (visited, seed.x))
+        continue;
+
+      left = seed.x;
+      right = seed.x;
+
+      while (left > 0 && can_fill (matches, visited, left - 1))
+        left--;
+
+      while (right < state->width - 1 && can_fill (matches, visited, right + 1))
+        right++;
+
+      for (gint x = left; x <= right; x++)
+        set_bit (visited, x);
+
+      if (write_pixels)
+        paint_span (row + left, right - left + 1, fill_color);
+
+      min_x = MIN (min_x, left);
+      max_x = MAX (max_x, right);
+      min_y = MIN (min_y, seed.y);
+      max_y = MAX (max_y, seed.y);
+
+      // Diagonal neighbors are connected too, so the rows are checked one pixel past the span
+      if (seed.y > 0)
+        push_runs (state, seeds, seed.y - 1, MAX (left - 1, 0), MIN (right + 1, state->width - 1));
+
+      if (seed.y < state->height - 1)
+        push_runs (state, seeds, seed.y + 1, MAX (left - 1, 0), MIN (right + 1, state->width - 1));
+    }
+
+  area->x = min_x;
+  area->y = min_y;
+  area->width = max_x - min_x + 1;
+  area->height = max_y - min_y + 1;
+
+  g_array_unref (seeds);
+
+  return is_completed;
+}
+
+static gboolean
+flood_fill_serial (cairo_surface_t   *surface,
+                   gint               start_x,
+                   gint               start_y,
+                   guint8             tolerance,
+                   guint32            fill_color,
+                   FloodFillProgress *progress,
+                   GdkRectangle      *filled_area)
+{
+  FillState state;
+  gboolean is_completed;
+
+  init_fill_state (&state, surface, start_x, start_y, tolerance, progress,
+                   cairo_image_surface_get_height (surface));
+  state.matches = g_malloc (state.words_per_row * state.height * sizeof (guint64));
+  state.is_row_matched = g_malloc0 (state.height * sizeof (gboolean));
+  state.visited = g_malloc0 (state.words_per_row * state.height * sizeof (guint64));
+
+  is_completed = fill_spans (&state, start_x, start_y, true, fill_color, filled_area);
+
+  cairo_surface_mark_dirty (surface);
+
+  g_free (state.matches);
+  g_free (state.is_row_matched);
+  g_free (state.visited);
+
+  return is_completed;
+}
+
+/* Big images are filled in parallel: the image is split in bands of whole rows,
+ * each band finds its runs of matching pixels and joins the connected ones on a
+ * worker thread, then the runs that touch across band borders are joined and
+ * the runs connected to the clicked pixel are filled, band by band. */
+
+static const gsize PARALLEL_FILL_MIN_PIXELS = 4096 * 2048;
+static const gint  MIN_BAND_HEIGHT = 64;
+
+typedef struct _Run {
+  gint y;
+  gint left;
+  gint right;
+} Run;
+
+typedef struct _Band {
+  FillState *state;
+  gint       first_row;
+  gint       end_row;
+
+  /* Runs sorted by row then by x, parents use indices in the band until the
+   * bands are merged */
+  GArray    *runs;
+  GArray    *parents;
+  guint      first_row_run_count;
+  guint      last_row_first_run;
+  guint      offset;
+
+  /* Fill */
+  guint32   *all_parents;
+  guint32    root;
+  guint32    fill_color;
+  gint       min_x;
+  gint       min_y;
+  gint       max_x;
+  gint       max_y;
+} Band;
+
+static guint32
+find_root (guint32 *parents,
+           guint32  index)
+{
+  while (parents[index] != index)
+    {
+      parents[index] = parents[parents[index]];
+      index = parents[index];
+    }
+
+  return index;
+}
+
+static void
+join (guint32 *parents,
+      guint32  a,
+      guint32  b)
+{
+  a = find_root (parents, a);
+  b = find_root (parents, b);
+
+  // The smaller index is the root so the result does not depend on the order
+  if (a < b)
+    parents[b] = a;
+  else if (b < a)
+    parents[a] = b;
+}
+
+/**
+ * Joins the runs of two consecutive rows that touch, diagonals included. Both
+ * rows are sorted by x, their runs are at index offset + i in parents.
+ */
+static void
+join_touching_runs (guint32 *parents,
+                    Run     *previous_runs,
+                    guint    previous_count,
+                    guint    previous_offset,
+                    Run     *current_runs,
+                    guint    current_count,
+                    guint    current_offset)
+{
+  guint i;
+  guint j;
+
+  i = 0;
+  j = 0;
+
+  while (i < previous_count && j < current_count)
+    {
+      if (previous_runs[i].right + 1 >= current_runs[j].left &&
+          current_runs[j].right + 1 >= previous_runs[i].left)
+        join (parents, previous_offset + i, current_offset + j);
+
+      // Move past the run that ends first, the other one can still touch the next run
+      if (previous_runs[i].right < current_runs[j].right)
+        i++;
+      else
+        j++;
+    }
+}
+
+/**
+ * Appends the runs of matching pixels of row y to the band.
+ */
+static void
+find_row_runs (Band    *band,
+               guint64 *matches,
+               gint     y)
+{
+  Run run;
+  guint32 parent;
+  gint x;
+  gint width;
+
+  width = band->state->width;
+  run.y = y;
+  x = 0;
+
+  while (x < width)
+    {
+      // Whole words without matches are skipped at once
+      if (x % 64 == 0 && matches[x / 64] == 0)
+        {
+          x += 64;
+          continue;
+        }
+
+      if (!is_bit_set (matches, x))
+        {
+          x++;
+          continue;
+        }
+
+      run.left = x;
+
+      while (x < width && is_bit_set (matches, x))
+        x++;
+
+      run.right = x - 1;
+      parent = band->runs->len;
+      g_array_append_val (band->runs, run);
+      g_array_append_val (band->parents, parent);
+    }
+}
+
+static void
+label_band (gpointer data,
+            gpointer user_data)
+{
+  Band *band = data;
+  FillState *state = band->state;
+  Run *runs;
+  guint64 *matches;
+  guint previous_first;
+  guint current_first;
+
+  matches = g_malloc (state->words_per_row * sizeof (guint64));
+  previous_first = 0;
+  current_first = 0;
+
+  for (gint y = band->first_row; y < band->end_row; y++)
+    {
+      // The other bands see it too, the result is thrown away anyway
+      if (is_cancelled (state))
+        break;
+
+      pixel_match_row (get_row (state, y), state->width, state->target, state->tolerance, matches);
+      find_row_runs (band, matches, y);
+
+      runs = (Run *) band->runs->data;
+
+      if (y > band->first_row)
+        join_touching_runs ((guint32 *) band->parents->data,
+                            runs + previous_first, current_first - previous_first, previous_first,
+                            runs + current_first, band->runs->len - current_first, current_first);
+      else
+        band->first_row_run_count = band->runs->len;
+
+      previous_first = current_first;
+      current_first = band->runs->len;
+
+      add_rows_done (state, 1);
+    }
+
+  band->last_row_first_run = previous_first;
+
+  g_free (matches);
+}
+
+static void
+fill_band (gpointer data,
+           gpointer user_data)
+{
+  Band *band = data;
+  FillState *state = band->state;
+  Run *run;
+  guint32 *row;
+
+  band->min_x = state->width;
+  band->min_y = state->height;
+  band->max_x = -1;
+  band->max_y = -1;
+
+  for (guint i = 0; i < band->runs->len; i++)
+    {
+      if (band->all_parents[band->offset + i] != band->root)
+        continue;
+
+      run = &g_array_index (band->runs, Run, i);
+      row = get_row (state, run->y);
+
+      paint_span (row + run->left, run->right - run->left + 1, band->fill_color);
+
+      band->min_x = MIN (band->min_x, run->left);
+      band->max_x = MAX (band->max_x, run->right);
+      band->min_y = MIN (band->min_y, run->y);
+      band->max_y = MAX (band->max_y, run->y);
+    }
+
+  add_rows_done (state, band->end_row - band->first_row);
+}
+
+/**
+ * Calls func on each of the count items of size item_size on a thread pool and
+ * waits for all of them.
+ */
+static void
+run_in_parallel (GFunc    func,
+                 gpointer items,
+                 gsize    item_size,
+                 gint     count)
+{
+  GThreadPool *pool;
+
+  pool = g_thread_pool_new (func, NULL, g_get_num_processors (), FALSE, NULL);
+
+  for (gint i = 0; i < count; i++)
+    g_thread_pool_push (pool, (guchar *) items + i * item_size, NULL);
+
+  g_thread_pool_free (pool, FALSE, TRUE);
+}
+
+/**
+ * Returns the height of the bands for a parallel pass over height rows, there
+ * are a few bands per thread so a slower band does not keep the others waiting.
+ */
+static gint
+get_band_height (gint height)
+{
+  gint band_count;
+
+  band_count = g_get_num_processors () * 4;
+
+  return MAX ((height + band_count - 1) / band_count, MIN_BAND_HEIGHT);
+}
+
+/**
+ * Gives the same result as the serial fill, the difference is that all the
+ * pixels are matched, even the ones that end up outside the region.
+ */
+static gboolean
+flood_fill_parallel (cairo_surface_t   *surface,
+                     gint               start_x,
+                     gint               start_y,
+                     guint8             tolerance,
+                     guint32            fill_color,
+                     FloodFillProgress *progress,
+                     GdkRectangle      *filled_area)
+{
+  FillState state;
+  GdkRectangle band_area;
+  Band *bands;
+  Band *band;
+  Band *next;
+  Run *run;
+  guint32 *parents;
+  guint32 root;
+  guint run_count;
+  gint band_count;
+  gint band_height;
+
+  // Every row is labeled then filled
+  init_fill_state (&state, surface, start_x, start_y, tolerance, progress,
+                   cairo_image_surface_get_height (surface) * 2);
+
+  band_height = get_band_height (state.height);
+  band_count = (state.height + band_height - 1) / band_height;
+  bands = g_new0 (Band, band_count);
+
+  for (gint i = 0; i < band_count; i++)
+    {
+      bands[i].state = &state;
+      bands[i].first_row = i * band_height;
+      bands[i].end_row = MIN ((i + 1) * band_height, state.height);
+      bands[i].runs = g_array_new (FALSE, FALSE, sizeof (Run));
+      bands[i].parents = g_array_new (FALSE, FALSE, sizeof (guint32));
+      bands[i].fill_color = fill_color;
+    }
+
+  run_in_parallel (label_band, bands, sizeof (Band), band_count);
+
+  if (is_cancelled (&state))
+    {
+      for (gint i = 0; i < band_count; i++)
+        {
+          g_array_unref (bands[i].runs);
+          g_array_unref (bands[i].parents);
+        }
+
+      g_free (bands);
+
+      return false;
+    }
+
+  run_count = 0;
+
+  for (gint i = 0; i < band_count; i++)
+    {
+      bands[i].offset = run_count;
+      run_count += bands[i].runs->len;
+    }
+
+  // All the runs in one array so they can be joined across bands
+  parents = g_new (guint32, MAX (run_count, 1));
+
+  for (gint i = 0; i < band_count; i++)
+    {
+      for (guint j = 0; j < bands[i].parents->len; j++)
+        parents[bands[i].offset + j] = g_array_index (bands[i].parents, guint32, j) + bands[i].offset;
+    }
+
+  for (gint i = 0; i + 1 < band_count; i++)
+    {
+      band = &bands[i];
+      next = &bands[i + 1];
+
+      join_touching_runs (parents,
+                          &g_array_index (band->runs, Run, band->last_row_first_run),
+                          band->runs->len - band->last_row_first_run,
+                          band->offset + band->last_row_first_run,
+                          (Run *) next->runs->data,
+                          next->first_row_run_count,
+                          next->offset);
+    }
+
+  for (guint i = 0; i < run_count; i++)
+    parents[i] = find_root (parents, i);
+
+  // The clicked pixel always matches itself, so it is in one of the runs of its band
+  band = &bands[start_y / band_height];
+  root = 0;
+
+  for (guint i = 0; i < band->runs->len; i++)
+    {
+      run = &g_array_index (band->runs, Run, i);
+
+      if (run->y == start_y && run->left <= start_x && start_x <= run->right)
+        {
+          root = parents[band->offset + i];
+          break;
+        }
+    }
+
+  for (gint i = 0; i < band_count; i++)
+    {
+      bands[i].all_parents = parents;
+      bands[i].root = root;
+    }
+
+  run_in_parallel (fill_band, bands, sizeof (Band), band_count);
+
+  cairo_surface_mark_dirty (surface);
+
+  filled_area->x = start_x;
+  filled_area->y = start_y;
+  filled_area->width = 1;
+  filled_area->height = 1;
+
+  for (gint i = 0; i < band_count; i++)
+    {
+      if (bands[i].max_x >= 0)
+        {
+          band_area.x = bands[i].min_x;
+          band_area.y = bands[i].min_y;
+          band_area.width = bands[i].max_x - bands[i].min_x + 1;
+          band_area.height = bands[i].max_y - bands[i].min_y + 1;
+          gdk_rectangle_union (filled_area, &band_area, filled_area);
+        }
+
+      g_array_unref (bands[i].runs);
+      g_array_unref (bands[i].parents);
+    }
+
+  g_free (parents);
+  g_free (bands);
+
+  return true;
+}
+
+/**
+ * Fills the 8-connected region around (start_x, start_y) of pixels that match
+ * the color of that pixel within tolerance with fill_color, writing directly to
+ * the surface pixels. fill_color has its alpha in the unused byte, a translucent
+ * color is painted over each filled pixel, which can differ within tolerance.
+ * filled_area is set to the bounding box of the filled pixels. Big images are
+ * filled on all the processors.
+ *
+ * progress can be NULL. Returns false if its cancellable was cancelled before
+ * the end, the surface is then left half filled.
+ */
+gboolean
+flood_fill (cairo_surface_t   *surface,
+            gint               start_x,
+            gint               start_y,
+            guint8             tolerance,
+            guint32            fill_color,
+            FloodFillProgress *progress,
+            GdkRectangle      *filled_area)
+{
+  gsize pixel_count;
+
+  pixel_count = (gsize) cairo_image_surface_get_width (surface) * cairo_image_surface_get_height (surface);
+
+  if (pixel_count >= PARALLEL_FILL_MIN_PIXELS && g_get_num_processors () > 1)
+    return flood_fill_parallel (surface, start_x, start_y, tolerance, fill_color, progress, filled_area);
+  else
+    return flood_fill_serial (surface, start_x, start_y, tolerance, fill_color, progress, filled_area);
+}
+
+/**
+ * Finds the same region as flood_fill () without changing the surface. Returns
+ * the region as one bit per pixel, in rows of (width + 63) / 64 words, and sets
+ * area to its bounding box. Free the bits with g_free ().
+ */
+guint64 *
+flood_fill_select (cairo_surface_t *surface,
+                   gint             start_x,
+                   gint             start_y,
+                   guint8           tolerance,
+                   GdkRectangle    *area)
+{
+  FillState state;
+
+  init_fill_state (&state, surface, start_x, start_y, tolerance, NULL,
+                   cairo_image_surface_get_height (surface));
+  state.matches = g_malloc (state.words_per_row * state.height * sizeof (guint64));
+  state.is_row_matched = g_malloc0 (state.height * sizeof (gboolean));
+  state.visited = g_malloc0 (state.words_per_row * state.height * sizeof (guint64));
+
+  fill_spans (&state, start_x, start_y, false, 0, area);
+
+  g_free (state.matches);
+  g_free (state.is_row_matched);
+
+  return state.visited;
+}
+
+typedef struct _ReplaceBand {
+  FillState *state;
+  gint       first_row;
+  gint       end_row;
+  guint32    fill_color;
+  gint       min_x;
+  gint       min_y;
+  gint       max_x;
+  gint       max_y;
+} ReplaceBand;
+
+static void
+replace_band (gpointer data,
+              gpointer user_data)
+{
+  ReplaceBand *band = data;
+  FillState *state = band->state;
+  gint first;
+  gint last;
+
+  band->min_x = state->width;
+  band->min_y = state->height;
+  band->max_x = -1;
+  band->max_y = -1;
+
+  for (gint y = band->first_row; y < band->end_row; y++)
+    {
+      if (is_cancelled (state))
+        break;
+
+      add_rows_done (state, 1);
+
+      if (!pixel_replace_row (get_row (state, y), state->width,
+                              state->target, state->tolerance,
+                              band->fill_color | 0xff000000, band->fill_color >> 24,
+                              &first, &last))
+        continue;
+
+      band->min_x = MIN (band->min_x, first);
+      band->max_x = MAX (band->max_x, last);
+      band->min_y = MIN (band->min_y, y);
+      band->max_y = y;
+    }
+}
+
+/**
+ * Fills every pixel of the image that matches the color of (start_x, start_y)
+ * within tolerance with fill_color, connected or not. The image is swept once,
+ * in bands on all the processors for big images. filled_area is set to the
+ * bounding box of the filled pixels. progress works like in flood_fill.
+ */
+gboolean
+flood_fill_everywhere (cairo_surface_t   *surface,
+                       gint               start_x,
+                       gint               start_y,
+                       guint8             tolerance,
+                       guint32            fill_color,
+                       FloodFillProgress *progress,
+                       GdkRectangle      *filled_area)
+{
+  FillState state;
+  ReplaceBand *bands;
+  gint band_count;
+  gint band_height;
+  gint min_x;
+  gint min_y;
+  gint max_x;
+  gint max_y;
+
+  init_fill_state (&state, surface, start_x, start_y, tolerance, progress,
+                   cairo_image_surface_get_height (surface));
+
+  if ((gsize) state.width * state.height >= PARALLEL_FILL_MIN_PIXELS && g_get_num_processors () > 1)
+    band_height = get_band_height (state.height);
+  else
+    band_height = state.height;
+
+  band_count = (state.height + band_height - 1) / band_height;
+  bands = g_new0 (ReplaceBand, band_count);
+
+  for (gint i = 0; i < band_count; i++)
+    {
+      bands[i].state = &state;
+      bands[i].first_row = i * band_height;
+      bands[i].end_row = MIN ((i + 1) * band_height, state.height);
+      bands[i].fill_color = fill_color;
+    }
+
+  if (band_count > 1)
+    run_in_parallel (replace_band, bands, sizeof (ReplaceBand), band_count);
+  else
+    replace_band (bands, NULL);
+
+  cairo_surface_mark_dirty (surface);
+
+  if (is_cancelled (&state))
+    {
+      g_free (bands);
+
+      return false;
+    }
+
+  // The clicked pixel is always replaced
+  min_x = max_x = start_x;
+  min_y = max_y = start_y;
+
+  for (gint i = 0; i < band_count; i++)
+    {
+      if (bands[i].max_x < 0)
+        continue;
+
+      min_x = MIN (min_x, bands[i].min_x);
+      max_x = MAX (max_x, bands[i].max_x);
+      min_y = MIN (min_y, bands[i].min_y);
+      max_y = MAX (max_y, bands[i].max_y);
+    }
+
+  filled_area->x = min_x;
+  filled_area->y = min_y;
+  filled_area->width = max_x - min_x + 1;
+  filled_area->height = max_y - min_y + 1;
+
+  g_free (bands);
+
+  return true;
+}
+
+/* Gaps are closed by leaving out the pixels that are too close to the outline
+ * for the fill to get through a gap, then growing the region filled from the
+ * remaining pixels back over them. Both steps need the distance of every pixel
+ * to a set of pixels, which is a squared Euclidean distance transform that is
+ * linear in the number of pixels: a pass over the columns finds the distance
+ * to the closest pixel of the set in the same column, then a pass over the
+ * rows finds the lower envelope of the parabolas rooted at every pixel of the
+ * row (Felzenszwalb and Huttenlocher). */
+
+static const gsize PARALLEL_DISTANCE_MIN_PIXELS = 1024 * 1024;
+
+// Far enough for any image, unlike G_MAXFLOAT it leaves room for the sums of the transform
+static const gfloat DISTANCE_INFINITY = 1e20f;
+
+typedef struct _DistanceBand {
+  FillState *state;
+  gfloat    *distances;
+  gint       first;
+  gint       end;
+} DistanceBand;
+
+/**
+ * Returns where the parabola rooted at q starts being lower than the one rooted
+ * at p, p < q.
+ */
+static inline gdouble
+get_intersection (gfloat *values,
+                  gint    p,
+                  gint    q)
+{
+  return ((values[q] + (gdouble) q * q) - (values[p] + (gdouble) p * p)) / (2.0 * (q - p));
+}
+
+/**
+ * Replaces the count values by their distance transform, the minimum over every
+ * q of (p - q)² + values[q]. line, roots and bounds are scratch buffers of
+ * count, count and count + 1 items.
+ */
+static void
+transform_line (gfloat  *values,
+                gint     count,
+                gfloat  *line,
+                gint    *roots,
+                gdouble *bounds)
+{
+  gdouble intersection;
+  gint k;
+
+  for (gint q = 0; q < count; q++)
+    line[q] = values[q];
+
+  k = 0;
+  roots[0] = 0;
+  bounds[0] = -DISTANCE_INFINITY;
+  bounds[1] = DISTANCE_INFINITY;
+
+  for (gint q = 1; q < count; q++)
+    {
+      intersection = get_intersection (line, roots[k], q);
+
+      // The parabolas that end up above the new one are no longer part of the envelope
+      while (intersection <= bounds[k])
+        {
+          k--;
+          intersection = get_intersection (line, roots[k], q);
+        }
+
+      k++;
+      roots[k] = q;
+      bounds[k] = intersection;
+      bounds[k + 1] = DISTANCE_INFINITY;
+    }
+
+  k = 0;
+
+  for (gint q = 0; q < count; q++)
+    {
+      while (bounds[k + 1] < q)
+        k++;
+
+      values[q] = (gfloat) (q - roots[k]) * (q - roots[k]) + line[roots[k]];
+    }
+}
+
+/**
+ * The values start at 0 or DISTANCE_INFINITY, so along a column the distance
+ * is the one to the closest 0 above or below. It is found by a sweep down then
+ * one up, a row at a time so the pixels are read in memory order. The rows
+ * pass squares it.
+ */
+static void
+transform_columns (gpointer data,
+                   gpointer user_data)
+{
+  DistanceBand *band = data;
+  FillState *state = band->state;
+  gfloat *row;
+  gfloat *next;
+
+  for (gint y = 1; y < state->height && !is_cancelled (state); y++)
+    {
+      row = band->distances + (gsize) y * state->width;
+      next = row - state->width;
+
+      for (gint x = band->first; x < band->end; x++)
+        row[x] = MIN (row[x], next[x] + 1);
+    }
+
+  for (gint y = state->height - 2; y >= 0 && !is_cancelled (state); y--)
+    {
+      row = band->distances + (gsize) y * state->width;
+      next = row + state->width;
+
+      for (gint x = band->first; x < band->end; x++)
+        row[x] = MIN (row[x], next[x] + 1);
+    }
+
+  // Progress is counted in rows, a column is worth height / width rows
+  add_rows_done (state, (gint64) (band->end - band->first) * state->height / state->width);
+}
+
+static void
+transform_rows (gpointer data,
+                gpointer user_data)
+{
+  DistanceBand *band = data;
+  FillState *state = band->state;
+  gfloat *row;
+  gfloat *line;
+  gint *roots;
+  gdouble *bounds;
+
+  line = g_new (gfloat, state->width);
+  roots = g_new (gint, state->width);
+  bounds = g_new (gdouble, state->width + 1);
+
+  for (gint y = band->first; y < band->end; y++)
+    {
+      if (is_cancelled (state))
+        break;
+
+      row = band->distances + (gsize) y * state->width;
+
+      // Infinity stays as it is, its square would not fit
+      for (gint x = 0; x < state->width; x++)
+        {
+          if (row[x] < DISTANCE_INFINITY)
+            row[x] *= row[x];
+        }
+
+      transform_line (row, state->width, line, roots, bounds);
+      add_rows_done (state, 1);
+    }
+
+  g_free (line);
+  g_free (roots);
+  g_free (bounds);
+}
+
+/**
+ * Calls func on bands of the count columns or rows, on all the processors for
+ * big images.
+ */
+static void
+transform_bands (FillState *state,
+                 gfloat    *distances,
+                 GFunc      func,
+                 gint       count)
+{
+  DistanceBand *bands;
+  gint band_count;
+  gint band_size;
+
+  if ((gsize) state->width * state->height >= PARALLEL_DISTANCE_MIN_PIXELS && g_get_num_processors () > 1)
+    band_size = get_band_height (count);
+  else
+    band_size = count;
+
+  band_count = (count + band_size - 1) / band_size;
+  bands = g_new0 (DistanceBand, band_count);
+
+  for (gint i = 0; i < band_count; i++)
+    {
+      bands[i].state = state;
+      bands[i].distances = distances;
+      bands[i].first = i * band_size;
+      bands[i].end = MIN ((i + 1) * band_size, count);
+    }
+
+  if (band_count > 1)
+    run_in_parallel (func, bands, sizeof (DistanceBand), band_count);
+  else
+    func (bands, NULL);
+
+  g_free (bands);
+}
+
+/**
+ * Replaces distances, 0 for the pixels of the set and DISTANCE_INFINITY for
+ * the others, by the squared distance of each pixel to the closest pixel of
+ * the set. Returns false if the fill was cancelled.
+ */
+static gboolean
+transform_distances (FillState *state,
+                     gfloat    *distances)
+{
+  transform_bands (state, distances, transform_columns, state->width);
+
+  if (is_cancelled (state))
+    return false;
+
+  transform_bands (state, distances, transform_rows, state->height);
+
+  return !is_cancelled (state);
+}
+
+/**
+ * Sets the bits of region for the matching pixels whose squared distance is
+ * above or below max_distance.
+ */
+static void
+keep_matches_by_distance (FillState *state,
+                          guint64   *matches,
+                          gfloat    *distances,
+                          gdouble    max_distance,
+                          gboolean   keep_far,
+                          guint64   *region)
+{
+  gfloat *row_distances;
+  guint64 *row_matches;
+  guint64 *row_region;
+
+  memset (region, 0, state->words_per_row * state->height * sizeof (guint64));
+
+  for (gint y = 0; y < state->height; y++)
+    {
+      row_distances = distances + (gsize) y * state->width;
+      row_matches = matches + y * state->words_per_row;
+      row_region = region + y * state->words_per_row;
+
+      for (gint x = 0; x < state->width; x++)
+        {
+          if (is_bit_set (row_matches, x) && (row_distances[x] > max_distance) == keep_far)
+            set_bit (row_region, x);
+        }
+    }
+}
+
+/**
+ * Like flood_fill, but the fill does not get through the gaps of up to gap
+ * pixels in the outline of the region. The outline is made of the pixels that
+ * do not match. The fill grows back from the pixels that are further than half
+ * the gap from the outline, so corners sharper than a right angle can keep a
+ * few pixels unfilled. Regions narrower than the gap at the clicked pixel are
+ * filled as if gap was 0.
+ */
+gboolean
+flood_fill_closing_gaps (cairo_surface_t   *surface,
+                         gint               start_x,
+                         gint               start_y,
+                         guint8             tolerance,
+                         gint               gap,
+                         guint32            fill_color,
+                         FloodFillProgress *progress,
+                         GdkRectangle      *filled_area)
+{
+  FillState state;
+  GdkRectangle core_area;
+  guint64 *matches;
+  guint64 *region;
+  gfloat *distances;
+  gdouble radius;
+  gsize bits_size;
+  gboolean is_completed;
+
+  // Matching all the rows, then two distance transforms of two passes each
+  init_fill_state (&state, surface, start_x, start_y, tolerance, progress,
+                   cairo_image_surface_get_height (surface) * 5);
+
+  bits_size = state.words_per_row * state.height * sizeof (guint64);
+  matches = g_malloc (bits_size);
+  region = g_malloc (bits_size);
+  distances = g_new (gfloat, (gsize) state.width * state.height);
+  state.is_row_matched = g_malloc (state.height * sizeof (gboolean));
+  state.visited = g_malloc0 (bits_size);
+
+  // A gap of gap pixels is closed by the pixels that are within half of it from its two sides
+  radius = (gap + 1) / 2.0;
+
+  for (gint y = 0; y < state.height; y++)
+    {
+      pixel_match_row (get_row (&state, y), state.width, state.target, state.tolerance,
+                       matches + y * state.words_per_row);
+      state.is_row_matched[y] = true;
+
+      for (gint x = 0; x < state.width; x++)
+        distances[(gsize) y * state.width + x] = is_bit_set (matches + y * state.words_per_row, x) ? DISTANCE_INFINITY : 0;
+
+      add_rows_done (&state, 1);
+    }
+
+  is_completed = transform_distances (&state, distances);
+
+  if (is_completed && distances[(gsize) start_y * state.width + start_x] <= radius * radius)
+    {
+      g_free (matches);
+      g_free (region);
+      g_free (distances);
+      g_free (state.is_row_matched);
+      g_free (state.visited);
+
+      return flood_fill (surface, start_x, start_y, tolerance, fill_color, progress, filled_area);
+    }
+
+  // The pixels far from the outline, connected to the clicked one
+  if (is_completed)
+    {
+      keep_matches_by_distance (&state, matches, distances, radius * radius, true, region);
+      state.matches = region;
+      is_completed = fill_spans (&state, start_x, start_y, false, 0, &core_area);
+    }
+
+  if (is_completed)
+    {
+      for (gint y = 0; y < state.height; y++)
+        {
+          for (gint x = 0; x < state.width; x++)
+            distances[(gsize) y * state.width + x] = is_bit_set (state.visited + y * state.words_per_row, x) ? 0 : DISTANCE_INFINITY;
+        }
+
+      is_completed = transform_distances (&state, distances);
+    }
+
+  // Grown back over the pixels close to the outline, one more pixel fills the right angle corners
+  if (is_completed)
+    {
+      keep_matches_by_distance (&state, matches, distances, (radius + 1) * (radius + 1), false, region);
+      memset (state.visited, 0, bits_size);
+      is_completed = fill_spans (&state, start_x, start_y, true, fill_color, filled_area);
+      cairo_surface_mark_dirty (surface);
+    }
+
+  g_free (matches);
+  g_free (region);
+  g_free (distances);
+  g_free (state.is_row_matched);
+  g_free (state.visited);
+
+  return is_completed;
+}
@@ -0,0 +1,61 @@
+/* flood-fill.h
+ *
+ * Copyright 2023 Rami Alkawadri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+/* Shared between the thread running a fill and the one watching it, permille
+ * goes from 0 to 1000 and is only accessed with the atomic functions */
+typedef struct _FloodFillProgress {
+  GCancellable *cancellable;
+  gint          permille;
+} FloodFillProgress;
+
+gboolean flood_fill              (cairo_surface_t   *surface,
+                                  gint               start_x,
+                                  gint               start_y,
+                                  guint8             tolerance,
+                                  guint32            fill_color,
+                                  FloodFillProgress *progress,
+                                  GdkRectangle      *filled_area);
+
+gboolean flood_fill_closing_gaps (cairo_surface_t   *surface,
+                                  gint               start_x,
+                                  gint               start_y,
+                                  guint8             tolerance,
+                                  gint               gap,
+                                  guint32            fill_color,
+                                  FloodFillProgress *progress,
+                                  GdkRectangle      *filled_area);
+
+gboolean flood_fill_everywhere   (cairo_surface_t   *surface,
+                                  gint               start_x,
+                                  gint               start_y,
+                                  guint8             tolerance,
+                                  guint32            fill_color,
+                                  FloodFillProgress *progress,
+                                  GdkRectangle      *filled_area);
+
+guint64 *flood_fill_select       (cairo_surface_t   *surface,
+                                  gint               start_x,
+                                  gint               start_y,
+                                  guint8             tolerance,
+                                  GdkRectangle      *area);
@@ -0,0 +1,1137 @@
+/* pixel-kernels.c
+ *
+ * Copyright 2023 Rami Alkawadri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#if defined (__SSE2__)
+#include <immintrin.h>
+#elif defined (__ARM_NEON) && defined (__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "utils/pixel-kernels.h"
+
+/* SSE2 is part of x86-64 so it is picked at compile time like the NEON
+ * kernels of aarch64, AVX2 needs the CPU to be checked at runtime */
+#if defined (__SSE2__) && defined (__GNUC__)
+#define HAVE_AVX2_KERNELS
+#define AVX2_FUNCTION __attribute__ ((target ("avx2")))
+#endif
+
+typedef struct _PixelKernels {
+  const gchar *name;
+
+  void (*fill_span)      (guint32      *pixels,
+                          gint          length,
+                          guint32       pixel);
+  void (*blend_coverage) (guint8       *coverage,
+                          const guint8 *source,
+                          gint          length);
+  void (*blend_color)    (guint32      *pixels,
+                          const guint8 *mask,
+                          gint          length,
+                          guint32       color);
+  void (*blend_span)     (guint32      *pixels,
+                          gint          length,
+                          guint32       color,
+                          guint8        amount);
+  void (*match_row)      (const guint32 *pixels,
+                          gint           length,
+                          guint32        target,
+                          guint8         tolerance,
+                          guint64       *matches);
+  gboolean (*replace_row) (guint32 *pixels,
+                           gint     length,
+                           guint32  target,
+                           guint8   tolerance,
+                           guint32  replacement,
+                           guint8   amount,
+                           gint    *first,
+                           gint    *last);
+} PixelKernels;
+
+/* Scalar kernels, they handle the pixels left over by the SIMD ones too. The
+ * products are divided by 255 with rounding, the same way the SIMD kernels do
+ * it with shifts. */
+
+static inline guint32
+divide_by_255 (guint32 value)
+{
+  value += 128;
+
+  return (value + (value >> 8)) >> 8;
+}
+
+static void
+fill_span_scalar (guint32 *pixels,
+                  gint     length,
+                  guint32  pixel)
+{
+  for (gint i = 0; i < length; i++)
+    pixels[i] = pixel;
+}
+
+static void
+blend_coverage_scalar (guint8       *coverage,
+                       const guint8 *source,
+                       gint          length)
+{
+  for (gint i = 0; i < length; i++)
+    coverage[i] += divide_by_255 (source[i] * (255 - coverage[i]));
+}
+
+static inline guint32
+blend_pixel (guint32 pixel,
+             guint32 color,
+             guint32 amount)
+{
+  guint32 result;
+
+  result = 0;
+
+  for (gint shift = 0; shift < 32; shift += 8)
+    result |= divide_by_255 (((pixel >> shift) & 0xff) * (255 - amount) +
+                             ((color >> shift) & 0xff) * amount) << shift;
+
+  return result;
+}
+
+static void
+blend_color_scalar (guint32      *pixels,
+                    const guint8 *mask,
+                    gint          length,
+                    guint32       color)
+{
+  for (gint i = 0; i < length; i++)
+    {
+      if (mask[i] != 0)
+        pixels[i] = blend_pixel (pixels[i], color, mask[i]);
+    }
+}
+
+static void
+blend_span_scalar (guint32 *pixels,
+                   gint     length,
+                   guint32  color,
+                   guint8   amount)
+{
+  for (gint i = 0; i < length; i++)
+    pixels[i] = blend_pixel (pixels[i], color, amount);
+}
+
+static inline gint
+get_channel_difference (guint32 pixel,
+                        guint32 target,
+                        gint    shift)
+{
+  return ABS ((gint) ((pixel >> shift) & 0xff) - (gint) ((target >> shift) & 0xff));
+}
+
+static inline gboolean
+pixel_matches (guint32 pixel,
+               guint32 target,
+               guint8  tolerance)
+{
+  return get_channel_difference (pixel, target, 0) <= tolerance &&
+         get_channel_difference (pixel, target, 8) <= tolerance &&
+         get_channel_difference (pixel, target, 16) <= tolerance;
+}
+
+/**
+ * Matches the pixels from start, a multiple of 64, to the end of the row.
+ */
+static void
+match_words_scalar (const guint32 *pixels,
+                    gint           start,
+                    gint           length,
+                    guint32        target,
+                    guint8         tolerance,
+                    guint64       *matches)
+{
+  guint64 word;
+
+  for (gint x = start; x < length; x += 64)
+    {
+      word = 0;
+
+      for (gint i = 0; i < 64 && x + i < length; i++)
+        word |= (guint64) pixel_matches (pixels[x + i], target, tolerance) << i;
+
+      matches[x / 64] = word;
+    }
+}
+
+static void
+match_row_scalar (const guint32 *pixels,
+                  gint           length,
+                  guint32        target,
+                  guint8         tolerance,
+                  guint64       *matches)
+{
+  match_words_scalar (pixels, 0, length, target, tolerance, matches);
+}
+
+/**
+ * Replaces the matching pixels from start to the end of the row, first and last
+ * are only moved outwards.
+ */
+static void
+replace_pixels_scalar (guint32 *pixels,
+                       gint     start,
+                       gint     length,
+                       guint32  target,
+                       guint8   tolerance,
+                       guint32  replacement,
+                       guint8   amount,
+                       gint    *first,
+                       gint    *last)
+{
+  for (gint x = start; x < length; x++)
+    {
+      if (!pixel_matches (pixels[x], target, tolerance))
+        continue;
+
+      pixels[x] = blend_pixel (pixels[x], replacement, amount);
+      *first = MIN (*first, x);
+      *last = x;
+    }
+}
+
+static gboolean
+replace_row_scalar (guint32 *pixels,
+                    gint     length,
+                    guint32  target,
+                    guint8   tolerance,
+                    guint32  replacement,
+                    guint8   amount,
+                    gint    *first,
+                    gint    *last)
+{
+  *first = length;
+  *last = -1;
+
+  replace_pixels_scalar (pixels, 0, length, target, tolerance, replacement, amount, first, last);
+
+  return *last >= 0;
+}
+
+#if !defined (__SSE2__) && !(defined (__ARM_NEON) && defined (__aarch64__))
+static const PixelKernels scalar_kernels = {
+  "scalar",
+  fill_span_scalar,
+  blend_coverage_scalar,
+  blend_color_scalar,
+  blend_span_scalar,
+  match_row_scalar,
+  replace_row_scalar,
+};
+#endif
+
+/* The match kernels compare the channel differences against the tolerance a
+ * vector of pixels at a time. The unused byte is compared against 0xff so it
+ * always passes, then a pixel matches when its four bytes pass. */
+
+static inline guint32
+get_tolerance_pixel (guint8 tolerance)
+{
+  return 0xff000000 | tolerance * 0x010101;
+}
+
+#if defined (__SSE2__)
+
+/* The 8 bit channels are widened to 16 bits for the products, then packed
+ * back. Unpacking and packing both work inside 128 bit lanes, so the pixels
+ * keep their order with AVX2 too. */
+
+static inline __m128i
+divide_by_255_sse2 (__m128i values)
+{
+  values = _mm_add_epi16 (values, _mm_set1_epi16 (128));
+
+  return _mm_srli_epi16 (_mm_add_epi16 (values, _mm_srli_epi16 (values, 8)), 8);
+}
+
+static inline __m128i
+blend_channels_sse2 (__m128i pixels,
+                     __m128i amounts,
+                     __m128i color)
+{
+  __m128i inverse;
+
+  inverse = _mm_sub_epi16 (_mm_set1_epi16 (255), amounts);
+
+  return divide_by_255_sse2 (_mm_add_epi16 (_mm_mullo_epi16 (pixels, inverse),
+                                            _mm_mullo_epi16 (color, amounts)));
+}
+
+/**
+ * Blends the widened colors into four pixels by the same widened amount.
+ */
+static inline __m128i
+blend_vector_sse2 (__m128i values,
+                   __m128i amounts,
+                   __m128i colors)
+{
+  __m128i zero;
+
+  zero = _mm_setzero_si128 ();
+
+  return _mm_packus_epi16 (blend_channels_sse2 (_mm_unpacklo_epi8 (values, zero), amounts, colors),
+                           blend_channels_sse2 (_mm_unpackhi_epi8 (values, zero), amounts, colors));
+}
+
+static void
+fill_span_sse2 (guint32 *pixels,
+                gint     length,
+                guint32  pixel)
+{
+  __m128i values;
+  gint i;
+
+  values = _mm_set1_epi32 (pixel);
+
+  for (i = 0; i + 4 <= length; i += 4)
+    _mm_storeu_si128 ((__m128i *) (pixels + i), values);
+
+  fill_span_scalar (pixels + i, length - i, pixel);
+}
+
+static void
+blend_coverage_sse2 (guint8       *coverage,
+                     const guint8 *source,
+                     gint          length)
+{
+  __m128i zero;
+  __m128i values;
+  __m128i sources;
+  __m128i inverse;
+  __m128i low;
+  __m128i high;
+  gint i;
+
+  zero = _mm_setzero_si128 ();
+
+  for (i = 0; i + 16 <= length; i += 16)
+    {
+      values = _mm_loadu_si128 ((const __m128i *) (coverage + i));
+      sources = _mm_loadu_si128 ((const __m128i *) (source + i));
+      inverse = _mm_xor_si128 (values, _mm_set1_epi8 (-1));
+
+      low = divide_by_255_sse2 (_mm_mullo_epi16 (_mm_unpacklo_epi8 (sources, zero),
+                                                 _mm_unpacklo_epi8 (inverse, zero)));
+      high = divide_by_255_sse2 (_mm_mullo_epi16 (_mm_unpackhi_epi8 (sources, zero),
+                                                  _mm_unpackhi_epi8 (inverse, zero)));
+
+      _mm_storeu_si128 ((__m128i *) (coverage + i),
+                        _mm_add_epi8 (values, _mm_packus_epi16 (low, high)));
+    }
+
+  blend_coverage_scalar (coverage + i, source + i, length - i);
+}
+
+static void
+blend_color_sse2 (guint32      *pixels,
+                  const guint8 *mask,
+                  gint          length,
+                  guint32       color)
+{
+  __m128i zero;
+  __m128i colors;
+  __m128i values;
+  __m128i amounts;
+  __m128i low;
+  __m128i high;
+  gint32 four_amounts;
+  gint i;
+
+  zero = _mm_setzero_si128 ();
+  colors = _mm_unpacklo_epi8 (_mm_set1_epi32 (color), zero);
+
+  for (i = 0; i + 4 <= length; i += 4)
+    {
+      memcpy (&four_amounts, mask + i, sizeof (four_amounts));
+
+      if (four_amounts == 0)
+        continue;
+
+      // Every byte of a pixel gets the amount of the pixel
+      amounts = _mm_cvtsi32_si128 (four_amounts);
+      amounts = _mm_unpacklo_epi8 (amounts, amounts);
+      amounts = _mm_unpacklo_epi16 (amounts, amounts);
+
+      values = _mm_loadu_si128 ((const __m128i *) (pixels + i));
+      low = blend_channels_sse2 (_mm_unpacklo_epi8 (values, zero),
+                                 _mm_unpacklo_epi8 (amounts, zero),
+                                 colors);
+      high = blend_channels_sse2 (_mm_unpackhi_epi8 (values, zero),
+                                  _mm_unpackhi_epi8 (amounts, zero),
+                                  colors);
+
+      _mm_storeu_si128 ((__m128i *) (pixels + i), _mm_packus_epi16 (low, high));
+    }
+
+  blend_color_scalar (pixels + i, mask + i, length - i, color);
+}
+
+static void
+blend_span_sse2 (guint32 *pixels,
+                 gint     length,
+                 guint32  color,
+                 guint8   amount)
+{
+  __m128i colors;
+  __m128i amounts;
+  __m128i values;
+  gint i;
+
+  colors = _mm_unpacklo_epi8 (_mm_set1_epi32 (color), _mm_setzero_si128 ());
+  amounts = _mm_set1_epi16 (amount);
+
+  for (i = 0; i + 4 <= length; i += 4)
+    {
+      values = _mm_loadu_si128 ((const __m128i *) (pixels + i));
+      _mm_storeu_si128 ((__m128i *) (pixels + i), blend_vector_sse2 (values, amounts, colors));
+    }
+
+  blend_span_scalar (pixels + i, length - i, color, amount);
+}
+
+static inline __m128i
+match_vector_sse2 (__m128i values,
+                   __m128i target,
+                   __m128i tolerance)
+{
+  __m128i difference;
+  __m128i is_within;
+
+  difference = _mm_or_si128 (_mm_subs_epu8 (values, target), _mm_subs_epu8 (target, values));
+  is_within = _mm_cmpeq_epi8 (_mm_max_epu8 (difference, tolerance), tolerance);
+
+  return _mm_cmpeq_epi32 (is_within, _mm_set1_epi32 (-1));
+}
+
+static void
+match_row_sse2 (const guint32 *pixels,
+                gint           length,
+                guint32        target,
+                guint8         tolerance,
+                guint64       *matches)
+{
+  __m128i targets;
+  __m128i tolerances;
+  __m128i is_within;
+  guint64 word;
+  gint x;
+
+  targets = _mm_set1_epi32 (target);
+  tolerances = _mm_set1_epi32 (get_tolerance_pixel (tolerance));
+
+  // 64 is a multiple of the step so steps never straddle words
+  for (x = 0; x + 64 <= length; x += 64)
+    {
+      word = 0;
+
+      for (gint i = 0; i < 64; i += 4)
+        {
+          is_within = match_vector_sse2 (_mm_loadu_si128 ((const __m128i *) (pixels + x + i)),
+                                         targets, tolerances);
+          word |= (guint64) _mm_movemask_ps (_mm_castsi128_ps (is_within)) << i;
+        }
+
+      matches[x / 64] = word;
+    }
+
+  match_words_scalar (pixels, x, length, target, tolerance, matches);
+}
+
+static gboolean
+replace_row_sse2 (guint32 *pixels,
+                  gint     length,
+                  guint32  target,
+                  guint8   tolerance,
+                  guint32  replacement,
+                  guint8   amount,
+                  gint    *first,
+                  gint    *last)
+{
+  __m128i targets;
+  __m128i tolerances;
+  __m128i replacements;
+  __m128i colors;
+  __m128i amounts;
+  __m128i values;
+  __m128i replaced;
+  __m128i is_within;
+  guint bits;
+  gint x;
+
+  *first = length;
+  *last = -1;
+  targets = _mm_set1_epi32 (target);
+  tolerances = _mm_set1_epi32 (get_tolerance_pixel (tolerance));
+  replacements = _mm_set1_epi32 (replacement);
+  colors = _mm_unpacklo_epi8 (replacements, _mm_setzero_si128 ());
+  amounts = _mm_set1_epi16 (amount);
+
+  for (x = 0; x + 4 <= length; x += 4)
+    {
+      values = _mm_loadu_si128 ((const __m128i *) (pixels + x));
+      is_within = match_vector_sse2 (values, targets, tolerances);
+      bits = _mm_movemask_ps (_mm_castsi128_ps (is_within));
+
+      if (bits == 0)
+        continue;
+
+      replaced = amount == 255 ? replacements : blend_vector_sse2 (values, amounts, colors);
+
+      // There is no blend in SSE2
+      values = _mm_or_si128 (_mm_and_si128 (is_within, replaced), _mm_andnot_si128 (is_within, values));
+      _mm_storeu_si128 ((__m128i *) (pixels + x), values);
+
+      *first = MIN (*first, x + g_bit_nth_lsf (bits, -1));
+      *last = x + g_bit_nth_msf (bits, -1);
+    }
+
+  replace_pixels_scalar (pixels, x, length, target, tolerance, replacement, amount, first, last);
+
+  return *last >= 0;
+}
+
+static const PixelKernels sse2_kernels = {
+  "sse2",
+  fill_span_sse2,
+  blend_coverage_sse2,
+  blend_color_sse2,
+  blend_span_sse2,
+  match_row_sse2,
+  replace_row_sse2,
+};
+
+#endif
+
+#if defined (HAVE_AVX2_KERNELS)
+
+static inline AVX2_FUNCTION __m256i
+divide_by_255_avx2 (__m256i values)
+{
+  values = _mm256_add_epi16 (values, _mm256_set1_epi16 (128));
+
+  return _mm256_srli_epi16 (_mm256_add_epi16 (values, _mm256_srli_epi16 (values, 8)), 8);
+}
+
+static inline AVX2_FUNCTION __m256i
+blend_channels_avx2 (__m256i pixels,
+                     __m256i amounts,
+                     __m256i color)
+{
+  __m256i inverse;
+
+  inverse = _mm256_sub_epi16 (_mm256_set1_epi16 (255), amounts);
+
+  return divide_by_255_avx2 (_mm256_add_epi16 (_mm256_mullo_epi16 (pixels, inverse),
+                                               _mm256_mullo_epi16 (color, amounts)));
+}
+
+static inline AVX2_FUNCTION __m256i
+blend_vector_avx2 (__m256i values,
+                   __m256i amounts,
+                   __m256i colors)
+{
+  __m256i zero;
+
+  zero = _mm256_setzero_si256 ();
+
+  return _mm256_packus_epi16 (blend_channels_avx2 (_mm256_unpacklo_epi8 (values, zero), amounts, colors),
+                              blend_channels_avx2 (_mm256_unpackhi_epi8 (values, zero), amounts, colors));
+}
+
+static AVX2_FUNCTION void
+fill_span_avx2 (guint32 *pixels,
+                gint     length,
+                guint32  pixel)
+{
+  __m256i values;
+  gint i;
+
+  values = _mm256_set1_epi32 (pixel);
+
+  for (i = 0; i + 8 <= length; i += 8)
+    _mm256_storeu_si256 ((__m256i *) (pixels + i), values);
+
+  fill_span_scalar (pixels + i, length - i, pixel);
+}
+
+static AVX2_FUNCTION void
+blend_coverage_avx2 (guint8       *coverage,
+                     const guint8 *source,
+                     gint          length)
+{
+  __m256i zero;
+  __m256i values;
+  __m256i sources;
+  __m256i inverse;
+  __m256i low;
+  __m256i high;
+  gint i;
+
+  zero = _mm256_setzero_si256 ();
+
+  for (i = 0; i + 32 <= length; i += 32)
+    {
+      values = _mm256_loadu_si256 ((const __m256i *) (coverage + i));
+      sources = _mm256_loadu_si256 ((const __m256i *) (source + i));
+      inverse = _mm256_xor_si256 (values, _mm256_set1_epi8 (-1));
+
+      low = divide_by_255_avx2 (_mm256_mullo_epi16 (_mm256_unpacklo_epi8 (sources, zero),
+                                                    _mm256_unpacklo_epi8 (inverse, zero)));
+      high = divide_by_255_avx2 (_mm256_mullo_epi16 (_mm256_unpackhi_epi8 (sources, zero),
+                                                     _mm256_unpackhi_epi8 (inverse, zero)));
+
+      _mm256_storeu_si256 ((__m256i *) (coverage + i),
+                           _mm256_add_epi8 (values, _mm256_packus_epi16 (low, high)));
+    }
+
+  // Dabs are narrow, the rest of the row usually fits a SSE2 step
+  blend_coverage_sse2 (coverage + i, source + i, length - i);
+}
+
+static AVX2_FUNCTION void
+blend_color_avx2 (guint32      *pixels,
+                  const guint8 *mask,
+                  gint          length,
+                  guint32       color)
+{
+  __m256i zero;
+  __m256i colors;
+  __m256i values;
+  __m256i amounts;
+  __m256i low;
+  __m256i high;
+  gint64 eight_amounts;
+  gint i;
+
+  zero = _mm256_setzero_si256 ();
+  colors = _mm256_unpacklo_epi8 (_mm256_set1_epi32 (color), zero);
+
+  for (i = 0; i + 8 <= length; i += 8)
+    {
+      memcpy (&eight_amounts, mask + i, sizeof (eight_amounts));
+
+      if (eight_amounts == 0)
+        continue;
+
+      // Every byte of a pixel gets the amount of the pixel
+      amounts = _mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const __m128i *) (mask + i)));
+      amounts = _mm256_mullo_epi32 (amounts, _mm256_set1_epi32 (0x01010101));
+
+      values = _mm256_loadu_si256 ((const __m256i *) (pixels + i));
+      low = blend_channels_avx2 (_mm256_unpacklo_epi8 (values, zero),
+                                 _mm256_unpacklo_epi8 (amounts, zero),
+                                 colors);
+      high = blend_channels_avx2 (_mm256_unpackhi_epi8 (values, zero),
+                                  _mm256_unpackhi_epi8 (amounts, zero),
+                                  colors);
+
+      _mm256_storeu_si256 ((__m256i *) (pixels + i), _mm256_packus_epi16 (low, high));
+    }
+
+  blend_color_sse2 (pixels + i, mask + i, length - i, color);
+}
+
+static AVX2_FUNCTION void
+blend_span_avx2 (guint32 *pixels,
+                 gint     length,
+                 guint32  color,
+                 guint8   amount)
+{
+  __m256i colors;
+  __m256i amounts;
+  __m256i values;
+  gint i;
+
+  colors = _mm256_unpacklo_epi8 (_mm256_set1_epi32 (color), _mm256_setzero_si256 ());
+  amounts = _mm256_set1_epi16 (amount);
+
+  for (i = 0; i + 8 <= length; i += 8)
+    {
+      values = _mm256_loadu_si256 ((const __m256i *) (pixels + i));
+      _mm256_storeu_si256 ((__m256i *) (pixels + i), blend_vector_avx2 (values, amounts, colors));
+    }
+
+  blend_span_sse2 (pixels + i, length - i, color, amount);
+}
+
+static inline AVX2_FUNCTION __m256i
+match_vector_avx2 (__m256i values,
+                   __m256i target,
+                   __m256i tolerance)
+{
+  __m256i difference;
+  __m256i is_within;
+
+  difference = _mm256_or_si256 (_mm256_subs_epu8 (values, target), _mm256_subs_epu8 (target, values));
+  is_within = _mm256_cmpeq_epi8 (_mm256_max_epu8 (difference, tolerance), tolerance);
+
+  return _mm256_cmpeq_epi32 (is_within, _mm256_set1_epi32 (-1));
+}
+
+static AVX2_FUNCTION void
+match_row_avx2 (const guint32 *pixels,
+                gint           length,
+                guint32        target,
+                guint8         tolerance,
+                guint64       *matches)
+{
+  __m256i targets;
+  __m256i tolerances;
+  __m256i is_within;
+  guint64 word;
+  gint x;
+
+  targets = _mm256_set1_epi32 (target);
+  tolerances = _mm256_set1_epi32 (get_tolerance_pixel (tolerance));
+
+  for (x = 0; x + 64 <= length; x += 64)
+    {
+      word = 0;
+
+      for (gint i = 0; i < 64; i += 8)
+        {
+          is_within = match_vector_avx2 (_mm256_loadu_si256 ((const __m256i *) (pixels + x + i)),
+                                         targets, tolerances);
+          word |= (guint64) _mm256_movemask_ps (_mm256_castsi256_ps (is_within)) << i;
+        }
+
+      matches[x / 64] = word;
+    }
+
+  match_words_scalar (pixels, x, length, target, tolerance, matches);
+}
+
+static AVX2_FUNCTION gboolean
+replace_row_avx2 (guint32 *pixels,
+                  gint     length,
+                  guint32  target,
+                  guint8   tolerance,
+                  guint32  replacement,
+                  guint8   amount,
+                  gint    *first,
+                  gint    *last)
+{
+  __m256i targets;
+  __m256i tolerances;
+  __m256i replacements;
+  __m256i colors;
+  __m256i amounts;
+  __m256i values;
+  __m256i replaced;
+  __m256i is_within;
+  guint bits;
+  gint x;
+
+  *first = length;
+  *last = -1;
+  targets = _mm256_set1_epi32 (target);
+  tolerances = _mm256_set1_epi32 (get_tolerance_pixel (tolerance));
+  replacements = _mm256_set1_epi32 (replacement);
+  colors = _mm256_unpacklo_epi8 (replacements, _mm256_setzero_si256 ());
+  amounts = _mm256_set1_epi16 (amount);
+
+  for (x = 0; x + 8 <= length; x += 8)
+    {
+      values = _mm256_loadu_si256 ((const __m256i *) (pixels + x));
+      is_within = match_vector_avx2 (values, targets, tolerances);
+      bits = _mm256_movemask_ps (_mm256_castsi256_ps (is_within));
+
+      if (bits == 0)
+        continue;
+
+      replaced = amount == 255 ? replacements : blend_vector_avx2 (values, amounts, colors);
+      _mm256_storeu_si256 ((__m256i *) (pixels + x), _mm256_blendv_epi8 (values, replaced, is_within));
+
+      *first = MIN (*first, x + g_bit_nth_lsf (bits, -1));
+      *last = x + g_bit_nth_msf (bits, -1);
+    }
+
+  replace_pixels_scalar (pixels, x, length, target, tolerance, replacement, amount, first, last);
+
+  return *last >= 0;
+}
+
+static const PixelKernels avx2_kernels = {
+  "avx2",
+  fill_span_avx2,
+  blend_coverage_avx2,
+  blend_color_avx2,
+  blend_span_avx2,
+  match_row_avx2,
+  replace_row_avx2,
+};
+
+#endif
+
+#if defined (__ARM_NEON) && defined (__aarch64__)
+
+/* The rounding shifts of NEON divide by 255 with the same rounding as the
+ * scalar kernels */
+static inline uint8x8_t
+divide_by_255_neon (uint16x8_t values)
+{
+  return vrshrn_n_u16 (vrsraq_n_u16 (values, values, 8), 8);
+}
+
+static inline uint8x16_t
+blend_vector_neon (uint8x16_t values,
+                   uint8x8_t  amounts,
+                   uint8x16_t colors)
+{
+  uint8x8_t inverse;
+  uint8x8_t low;
+  uint8x8_t high;
+
+  inverse = vmvn_u8 (amounts);
+  low = divide_by_255_neon (vmlal_u8 (vmull_u8 (vget_low_u8 (values), inverse),
+                                      vget_low_u8 (colors), amounts));
+  high = divide_by_255_neon (vmlal_u8 (vmull_u8 (vget_high_u8 (values), inverse),
+                                       vget_high_u8 (colors), amounts));
+
+  return vcombine_u8 (low, high);
+}
+
+static void
+fill_span_neon (guint32 *pixels,
+                gint     length,
+                guint32  pixel)
+{
+  uint32x4_t values;
+  gint i;
+
+  values = vdupq_n_u32 (pixel);
+
+  for (i = 0; i + 4 <= length; i += 4)
+    vst1q_u32 (pixels + i, values);
+
+  fill_span_scalar (pixels + i, length - i, pixel);
+}
+
+static void
+blend_coverage_neon (guint8       *coverage,
+                     const guint8 *source,
+                     gint          length)
+{
+  uint8x16_t values;
+  uint8x16_t sources;
+  uint8x16_t inverse;
+  uint8x8_t low;
+  uint8x8_t high;
+  gint i;
+
+  for (i = 0; i + 16 <= length; i += 16)
+    {
+      values = vld1q_u8 (coverage + i);
+      sources = vld1q_u8 (source + i);
+      inverse = vmvnq_u8 (values);
+
+      low = divide_by_255_neon (vmull_u8 (vget_low_u8 (sources), vget_low_u8 (inverse)));
+      high = divide_by_255_neon (vmull_high_u8 (sources, inverse));
+
+      vst1q_u8 (coverage + i, vaddq_u8 (values, vcombine_u8 (low, high)));
+    }
+
+  blend_coverage_scalar (coverage + i, source + i, length - i);
+}
+
+static void
+blend_color_neon (guint32      *pixels,
+                  const guint8 *mask,
+                  gint          length,
+                  guint32       color)
+{
+  uint8x8x4_t channels;
+  uint8x8_t amounts;
+  uint8x8_t inverse;
+  uint16x8_t sums;
+  gint i;
+
+  for (i = 0; i + 8 <= length; i += 8)
+    {
+      amounts = vld1_u8 (mask + i);
+
+      if (vget_lane_u64 (vreinterpret_u64_u8 (amounts), 0) == 0)
+        continue;
+
+      inverse = vmvn_u8 (amounts);
+
+      // Loading four ways splits the pixels into one vector per channel
+      channels = vld4_u8 ((const guint8 *) (pixels + i));
+
+      for (gint channel = 0; channel < 4; channel++)
+        {
+          sums = vmull_u8 (channels.val[channel], inverse);
+          sums = vmlal_u8 (sums, vdup_n_u8 ((color >> (channel * 8)) & 0xff), amounts);
+          channels.val[channel] = divide_by_255_neon (sums);
+        }
+
+      vst4_u8 ((guint8 *) (pixels + i), channels);
+    }
+
+  blend_color_scalar (pixels + i, mask + i, length - i, color);
+}
+
+static void
+blend_span_neon (guint32 *pixels,
+                 gint     length,
+                 guint32  color,
+                 guint8   amount)
+{
+  uint8x16_t colors;
+  uint8x8_t amounts;
+  uint8x16_t values;
+  gint i;
+
+  colors = vreinterpretq_u8_u32 (vdupq_n_u32 (color));
+  amounts = vdup_n_u8 (amount);
+
+  for (i = 0; i + 4 <= length; i += 4)
+    {
+      values = vld1q_u8 ((const guint8 *) (pixels + i));
+      vst1q_u8 ((guint8 *) (pixels + i), blend_vector_neon (values, amounts, colors));
+    }
+
+  blend_span_scalar (pixels + i, length - i, color, amount);
+}
+
+static inline uint32x4_t
+match_vector_neon (uint8x16_t values,
+                   uint8x16_t target,
+                   uint8x16_t tolerance)
+{
+  uint32x4_t is_within;
+
+  is_within = vreinterpretq_u32_u8 (vcleq_u8 (vabdq_u8 (values, target), tolerance));
+
+  return vceqq_u32 (is_within, vdupq_n_u32 (0xffffffff));
+}
+
+static inline guint
+get_lane_bits_neon (uint32x4_t is_within)
+{
+  static const guint32 bits[4] = { 1, 2, 4, 8 };
+
+  return vaddvq_u32 (vandq_u32 (is_within, vld1q_u32 (bits)));
+}
+
+static void
+match_row_neon (const guint32 *pixels,
+                gint           length,
+                guint32        target,
+                guint8         tolerance,
+                guint64       *matches)
+{
+  uint8x16_t targets;
+  uint8x16_t tolerances;
+  uint32x4_t is_within;
+  guint64 word;
+  gint x;
+
+  targets = vreinterpretq_u8_u32 (vdupq_n_u32 (target));
+  tolerances = vreinterpretq_u8_u32 (vdupq_n_u32 (get_tolerance_pixel (tolerance)));
+
+  for (x = 0; x + 64 <= length; x += 64)
+    {
+      word = 0;
+
+      for (gint i = 0; i < 64; i += 4)
+        {
+          is_within = match_vector_neon (vld1q_u8 ((const guint8 *) (pixels + x + i)),
+                                         targets, tolerances);
+          word |= (guint64) get_lane_bits_neon (is_within) << i;
+        }
+
+      matches[x / 64] = word;
+    }
+
+  match_words_scalar (pixels, x, length, target, tolerance, matches);
+}
+
+static gboolean
+replace_row_neon (guint32 *pixels,
+                  gint     length,
+                  guint32  target,
+                  guint8   tolerance,
+                  guint32  replacement,
+                  guint8   amount,
+                  gint    *first,
+                  gint    *last)
+{
+  uint8x16_t targets;
+  uint8x16_t tolerances;
+  uint8x16_t replacements;
+  uint8x8_t amounts;
+  uint8x16_t values;
+  uint8x16_t replaced;
+  uint32x4_t is_within;
+  guint bits;
+  gint x;
+
+  *first = length;
+  *last = -1;
+  targets = vreinterpretq_u8_u32 (vdupq_n_u32 (target));
+  tolerances = vreinterpretq_u8_u32 (vdupq_n_u32 (get_tolerance_pixel (tolerance)));
+  replacements = vreinterpretq_u8_u32 (vdupq_n_u32 (replacement));
+  amounts = vdup_n_u8 (amount);
+
+  for (x = 0; x + 4 <= length; x += 4)
+    {
+      values = vld1q_u8 ((const guint8 *) (pixels + x));
+      is_within = match_vector_neon (values, targets, tolerances);
+      bits = get_lane_bits_neon (is_within);
+
+      if (bits == 0)
+        continue;
+
+      replaced = amount == 255 ? replacements : blend_vector_neon (values, amounts, replacements);
+      vst1q_u8 ((guint8 *) (pixels + x), vbslq_u8 (vreinterpretq_u8_u32 (is_within), replaced, values));
+
+      *first = MIN (*first, x + g_bit_nth_lsf (bits, -1));
+      *last = x + g_bit_nth_msf (bits, -1);
+    }
+
+  replace_pixels_scalar (pixels, x, length, target, tolerance, replacement, amount, first, last);
+
+  return *last >= 0;
+}
+
+static const PixelKernels neon_kernels = {
+  "neon",
+  fill_span_neon,
+  blend_coverage_neon,
+  blend_color_neon,
+  blend_span_neon,
+  match_row_neon,
+  replace_row_neon,
+};
+
+#endif
+
+static const PixelKernels *
+select_kernels (void)
+{
+#if defined (HAVE_AVX2_KERNELS)
+  if (__builtin_cpu_supports ("avx2"))
+    return &avx2_kernels;
+#endif
+
+#if defined (__SSE2__)
+  return &sse2_kernels;
+#elif defined (__ARM_NEON) && defined (__aarch64__)
+  return &neon_kernels;
+#else
+  return &scalar_kernels;
+#endif
+}
+
+static const PixelKernels *
+get_kernels (void)
+{
+  static gsize kernels = 0;
+  const PixelKernels *selected;
+
+  if (g_once_init_enter (&kernels))
+    {
+      selected = select_kernels ();
+      g_debug ("Using the %s pixel kernels", selected->name);
+      g_once_init_leave (&kernels, (gsize) selected);
+    }
+
+  return (const PixelKernels *) kernels;
+}
+
+void
+pixel_fill_span (guint32 *pixels,
+                 gint     length,
+                 guint32  pixel)
+{
+  get_kernels ()->fill_span (pixels, length, pixel);
+}
+
+void
+pixel_blend_coverage (guint8       *coverage,
+                      const guint8 *source,
+                      gint          length)
+{
+  get_kernels ()->blend_coverage (coverage, source, length);
+}
+
+void
+pixel_blend_color (guint32      *pixels,
+                   const guint8 *mask,
+                   gint          length,
+                   guint32       color)
+{
+  get_kernels ()->blend_color (pixels, mask, length, color);
+}
+
+void
+pixel_blend_span (guint32 *pixels,
+                  gint     length,
+                  guint32  color,
+                  guint8   amount)
+{
+  get_kernels ()->blend_span (pixels, length, color, amount);
+}
+
+/**
+ * Sets a bit in matches for every pixel of the row that matches target, the
+ * first pixel is the lowest bit of matches[0]. matches must have room for length
+ * bits rounded up to a multiple of 64, the bits past length are cleared.
+ */
+void
+pixel_match_row (const guint32 *pixels,
+                 gint           length,
+                 guint32        target,
+                 guint8         tolerance,
+                 guint64       *matches)
+{
+  get_kernels ()->match_row (pixels, length, target, tolerance, matches);
+}
+
+/**
+ * Blends replacement by amount into the pixels of the row that match target,
+ * each one is blended over its own value and an amount of 255 writes
+ * replacement as it is. Returns false if no pixel matched, otherwise first and
+ * last are set to the first and last replaced pixels.
+ */
+gboolean
+pixel_replace_row (guint32 *pixels,
+                   gint     length,
+                   guint32  target,
+                   guint8   tolerance,
+                   guint32  replacement,
+                   guint8   amount,
+                   gint    *first,
+                   gint    *last)
+{
+  return get_kernels ()->replace_row (pixels, length, target, tolerance, replacement, amount, first, last);
+}
+
+const gchar *
+pixel_kernels_get_name (void)
+{
+  return get_kernels ()->name;
+}
@@ -0,0 +1,69 @@
+/* pixel-kernels.h
+ *
+ * Copyright 2023 Rami Alkawadri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <glib.h>
+
+/* Kernels for the pixel loops that run while drawing. Each kernel has SIMD
+ * versions and a scalar one that the others must match exactly, the widest
+ * version the CPU supports is chosen at runtime the first time a kernel is
+ * called. Pixels are RGB24, the unused byte is treated like the others except
+ * by the match kernels. */
+
+void         pixel_fill_span        (guint32       *pixels,
+                                     gint           length,
+                                     guint32        pixel);
+
+/* Paints source over coverage with the OVER operator, both are A8 rows */
+void         pixel_blend_coverage   (guint8        *coverage,
+                                     const guint8  *source,
+                                     gint           length);
+
+/* Blends color into the pixels, each pixel by the amount of its mask byte */
+void         pixel_blend_color      (guint32       *pixels,
+                                     const guint8  *mask,
+                                     gint           length,
+                                     guint32        color);
+
+/* Blends color into all the pixels by the same amount */
+void         pixel_blend_span       (guint32       *pixels,
+                                     gint           length,
+                                     guint32        color,
+                                     guint8         amount);
+
+/* Two pixels match when none of their red, green and blue channels differ by
+ * more than the tolerance, the unused byte is ignored */
+void         pixel_match_row        (const guint32 *pixels,
+                                     gint           length,
+                                     guint32        target,
+                                     guint8         tolerance,
+                                     guint64       *matches);
+
+gboolean     pixel_replace_row      (guint32       *pixels,
+                                     gint           length,
+                                     guint32        target,
+                                     guint8         tolerance,
+                                     guint32        replacement,
+                                     guint8         amount,
+                                     gint          *first,
+                                     gint          *last);
+
+const gchar *pixel_kernels_get_name (void);
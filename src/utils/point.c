@@ -43,3 +43,31 @@ point_is_inside_rectangle (Point        *self,
   return rectangle->x <= self->x && self->x <= rectangle->x + rectangle->width &&
       rectangle->y <= self->y && self->y <= rectangle->y + rectangle->height;
 }
+
+/**
+ * Sets result to the point at t, from 0 to 1, of the Catmull-Rom curve from p1
+ * to p2. The curve goes through p1 and p2, p0 and p3 only shape its tangents.
+ */
+void
+point_catmull_rom (PrecisePoint *p0,
+                   PrecisePoint *p1,
+                   PrecisePoint *p2,
+                   PrecisePoint *p3,
+                   gdouble       t,
+                   PrecisePoint *result)
+{
+  gdouble t2;
+  gdouble t3;
+
+  t2 = t * t;
+  t3 = t2 * t;
+
+  result->x = 0.5 * (2 * p1->x +
+                     (p2->x - p0->x) * t +
+                     (2 * p0->x - 5 * p1->x + 4 * p2->x - p3->x) * t2 +
+                     (3 * p1->x - p0->x - 3 * p2->x + p3->x) * t3);
+  result->y = 0.5 * (2 * p1->y +
+                     (p2->y - p0->y) * t +
+                     (2 * p0->y - 5 * p1->y + 4 * p2->y - p3->y) * t2 +
+                     (3 * p1->y - p0->y - 3 * p2->y + p3->y) * t3);
+}
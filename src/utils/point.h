@@ -28,6 +28,12 @@ typedef struct _Point {
   gint y;
 } Point;
 
+/* A position between pixels, like the positions of the pointer */
+typedef struct _PrecisePoint {
+  gdouble x;
+  gdouble y;
+} PrecisePoint;
+
 Point   *point_new                 (gint x,
                                     gint y);
 
@@ -35,3 +41,10 @@ void     point_dispose             (Point *self);
 
 gboolean point_is_inside_rectangle (Point        *self,
                                     GdkRectangle *rectangle);
+
+void     point_catmull_rom         (PrecisePoint *p0,
+                                    PrecisePoint *p1,
+                                    PrecisePoint *p2,
+                                    PrecisePoint *p3,
+                                    gdouble       t,
+                                    PrecisePoint *result);
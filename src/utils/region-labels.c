@@ -0,0 +1,518 @@
+/* region-labels.c
+ *
+ * Copyright 2023 Rami Alkawadri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "utils/pixel-kernels.h"
+#include "utils/region-labels.h"
+
+/* Images with more than a run every MIN_PIXELS_PER_RUN pixels on average, like
+ * photos, have too many tiny regions for the labels to pay off */
+static const gsize MIN_PIXELS_PER_RUN = 16;
+
+/* A horizontal run of pixels of one color, every pixel is in exactly one */
+typedef struct _LabelRun {
+  gint    y;
+  gint    left;
+  gint    right;
+  guint32 label;
+} LabelRun;
+
+typedef struct _Label {
+  guint32      pixel;
+  GdkRectangle area;
+  guint        first_member;
+  guint        member_count;
+
+  /* Cleared when something changed next to the region */
+  gboolean     is_valid;
+} Label;
+
+struct _RegionLabels {
+  gint      width;
+  gint      height;
+
+  /* Sorted by row then by x, the runs of row y start at row_starts[y] */
+  LabelRun *runs;
+  guint     run_count;
+  guint    *row_starts;
+
+  /* The runs of each label, at first_member in members */
+  Label    *labels;
+  guint     label_count;
+  guint    *members;
+};
+
+/**
+ * Compares the color of two RGB24 pixels, their unused byte can differ.
+ */
+static inline gboolean
+is_same_color (guint32 a,
+               guint32 b)
+{
+  return ((a ^ b) & 0x00ffffff) == 0;
+}
+
+static guint32
+find_root (guint32 *parents,
+           guint32  index)
+{
+  while (parents[index] != index)
+    {
+      parents[index] = parents[parents[index]];
+      index = parents[index];
+    }
+
+  return index;
+}
+
+static void
+join (guint32 *parents,
+      guint32  a,
+      guint32  b)
+{
+  a = find_root (parents, a);
+  b = find_root (parents, b);
+
+  // The smaller index is the root, so a root is always the first run of its region
+  if (a < b)
+    parents[b] = a;
+  else if (b < a)
+    parents[a] = b;
+}
+
+/**
+ * Appends the runs of row y, each with itself as parent.
+ */
+static void
+find_row_runs (GArray  *runs,
+               GArray  *parents,
+               guint32 *row,
+               gint     width,
+               gint     y)
+{
+  LabelRun run;
+  guint32 parent;
+  gint x;
+
+  run.y = y;
+  run.label = 0;
+  x = 0;
+
+  while (x < width)
+    {
+      run.left = x;
+
+      while (x + 1 < width && is_same_color (row[x + 1], row[run.left]))
+        x++;
+
+      run.right = x;
+      x++;
+
+      parent = runs->len;
+      g_array_append_val (runs, run);
+      g_array_append_val (parents, parent);
+    }
+}
+
+/**
+ * Joins the runs of one color of two consecutive rows that touch, diagonals
+ * included. The previous row runs go from previous_first to current_first and
+ * the current row ones from current_first to end.
+ */
+static void
+join_touching_runs (guint32  *parents,
+                    LabelRun *runs,
+                    guint     previous_first,
+                    guint     current_first,
+                    guint     end,
+                    guint32  *previous_row,
+                    guint32  *current_row)
+{
+  guint i;
+
+  i = previous_first;
+
+  for (guint j = current_first; j < end; j++)
+    {
+      // Runs of a row follow each other, so the ones before this run cannot touch the next runs either
+      while (i < current_first && runs[i].right + 1 < runs[j].left)
+        i++;
+
+      for (guint k = i; k < current_first && runs[k].left <= runs[j].right + 1; k++)
+        {
+          if (is_same_color (previous_row[runs[k].left], current_row[runs[j].left]))
+            join (parents, k, j);
+        }
+    }
+}
+
+/**
+ * Groups the runs by label and finds the color and bounding box of each label.
+ */
+static void
+build_labels (RegionLabels *self,
+              guchar       *data,
+              gint          stride)
+{
+  LabelRun *run;
+  Label *label;
+  GdkRectangle run_area;
+  guint first_member;
+
+  self->labels = g_new0 (Label, self->label_count);
+  self->members = g_new (guint, self->run_count);
+
+  for (guint i = 0; i < self->run_count; i++)
+    {
+      run = &self->runs[i];
+      label = &self->labels[run->label];
+
+      run_area.x = run->left;
+      run_area.y = run->y;
+      run_area.width = run->right - run->left + 1;
+      run_area.height = 1;
+
+      if (label->member_count == 0)
+        {
+          label->pixel = ((guint32 *) (data + run->y * stride))[run->left];
+          label->area = run_area;
+          label->is_valid = true;
+        }
+      else
+        {
+          gdk_rectangle_union (&label->area, &run_area, &label->area);
+        }
+
+      label->member_count++;
+    }
+
+  first_member = 0;
+
+  for (guint i = 0; i < self->label_count; i++)
+    {
+      self->labels[i].first_member = first_member;
+      first_member += self->labels[i].member_count;
+      self->labels[i].member_count = 0;
+    }
+
+  for (guint i = 0; i < self->run_count; i++)
+    {
+      label = &self->labels[self->runs[i].label];
+      self->members[label->first_member + label->member_count] = i;
+      label->member_count++;
+    }
+}
+
+/**
+ * Labels the regions of surface, row by row. Returns NULL if the image has too
+ * many regions or if the cancellable of progress, which can be NULL, was
+ * cancelled.
+ */
+RegionLabels *
+region_labels_new (cairo_surface_t   *surface,
+                   FloodFillProgress *progress)
+{
+  RegionLabels *self;
+  GArray *runs;
+  GArray *parents;
+  guint32 *row;
+  guint32 *previous_row;
+  guint32 *parents_data;
+  guint32 root;
+  guchar *data;
+  gsize max_run_count;
+  gint stride;
+  gint width;
+  gint height;
+
+  cairo_surface_flush (surface);
+  data = cairo_image_surface_get_data (surface);
+  stride = cairo_image_surface_get_stride (surface);
+  width = cairo_image_surface_get_width (surface);
+  height = cairo_image_surface_get_height (surface);
+
+  max_run_count = MAX ((gsize) width * height / MIN_PIXELS_PER_RUN, 1);
+  runs = g_array_new (FALSE, FALSE, sizeof (LabelRun));
+  parents = g_array_new (FALSE, FALSE, sizeof (guint32));
+
+  self = g_new0 (RegionLabels, 1);
+  self->width = width;
+  self->height = height;
+  self->row_starts = g_new (guint, height + 1);
+
+  previous_row = NULL;
+
+  for (gint y = 0; y < height; y++)
+    {
+      if (progress != NULL)
+        {
+          if (g_cancellable_is_cancelled (progress->cancellable))
+            break;
+
+          g_atomic_int_set (&progress->permille, (gint) ((gint64) y * 1000 / height));
+        }
+
+      row = (guint32 *) (data + y * stride);
+      self->row_starts[y] = runs->len;
+      find_row_runs (runs, parents, row, width, y);
+
+      if (runs->len > max_run_count)
+        break;
+
+      if (y > 0)
+        join_touching_runs ((guint32 *) parents->data, (LabelRun *) runs->data,
+                            self->row_starts[y - 1], self->row_starts[y], runs->len,
+                            previous_row, row);
+
+      previous_row = row;
+      self->row_starts[y + 1] = runs->len;
+    }
+
+  if (runs->len > max_run_count || (progress != NULL && g_cancellable_is_cancelled (progress->cancellable)))
+    {
+      g_array_unref (runs);
+      g_array_unref (parents);
+      g_free (self->row_starts);
+      g_free (self);
+
+      return NULL;
+    }
+
+  self->run_count = runs->len;
+  self->runs = (LabelRun *) g_array_free (runs, FALSE);
+  parents_data = (guint32 *) parents->data;
+
+  // Roots come first in their regions, so a region gets its label at its root
+  for (guint i = 0; i < self->run_count; i++)
+    {
+      root = find_root (parents_data, i);
+
+      if (root == i)
+        self->runs[i].label = self->label_count++;
+      else
+        self->runs[i].label = self->runs[root].label;
+    }
+
+  g_array_unref (parents);
+
+  build_labels (self, data, stride);
+
+  return self;
+}
+
+void
+region_labels_dispose (RegionLabels *self)
+{
+  g_free (self->runs);
+  g_free (self->row_starts);
+  g_free (self->labels);
+  g_free (self->members);
+  g_free (self);
+}
+
+/**
+ * Returns the index of the run with the pixel at (x, y), which must be in the
+ * image.
+ */
+static guint
+find_run (RegionLabels *self,
+          gint          x,
+          gint          y)
+{
+  guint low;
+  guint high;
+  guint middle;
+
+  low = self->row_starts[y];
+  high = self->row_starts[y + 1];
+
+  while (low + 1 < high)
+    {
+      middle = low + (high - low) / 2;
+
+      if (self->runs[middle].left <= x)
+        low = middle;
+      else
+        high = middle;
+    }
+
+  return low;
+}
+
+/**
+ * Finds the region of (x, y). Returns false if it is outside the image or if the
+ * region is no longer valid, otherwise sets pixel to the color of the region
+ * and area to its bounding box.
+ */
+gboolean
+region_labels_lookup (RegionLabels *self,
+                      gint          x,
+                      gint          y,
+                      guint32      *pixel,
+                      GdkRectangle *area)
+{
+  Label *label;
+
+  if (x < 0 || y < 0 || x >= self->width || y >= self->height)
+    return false;
+
+  label = &self->labels[self->runs[find_run (self, x, y)].label];
+
+  if (!label->is_valid)
+    return false;
+
+  *pixel = label->pixel;
+  *area = label->area;
+
+  return true;
+}
+
+/**
+ * Forgets the labels that have runs of row y between left and right, both
+ * included and inside the image.
+ */
+static void
+invalidate_row (RegionLabels *self,
+                gint          y,
+                gint          left,
+                gint          right)
+{
+  for (guint i = find_run (self, left, y); i < self->row_starts[y + 1] && self->runs[i].left <= right; i++)
+    self->labels[self->runs[i].label].is_valid = false;
+}
+
+/**
+ * Gives the region of index label its new color. If it now touches a region of
+ * the same color they are one region, both are forgotten so the next fill on
+ * them labels the image again.
+ */
+static void
+recolor_label (RegionLabels *self,
+               guint         index,
+               guint32       pixel)
+{
+  Label *label;
+  LabelRun *run;
+  LabelRun *neighbor;
+  gboolean touches_same_color;
+  gint left;
+  gint right;
+
+  label = &self->labels[index];
+
+  if (is_same_color (label->pixel, pixel))
+    {
+      label->pixel = pixel;
+      return;
+    }
+
+  label->pixel = pixel;
+  touches_same_color = false;
+
+  for (guint i = 0; i < label->member_count; i++)
+    {
+      run = &self->runs[self->members[label->first_member + i]];
+      left = MAX (run->left - 1, 0);
+      right = MIN (run->right + 1, self->width - 1);
+
+      for (gint y = MAX (run->y - 1, 0); y <= MIN (run->y + 1, self->height - 1); y++)
+        {
+          for (guint j = find_run (self, left, y); j < self->row_starts[y + 1] && self->runs[j].left <= right; j++)
+            {
+              neighbor = &self->runs[j];
+
+              if (neighbor->label != index && is_same_color (self->labels[neighbor->label].pixel, pixel))
+                {
+                  self->labels[neighbor->label].is_valid = false;
+                  touches_same_color = true;
+                }
+            }
+        }
+    }
+
+  if (touches_same_color)
+    label->is_valid = false;
+}
+
+/**
+ * Writes fill_pixel to the pixels of the region of (x, y), which must be valid.
+ * surface can cover only part of the image, its device offset places it. The
+ * labels then know about the new color of the region.
+ */
+void
+region_labels_fill (RegionLabels    *self,
+                    gint             x,
+                    gint             y,
+                    guint32          fill_pixel,
+                    cairo_surface_t *surface)
+{
+  Label *label;
+  LabelRun *run;
+  guint32 *row;
+  guchar *data;
+  guint index;
+  gdouble offset_x;
+  gdouble offset_y;
+  gint stride;
+
+  index = self->runs[find_run (self, x, y)].label;
+  label = &self->labels[index];
+
+  cairo_surface_flush (surface);
+  data = cairo_image_surface_get_data (surface);
+  stride = cairo_image_surface_get_stride (surface);
+  cairo_surface_get_device_offset (surface, &offset_x, &offset_y);
+
+  for (guint i = 0; i < label->member_count; i++)
+    {
+      run = &self->runs[self->members[label->first_member + i]];
+      row = (guint32 *) (data + (run->y + (gint) offset_y) * stride) + (gint) offset_x;
+
+      pixel_fill_span (row + run->left, run->right - run->left + 1, fill_pixel);
+    }
+
+  cairo_surface_mark_dirty (surface);
+
+  recolor_label (self, index, fill_pixel);
+}
+
+/**
+ * Forgets the regions that area changed, and the ones next to it since they may
+ * have joined.
+ */
+void
+region_labels_invalidate (RegionLabels *self,
+                          GdkRectangle *area)
+{
+  gint left;
+  gint top;
+  gint right;
+  gint bottom;
+
+  left = MAX (area->x - 1, 0);
+  top = MAX (area->y - 1, 0);
+  right = MIN (area->x + area->width, self->width - 1);
+  bottom = MIN (area->y + area->height, self->height - 1);
+
+  if (area->width <= 0 || area->height <= 0 || left > right || top > bottom)
+    return;
+
+  for (gint y = top; y <= bottom; y++)
+    invalidate_row (self, y, left, right);
+}
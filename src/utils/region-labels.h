@@ -0,0 +1,50 @@
+/* region-labels.h
+ *
+ * Copyright 2023 Rami Alkawadri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+#include "utils/flood-fill.h"
+
+/* The image split into its 8-connected regions of one exact color, so filling a
+ * region again is a lookup. A change to the image only forgets the regions
+ * around it, the others stay valid. */
+struct _RegionLabels;
+
+typedef struct _RegionLabels RegionLabels;
+
+RegionLabels *region_labels_new        (cairo_surface_t   *surface,
+                                        FloodFillProgress *progress);
+void          region_labels_dispose    (RegionLabels      *self);
+
+gboolean      region_labels_lookup     (RegionLabels      *self,
+                                        gint               x,
+                                        gint               y,
+                                        guint32           *pixel,
+                                        GdkRectangle      *area);
+void          region_labels_fill       (RegionLabels      *self,
+                                        gint               x,
+                                        gint               y,
+                                        guint32            fill_pixel,
+                                        cairo_surface_t   *surface);
+
+void          region_labels_invalidate (RegionLabels      *self,
+                                        GdkRectangle      *area);
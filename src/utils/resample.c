@@ -0,0 +1,393 @@
+/* resample.c
+ *
+ * Copyright 2023 Rami Alkawadri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#if defined (__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "utils/resample.h"
+
+// Smaller areas are resampled on the calling thread
+static const gsize PARALLEL_RESAMPLE_MIN_PIXELS = 512 * 512;
+
+// Rows of a band, a few bands per thread keep the threads busy until the end
+static const gint RESAMPLE_BAND_HEIGHT = 32;
+
+typedef struct _ResampleState {
+  const guchar   *source_data;
+  gint            source_width;
+  gint            source_height;
+  gint            source_stride;
+
+  /* Alpha set on every source pixel, the unused byte of RGB24 pixels is not
+   * an alpha while ARGB32 pixels have their own */
+  guint32         source_alpha;
+
+  cairo_matrix_t  to_source;
+  ResampleFilter  filter;
+
+  GdkRectangle    area;
+  guchar         *data;
+  gint            stride;
+} ResampleState;
+
+typedef struct _ResampleBand {
+  ResampleState *state;
+  gint           first_row;
+  gint           end_row;
+} ResampleBand;
+
+/**
+ * Returns the source pixel at (x, y) as a premultiplied pixel, or a transparent
+ * one outside the source so the edges of the result fade out.
+ */
+static inline guint32
+get_source_pixel (ResampleState *state,
+                  gint           x,
+                  gint           y)
+{
+  if (x < 0 || y < 0 || x >= state->source_width || y >= state->source_height)
+    return 0;
+
+  return ((const guint32 *) (state->source_data + y * state->source_stride))[x] | state->source_alpha;
+}
+
+/**
+ * Returns the Catmull-Rom weights of the four samples around a position at t
+ * past the second one, the cubic goes through the samples.
+ */
+static void
+get_cubic_weights (gfloat t,
+                   gfloat weights[4])
+{
+  weights[0] = ((-0.5f * t + 1) * t - 0.5f) * t;
+  weights[1] = (1.5f * t - 2.5f) * t * t + 1;
+  weights[2] = ((-1.5f * t + 2) * t + 0.5f) * t;
+  weights[3] = (0.5f * t - 0.5f) * t * t;
+}
+
+#if defined (__SSE2__)
+
+/* One pixel per vector, its four channels are interpolated together */
+
+static inline __m128i
+blend_pairs (__m128i pairs,
+             gint    weight)
+{
+  __m128i weights;
+
+  // The low pixel of each pair gets 256 - weight, the high one weight
+  weights = _mm_set_epi16 (weight, weight, weight, weight,
+                           256 - weight, 256 - weight, 256 - weight, 256 - weight);
+  pairs = _mm_mullo_epi16 (pairs, weights);
+  pairs = _mm_add_epi16 (pairs, _mm_srli_si128 (pairs, 8));
+
+  return _mm_srli_epi16 (_mm_add_epi16 (pairs, _mm_set1_epi16 (128)), 8);
+}
+
+static guint32
+interpolate_bilinear (guint32 top_left,
+                      guint32 top_right,
+                      guint32 bottom_left,
+                      guint32 bottom_right,
+                      gint    weight_x,
+                      gint    weight_y)
+{
+  __m128i zero;
+  __m128i top;
+  __m128i bottom;
+  __m128i result;
+
+  zero = _mm_setzero_si128 ();
+  top = blend_pairs (_mm_unpacklo_epi8 (_mm_set_epi32 (0, 0, top_right, top_left), zero), weight_x);
+  bottom = blend_pairs (_mm_unpacklo_epi8 (_mm_set_epi32 (0, 0, bottom_right, bottom_left), zero), weight_x);
+  result = blend_pairs (_mm_unpacklo_epi64 (top, bottom), weight_y);
+
+  return _mm_cvtsi128_si32 (_mm_packus_epi16 (result, zero));
+}
+
+static guint32
+sample_bicubic (ResampleState *state,
+                gint           left,
+                gint           top,
+                gfloat         weights_x[4],
+                gfloat         weights_y[4])
+{
+  const guint32 *source_row;
+  __m128i zero;
+  __m128i pixels;
+  __m128i halves[2];
+  __m128i pixel;
+  __m128 row;
+  __m128 sum;
+  __m128 alpha;
+  gboolean is_inside;
+
+  zero = _mm_setzero_si128 ();
+  sum = _mm_setzero_ps ();
+  is_inside = left >= 0 && top >= 0 &&
+              left + 3 < state->source_width && top + 3 < state->source_height;
+
+  for (gint j = 0; j < 4; j++)
+    {
+      if (is_inside)
+        {
+          // The four pixels of the row are loaded at once, then widened one by one
+          source_row = (const guint32 *) (state->source_data + (top + j) * state->source_stride);
+          pixels = _mm_or_si128 (_mm_loadu_si128 ((const __m128i *) (source_row + left)),
+                                 _mm_set1_epi32 (state->source_alpha));
+          halves[0] = _mm_unpacklo_epi8 (pixels, zero);
+          halves[1] = _mm_unpackhi_epi8 (pixels, zero);
+        }
+
+      row = _mm_setzero_ps ();
+
+      for (gint i = 0; i < 4; i++)
+        {
+          if (is_inside)
+            {
+              pixel = i % 2 == 0 ? _mm_unpacklo_epi16 (halves[i / 2], zero) :
+                                   _mm_unpackhi_epi16 (halves[i / 2], zero);
+            }
+          else
+            {
+              pixel = _mm_cvtsi32_si128 (get_source_pixel (state, left + i, top + j));
+              pixel = _mm_unpacklo_epi16 (_mm_unpacklo_epi8 (pixel, zero), zero);
+            }
+
+          row = _mm_add_ps (row, _mm_mul_ps (_mm_cvtepi32_ps (pixel), _mm_set1_ps (weights_x[i])));
+        }
+
+      sum = _mm_add_ps (sum, _mm_mul_ps (row, _mm_set1_ps (weights_y[j])));
+    }
+
+  // The cubic overshoots, premultiplied channels must stay within the alpha
+  alpha = _mm_shuffle_ps (sum, sum, _MM_SHUFFLE (3, 3, 3, 3));
+  alpha = _mm_min_ps (_mm_max_ps (alpha, _mm_setzero_ps ()), _mm_set1_ps (255));
+  sum = _mm_min_ps (_mm_max_ps (sum, _mm_setzero_ps ()), alpha);
+
+  pixel = _mm_cvtps_epi32 (sum);
+  pixel = _mm_packs_epi32 (pixel, zero);
+
+  return _mm_cvtsi128_si32 (_mm_packus_epi16 (pixel, zero));
+}
+
+#else
+
+static inline guint32
+interpolate_channel (guint32 a,
+                     guint32 b,
+                     gint    weight)
+{
+  return (a * (256 - weight) + b * weight + 128) >> 8;
+}
+
+static guint32
+interpolate_bilinear (guint32 top_left,
+                      guint32 top_right,
+                      guint32 bottom_left,
+                      guint32 bottom_right,
+                      gint    weight_x,
+                      gint    weight_y)
+{
+  guint32 top;
+  guint32 bottom;
+  guint32 result;
+
+  result = 0;
+
+  for (gint shift = 0; shift < 32; shift += 8)
+    {
+      top = interpolate_channel ((top_left >> shift) & 0xff, (top_right >> shift) & 0xff, weight_x);
+      bottom = interpolate_channel ((bottom_left >> shift) & 0xff, (bottom_right >> shift) & 0xff, weight_x);
+      result |= interpolate_channel (top, bottom, weight_y) << shift;
+    }
+
+  return result;
+}
+
+static guint32
+sample_bicubic (ResampleState *state,
+                gint           left,
+                gint           top,
+                gfloat         weights_x[4],
+                gfloat         weights_y[4])
+{
+  gfloat sums[4] = { 0, 0, 0, 0 };
+  gfloat row[4];
+  guint32 pixel;
+  guint32 result;
+
+  for (gint j = 0; j < 4; j++)
+    {
+      memset (row, 0, sizeof (row));
+
+      for (gint i = 0; i < 4; i++)
+        {
+          pixel = get_source_pixel (state, left + i, top + j);
+
+          for (gint channel = 0; channel < 4; channel++)
+            row[channel] += ((pixel >> (channel * 8)) & 0xff) * weights_x[i];
+        }
+
+      for (gint channel = 0; channel < 4; channel++)
+        sums[channel] += row[channel] * weights_y[j];
+    }
+
+  // The cubic overshoots, premultiplied channels must stay within the alpha
+  sums[3] = CLAMP (sums[3], 0, 255);
+  result = 0;
+
+  for (gint channel = 0; channel < 4; channel++)
+    result |= (guint32) (CLAMP (sums[channel], 0, sums[3]) + 0.5f) << (channel * 8);
+
+  return result;
+}
+
+#endif
+
+static guint32
+sample (ResampleState *state,
+        gdouble        x,
+        gdouble        y)
+{
+  gfloat weights_x[4];
+  gfloat weights_y[4];
+  gint left;
+  gint top;
+
+  // Samples are at the centers of the pixels
+  x -= 0.5;
+  y -= 0.5;
+
+  if (x < -2 || y < -2 || x > state->source_width + 1 || y > state->source_height + 1)
+    return 0;
+
+  left = floor (x);
+  top = floor (y);
+
+  if (state->filter == RESAMPLE_BICUBIC)
+    {
+      get_cubic_weights (x - left, weights_x);
+      get_cubic_weights (y - top, weights_y);
+
+      return sample_bicubic (state, left - 1, top - 1, weights_x, weights_y);
+    }
+
+  return interpolate_bilinear (get_source_pixel (state, left, top),
+                               get_source_pixel (state, left + 1, top),
+                               get_source_pixel (state, left, top + 1),
+                               get_source_pixel (state, left + 1, top + 1),
+                               (x - left) * 256 + 0.5,
+                               (y - top) * 256 + 0.5);
+}
+
+static void
+resample_band (gpointer data,
+               gpointer user_data)
+{
+  ResampleBand *band = data;
+  ResampleState *state = band->state;
+  cairo_matrix_t *matrix;
+  guint32 *row;
+  gdouble image_x;
+  gdouble image_y;
+
+  matrix = &state->to_source;
+
+  for (gint y = band->first_row; y < band->end_row; y++)
+    {
+      row = (guint32 *) (state->data + y * state->stride);
+      image_y = state->area.y + y + 0.5;
+
+      for (gint x = 0; x < state->area.width; x++)
+        {
+          image_x = state->area.x + x + 0.5;
+          row[x] = sample (state,
+                           matrix->xx * image_x + matrix->xy * image_y + matrix->x0,
+                           matrix->yx * image_x + matrix->yy * image_y + matrix->y0);
+        }
+    }
+}
+
+/**
+ * Returns an ARGB32 surface with the pixels of area, in the coordinates of the
+ * destination, each one sampled from source at the position to_source maps its
+ * center to. The surface has a device offset so it can be painted at (0, 0),
+ * it is transparent where nothing of source lands.
+ */
+cairo_surface_t *
+resample_surface (cairo_surface_t      *source,
+                  const cairo_matrix_t *to_source,
+                  GdkRectangle         *area,
+                  ResampleFilter        filter)
+{
+  cairo_surface_t *result;
+  ResampleState state;
+  ResampleBand *bands;
+  GThreadPool *pool;
+  gint band_count;
+
+  result = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, area->width, area->height);
+
+  cairo_surface_flush (source);
+  state.source_data = cairo_image_surface_get_data (source);
+  state.source_width = cairo_image_surface_get_width (source);
+  state.source_height = cairo_image_surface_get_height (source);
+  state.source_stride = cairo_image_surface_get_stride (source);
+  state.source_alpha = cairo_image_surface_get_format (source) == CAIRO_FORMAT_RGB24 ? 0xff000000 : 0;
+  state.to_source = *to_source;
+  state.filter = filter;
+  state.area = *area;
+  state.data = cairo_image_surface_get_data (result);
+  state.stride = cairo_image_surface_get_stride (result);
+
+  band_count = (area->height + RESAMPLE_BAND_HEIGHT - 1) / RESAMPLE_BAND_HEIGHT;
+  bands = g_new (ResampleBand, band_count);
+
+  for (gint i = 0; i < band_count; i++)
+    {
+      bands[i].state = &state;
+      bands[i].first_row = i * RESAMPLE_BAND_HEIGHT;
+      bands[i].end_row = MIN ((i + 1) * RESAMPLE_BAND_HEIGHT, area->height);
+    }
+
+  if ((gsize) area->width * area->height >= PARALLEL_RESAMPLE_MIN_PIXELS && g_get_num_processors () > 1)
+    {
+      pool = g_thread_pool_new (resample_band, NULL, g_get_num_processors (), FALSE, NULL);
+
+      for (gint i = 0; i < band_count; i++)
+        g_thread_pool_push (pool, &bands[i], NULL);
+
+      g_thread_pool_free (pool, FALSE, TRUE);
+    }
+  else
+    {
+      for (gint i = 0; i < band_count; i++)
+        resample_band (&bands[i], NULL);
+    }
+
+  g_free (bands);
+
+  cairo_surface_mark_dirty (result);
+  cairo_surface_set_device_offset (result, -area->x, -area->y);
+
+  return result;
+}
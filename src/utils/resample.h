@@ -0,0 +1,37 @@
+/* resample.h
+ *
+ * Copyright 2023 Rami Alkawadri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+/* Resampling of a surface through an affine transform, for the transforms that
+ * are committed to the image. Rows are split between threads for big areas and
+ * the pixels are interpolated with SSE2 where the CPU has it. */
+
+typedef enum {
+  RESAMPLE_BILINEAR,
+  RESAMPLE_BICUBIC,
+} ResampleFilter;
+
+cairo_surface_t *resample_surface (cairo_surface_t      *source,
+                                   const cairo_matrix_t *to_source,
+                                   GdkRectangle         *area,
+                                   ResampleFilter        filter);
@@ -0,0 +1,587 @@
+/* selection-mask.c
+ *
+ * Copyright 2023 Rami Alkawadri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "utils/selection-mask.h"
+
+/* Rows of whole 64 bit words, the bits past the width are always clear */
+struct _SelectionMask {
+  GdkRectangle  area;
+  gsize         words_per_row;
+  guint64      *bits;
+
+  /* Relative to the top left corner of area, NULL until it is first needed */
+  cairo_path_t *outline;
+};
+
+static inline gboolean
+is_bit_set (const guint64 *bits,
+            gint           x)
+{
+  return (bits[x / 64] >> (x % 64)) & 1;
+}
+
+/**
+ * Returns the 64 bits of row that start at bit x, the bits past the end of the
+ * row are clear.
+ */
+static inline guint64
+get_bits_at (const guint64 *row,
+             gsize          words_per_row,
+             gint           x)
+{
+  gsize word;
+  gint shift;
+  guint64 bits;
+
+  word = x / 64;
+  shift = x % 64;
+  bits = word < words_per_row ? row[word] >> shift : 0;
+
+  if (shift > 0 && word + 1 < words_per_row)
+    bits |= row[word + 1] << (64 - shift);
+
+  return bits;
+}
+
+/**
+ * Sets the bits from first to last, both included.
+ */
+static void
+set_bits (guint64 *row,
+          gint     first,
+          gint     last)
+{
+  guint64 first_mask;
+  guint64 last_mask;
+  gint first_word;
+  gint last_word;
+
+  first_word = first / 64;
+  last_word = last / 64;
+  first_mask = ~G_GUINT64_CONSTANT (0) << (first % 64);
+  last_mask = ~G_GUINT64_CONSTANT (0) >> (63 - last % 64);
+
+  if (first_word == last_word)
+    {
+      row[first_word] |= first_mask & last_mask;
+      return;
+    }
+
+  row[first_word] |= first_mask;
+
+  for (gint i = first_word + 1; i < last_word; i++)
+    row[i] = ~G_GUINT64_CONSTANT (0);
+
+  row[last_word] |= last_mask;
+}
+
+static SelectionMask *
+selection_mask_new (GdkRectangle *area)
+{
+  SelectionMask *self;
+
+  self = g_new0 (SelectionMask, 1);
+  self->area = *area;
+  self->words_per_row = (area->width + 63) / 64;
+  self->bits = g_new0 (guint64, self->words_per_row * area->height);
+
+  return self;
+}
+
+/**
+ * Creates a mask of the set bits of area. bits covers the image from its top
+ * left corner, in rows of words_per_row words.
+ */
+SelectionMask *
+selection_mask_new_from_bits (const guint64 *bits,
+                              gsize          words_per_row,
+                              GdkRectangle  *area)
+{
+  SelectionMask *self;
+  const guint64 *source_row;
+  guint64 *row;
+
+  self = selection_mask_new (area);
+
+  for (gint y = 0; y < area->height; y++)
+    {
+      source_row = bits + (area->y + y) * words_per_row;
+      row = self->bits + y * self->words_per_row;
+
+      for (gsize i = 0; i < self->words_per_row; i++)
+        row[i] = get_bits_at (source_row, words_per_row, area->x + i * 64);
+
+      if (area->width % 64 != 0)
+        row[self->words_per_row - 1] &= (G_GUINT64_CONSTANT (1) << (area->width % 64)) - 1;
+    }
+
+  return self;
+}
+
+/* An edge of the polygon over the rows whose centers it crosses, it crosses the
+ * center of row y at x + y * step. Computing it for each row instead of adding
+ * step keeps the centers that are exactly on an edge on the same side. */
+typedef struct _PolygonEdge {
+  gint    first_row;
+  gint    end_row;
+  gdouble x;
+  gdouble step;
+  gint    direction;
+} PolygonEdge;
+
+typedef struct _Crossing {
+  gdouble x;
+  gint    direction;
+} Crossing;
+
+static gint
+compare_edges (gconstpointer a,
+               gconstpointer b)
+{
+  return ((const PolygonEdge *) a)->first_row - ((const PolygonEdge *) b)->first_row;
+}
+
+static gint
+compare_crossings (gconstpointer a,
+                   gconstpointer b)
+{
+  gdouble difference = ((const Crossing *) a)->x - ((const Crossing *) b)->x;
+
+  return (difference > 0) - (difference < 0);
+}
+
+/**
+ * Returns the edges of the closed polygon that cross a row center, sorted by
+ * their first row.
+ */
+static GArray *
+get_polygon_edges (const Point *points,
+                   guint        count)
+{
+  GArray *edges;
+  PolygonEdge edge;
+  const Point *start;
+  const Point *end;
+
+  edges = g_array_sized_new (FALSE, FALSE, sizeof (PolygonEdge), count);
+
+  for (guint i = 0; i < count; i++)
+    {
+      start = &points[i];
+      end = &points[(i + 1) % count];
+      edge.direction = end->y > start->y ? 1 : -1;
+
+      if (edge.direction < 0)
+        {
+          start = end;
+          end = &points[i];
+        }
+
+      // The row centers are at y + 0.5, an edge covers the ones in [start, end)
+      edge.first_row = ceil (start->y - 0.5);
+      edge.end_row = ceil (end->y - 0.5);
+
+      if (edge.first_row >= edge.end_row)
+        continue;
+
+      edge.step = (end->x - start->x) / (gdouble) (end->y - start->y);
+      edge.x = start->x + (0.5 - start->y) * edge.step;
+      g_array_append_val (edges, edge);
+    }
+
+  g_array_sort (edges, compare_edges);
+
+  return edges;
+}
+
+/**
+ * Creates a mask of the pixels whose centers are inside the closed polygon,
+ * within bounds, following fill_rule. Rows are filled from the edges that
+ * cross them, so the time depends on the size of the polygon rather than on
+ * the size of the image. Returns NULL if the polygon is outside bounds.
+ */
+SelectionMask *
+selection_mask_new_from_polygon (const Point      *points,
+                                 guint             count,
+                                 cairo_fill_rule_t fill_rule,
+                                 GdkRectangle     *bounds)
+{
+  SelectionMask *self;
+  GdkRectangle area;
+  GArray *edges;
+  GArray *active_edges;
+  GArray *crossings;
+  PolygonEdge *edge;
+  Crossing crossing;
+  Crossing *row_crossings;
+  gdouble min_x = G_MAXDOUBLE;
+  gdouble min_y = G_MAXDOUBLE;
+  gdouble max_x = -G_MAXDOUBLE;
+  gdouble max_y = -G_MAXDOUBLE;
+  guint next_edge;
+  gint winding;
+  gint first;
+  gint last;
+
+  if (count < 3)
+    return NULL;
+
+  for (guint i = 0; i < count; i++)
+    {
+      min_x = MIN (min_x, points[i].x);
+      min_y = MIN (min_y, points[i].y);
+      max_x = MAX (max_x, points[i].x);
+      max_y = MAX (max_y, points[i].y);
+    }
+
+  area.x = floor (min_x);
+  area.y = floor (min_y);
+  area.width = ceil (max_x) - area.x;
+  area.height = ceil (max_y) - area.y;
+
+  if (!gdk_rectangle_intersect (&area, bounds, &area))
+    return NULL;
+
+  self = selection_mask_new (&area);
+  edges = get_polygon_edges (points, count);
+  active_edges = g_array_new (FALSE, FALSE, sizeof (PolygonEdge));
+  crossings = g_array_new (FALSE, FALSE, sizeof (Crossing));
+  next_edge = 0;
+
+  for (gint y = area.y; y < area.y + area.height; y++)
+    {
+      while (next_edge < edges->len &&
+             g_array_index (edges, PolygonEdge, next_edge).first_row <= y)
+        {
+          edge = &g_array_index (edges, PolygonEdge, next_edge++);
+          g_array_append_val (active_edges, *edge);
+        }
+
+      g_array_set_size (crossings, 0);
+
+      for (guint i = 0; i < active_edges->len; i++)
+        {
+          edge = &g_array_index (active_edges, PolygonEdge, i);
+
+          if (edge->end_row <= y)
+            {
+              g_array_remove_index_fast (active_edges, i--);
+              continue;
+            }
+
+          crossing.x = edge->x + y * edge->step;
+          crossing.direction = edge->direction;
+          g_array_append_val (crossings, crossing);
+        }
+
+      g_array_sort (crossings, compare_crossings);
+      row_crossings = (Crossing *) crossings->data;
+      winding = 0;
+
+      for (guint i = 0; i + 1 < crossings->len; i++)
+        {
+          if (fill_rule == CAIRO_FILL_RULE_EVEN_ODD)
+            winding ^= 1;
+          else
+            winding += row_crossings[i].direction;
+
+          if (winding == 0)
+            continue;
+
+          // The pixels whose centers are between the two crossings
+          first = MAX (ceil (row_crossings[i].x - 0.5), area.x);
+          last = MIN (ceil (row_crossings[i + 1].x - 0.5), area.x + area.width) - 1;
+
+          if (first <= last)
+            set_bits (self->bits + (y - area.y) * self->words_per_row,
+                      first - area.x, last - area.x);
+        }
+    }
+
+  g_array_unref (edges);
+  g_array_unref (active_edges);
+  g_array_unref (crossings);
+
+  return self;
+}
+
+void
+selection_mask_dispose (SelectionMask *self)
+{
+  g_clear_pointer (&self->outline, cairo_path_destroy);
+  g_free (self->bits);
+  g_free (self);
+}
+
+GdkRectangle
+selection_mask_get_area (SelectionMask *self)
+{
+  return self->area;
+}
+
+/**
+ * Moves the top left corner of the mask to (x, y), the outline moves with it.
+ */
+void
+selection_mask_move_to (SelectionMask *self,
+                        gint           x,
+                        gint           y)
+{
+  self->area.x = x;
+  self->area.y = y;
+}
+
+gboolean
+selection_mask_contains (SelectionMask *self,
+                         gint           x,
+                         gint           y)
+{
+  x -= self->area.x;
+  y -= self->area.y;
+
+  if (x < 0 || y < 0 || x >= self->area.width || y >= self->area.height)
+    return false;
+
+  return is_bit_set (self->bits + y * self->words_per_row, x);
+}
+
+/**
+ * Returns an A8 surface that is opaque on the selected pixels, placed by its
+ * device offset, or NULL if the mask is too big for an image surface.
+ */
+cairo_surface_t *
+selection_mask_to_surface (SelectionMask *self)
+{
+  cairo_surface_t *surface;
+  guint64 *row;
+  guchar *pixels;
+  gint stride;
+  gint x;
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_A8, self->area.width, self->area.height);
+
+  if (cairo_surface_status (surface) != CAIRO_STATUS_SUCCESS)
+    {
+      cairo_surface_destroy (surface);
+      return NULL;
+    }
+
+  cairo_surface_flush (surface);
+  stride = cairo_image_surface_get_stride (surface);
+
+  for (gint y = 0; y < self->area.height; y++)
+    {
+      row = self->bits + y * self->words_per_row;
+      pixels = cairo_image_surface_get_data (surface) + y * stride;
+      x = 0;
+
+      while (x < self->area.width)
+        {
+          // Whole words without selected pixels are skipped at once
+          if (x % 64 == 0 && row[x / 64] == 0)
+            {
+              x += 64;
+              continue;
+            }
+
+          if (is_bit_set (row, x))
+            pixels[x] = 0xff;
+
+          x++;
+        }
+    }
+
+  cairo_surface_mark_dirty (surface);
+  cairo_surface_set_device_offset (surface, -self->area.x, -self->area.y);
+
+  return surface;
+}
+
+/**
+ * Adds a line at y for every run of set bits of edges.
+ */
+static void
+add_horizontal_edges (cairo_t       *cr,
+                      const guint64 *edges,
+                      gsize          words,
+                      gint           y)
+{
+  gint limit;
+  gint start;
+  gint x;
+
+  limit = words * 64;
+  x = 0;
+
+  while (x < limit)
+    {
+      if (x % 64 == 0 && edges[x / 64] == 0)
+        {
+          x += 64;
+          continue;
+        }
+
+      if (!is_bit_set (edges, x))
+        {
+          x++;
+          continue;
+        }
+
+      start = x;
+
+      while (x < limit && is_bit_set (edges, x))
+        x++;
+
+      cairo_move_to (cr, start, y);
+      cairo_line_to (cr, x, y);
+    }
+}
+
+/**
+ * Sets bit x of transitions when pixel x of row differs from pixel x - 1, for
+ * x from 0 to the width included. Pixels outside the row are not selected.
+ */
+static void
+get_transitions (const guint64 *row,
+                 gsize          words_per_row,
+                 guint64       *transitions,
+                 gsize          transition_words)
+{
+  guint64 previous;
+  guint64 word;
+
+  previous = 0;
+
+  for (gsize i = 0; i < transition_words; i++)
+    {
+      word = row != NULL && i < words_per_row ? row[i] : 0;
+      transitions[i] = word ^ (word << 1 | previous >> 63);
+      previous = word;
+    }
+}
+
+/**
+ * Traces the borders between selected and unselected pixels, as the longest
+ * horizontal and vertical lines. Vertical lines are started and ended where the
+ * transitions of a row differ from the ones of the row above, so rows are only
+ * compared a word at a time.
+ */
+static cairo_path_t *
+trace_outline (SelectionMask *self)
+{
+  cairo_surface_t *surface;
+  cairo_t *cr;
+  cairo_path_t *path;
+  guint64 *edges;
+  guint64 *transitions;
+  guint64 *previous_transitions;
+  guint64 *swap;
+  const guint64 *row;
+  const guint64 *above;
+  gint *line_starts;
+  gsize transition_words;
+  gint width;
+  gint x;
+
+  width = self->area.width;
+  transition_words = width / 64 + 1;
+
+  edges = g_new (guint64, self->words_per_row);
+  transitions = g_new (guint64, transition_words);
+  previous_transitions = g_new0 (guint64, transition_words);
+  line_starts = g_new (gint, width + 1);
+
+  // Only the path is wanted, the surface is never drawn to
+  surface = cairo_image_surface_create (CAIRO_FORMAT_A8, 1, 1);
+  cr = cairo_create (surface);
+
+  for (gint y = 0; y <= self->area.height; y++)
+    {
+      row = y < self->area.height ? self->bits + y * self->words_per_row : NULL;
+      above = y > 0 ? self->bits + (y - 1) * self->words_per_row : NULL;
+
+      for (gsize i = 0; i < self->words_per_row; i++)
+        edges[i] = (row != NULL ? row[i] : 0) ^ (above != NULL ? above[i] : 0);
+
+      add_horizontal_edges (cr, edges, self->words_per_row, y);
+
+      get_transitions (row, self->words_per_row, transitions, transition_words);
+
+      for (gsize i = 0; i < transition_words; i++)
+        previous_transitions[i] ^= transitions[i];
+
+      // previous_transitions now has the vertical lines that start or end at y
+      for (x = 0; x <= width; x++)
+        {
+          if (x % 64 == 0 && previous_transitions[x / 64] == 0)
+            {
+              x += 63;
+              continue;
+            }
+
+          if (!is_bit_set (previous_transitions, x))
+            continue;
+
+          if (is_bit_set (transitions, x))
+            {
+              line_starts[x] = y;
+            }
+          else
+            {
+              cairo_move_to (cr, x, line_starts[x]);
+              cairo_line_to (cr, x, y);
+            }
+        }
+
+      swap = previous_transitions;
+      previous_transitions = transitions;
+      transitions = swap;
+    }
+
+  path = cairo_copy_path (cr);
+
+  cairo_destroy (cr);
+  cairo_surface_destroy (surface);
+  g_free (edges);
+  g_free (transitions);
+  g_free (previous_transitions);
+  g_free (line_starts);
+
+  return path;
+}
+
+/**
+ * Adds the outline of the selected pixels to the path of cr, with the top left
+ * corner of the mask at (x, y).
+ */
+void
+selection_mask_append_outline (SelectionMask *self,
+                               cairo_t       *cr,
+                               gdouble        x,
+                               gdouble        y)
+{
+  if (self->outline == NULL)
+    self->outline = trace_outline (self);
+
+  cairo_save (cr);
+  cairo_translate (cr, x, y);
+  cairo_append_path (cr, self->outline);
+  cairo_restore (cr);
+}
@@ -0,0 +1,55 @@
+/* selection-mask.h
+ *
+ * Copyright 2023 Rami Alkawadri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+#include "utils/point.h"
+
+/* A selection of any shape, one bit per selected pixel over the bounding box of
+ * the selection. The outline is traced the first time it is needed and kept,
+ * drawing it again is only a copy of the path. */
+struct _SelectionMask;
+
+typedef struct _SelectionMask SelectionMask;
+
+SelectionMask   *selection_mask_new_from_bits    (const guint64     *bits,
+                                                  gsize              words_per_row,
+                                                  GdkRectangle      *area);
+SelectionMask   *selection_mask_new_from_polygon (const Point       *points,
+                                                  guint              count,
+                                                  cairo_fill_rule_t  fill_rule,
+                                                  GdkRectangle      *bounds);
+void             selection_mask_dispose          (SelectionMask     *self);
+
+GdkRectangle     selection_mask_get_area         (SelectionMask     *self);
+void             selection_mask_move_to          (SelectionMask     *self,
+                                                  gint               x,
+                                                  gint               y);
+gboolean         selection_mask_contains         (SelectionMask     *self,
+                                                  gint               x,
+                                                  gint               y);
+
+cairo_surface_t *selection_mask_to_surface       (SelectionMask     *self);
+void             selection_mask_append_outline   (SelectionMask     *self,
+                                                  cairo_t           *cr,
+                                                  gdouble            x,
+                                                  gdouble            y);
@@ -0,0 +1,215 @@
+/* spill-file.c
+ *
+ * Copyright 2023 Rami Alkawadri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "utils/spill-file.h"
+
+struct _SpillFile {
+  gint    fd;
+  goffset length;
+
+  /* Bytes that were written and not discarded yet */
+  goffset live_length;
+};
+
+typedef struct _SpillFileMapping {
+  gpointer address;
+  gsize    length;
+} SpillFileMapping;
+
+static const cairo_user_data_key_t MAPPING_KEY;
+
+static void
+unmap (gpointer data)
+{
+  SpillFileMapping *mapping = data;
+
+  munmap (mapping->address, mapping->length);
+  g_free (mapping);
+}
+
+/**
+ * Creates the file in directory, or in the temporary directory if it is NULL or
+ * empty. The file is unlinked right away so it goes away with the process.
+ * Returns NULL if the file could not be created.
+ */
+SpillFile *
+spill_file_new (const gchar *directory)
+{
+  SpillFile *obj;
+  g_autofree gchar *path;
+  gint fd;
+
+  if (directory == NULL || directory[0] == '\0')
+    directory = g_get_tmp_dir ();
+
+  path = g_build_filename (directory, "paint-undo-XXXXXX", NULL);
+  fd = g_mkstemp (path);
+
+  if (fd == -1)
+    {
+      g_message ("Error creating undo history file in %s: %s", directory, g_strerror (errno));
+      return NULL;
+    }
+
+  g_unlink (path);
+
+  obj = g_malloc (sizeof (SpillFile));
+  obj->fd = fd;
+  obj->length = 0;
+  obj->live_length = 0;
+  return obj;
+}
+
+void
+spill_file_dispose (SpillFile *self)
+{
+  close (self->fd);
+  g_free (self);
+}
+
+/**
+ * Appends the pixels of the image surface to the file and sets offset to where
+ * they start. Writes are sequential so reading back in reverse order stays
+ * friendly to the page cache.
+ */
+gboolean
+spill_file_write_surface (SpillFile       *self,
+                          cairo_surface_t *surface,
+                          goffset         *offset)
+{
+  const guchar *data;
+  gsize length;
+  gsize written;
+  gssize result;
+
+  cairo_surface_flush (surface);
+  data = cairo_image_surface_get_data (surface);
+  length = (gsize) cairo_image_surface_get_stride (surface) * cairo_image_surface_get_height (surface);
+  written = 0;
+
+  while (written < length)
+    {
+      result = pwrite (self->fd, data + written, length - written, self->length + written);
+
+      if (result == -1 && errno == EINTR)
+        continue;
+
+      if (result == -1)
+        {
+          g_message ("Error writing undo history file: %s", g_strerror (errno));
+          return false;
+        }
+
+      written += result;
+    }
+
+  *offset = self->length;
+  self->length += length;
+  self->live_length += length;
+
+  return true;
+}
+
+/**
+ * Returns a read only RGB24 surface on the pixels written at offset, the mapping
+ * lives as long as the surface.
+ */
+cairo_surface_t *
+spill_file_map_surface (SpillFile *self,
+                        goffset    offset,
+                        gint       width,
+                        gint       height)
+{
+  cairo_surface_t *surface;
+  SpillFileMapping *mapping;
+  goffset page_offset;
+  gint stride;
+
+  stride = cairo_format_stride_for_width (CAIRO_FORMAT_RGB24, width);
+
+  // Mappings have to start at a page boundary
+  page_offset = offset - offset % sysconf (_SC_PAGESIZE);
+
+  mapping = g_malloc (sizeof (SpillFileMapping));
+  mapping->length = offset - page_offset + (gsize) stride * height;
+  mapping->address = mmap (NULL, mapping->length, PROT_READ, MAP_SHARED, self->fd, page_offset);
+
+  if (mapping->address == MAP_FAILED)
+    {
+      g_message ("Error reading undo history file: %s", g_strerror (errno));
+      g_free (mapping);
+      return NULL;
+    }
+
+  surface = cairo_image_surface_create_for_data ((guchar *) mapping->address + (offset - page_offset),
+                                                 CAIRO_FORMAT_RGB24,
+                                                 width,
+                                                 height,
+                                                 stride);
+  cairo_surface_set_user_data (surface, &MAPPING_KEY, mapping, unmap);
+
+  return surface;
+}
+
+/**
+ * Forgets the bytes written at offset. The file is truncated when they are at
+ * its end, so discarding in the reverse order of the writes gives all the space
+ * back.
+ */
+void
+spill_file_discard (SpillFile *self,
+                    goffset    offset,
+                    gsize      length)
+{
+  self->live_length -= length;
+
+  if (offset + (goffset) length != self->length)
+    return;
+
+  if (ftruncate (self->fd, offset) == -1)
+    {
+      g_message ("Error truncating undo history file: %s", g_strerror (errno));
+      return;
+    }
+
+  self->length = offset;
+}
+
+/**
+ * Returns the length of the file, including the bytes that were discarded but
+ * could not be given back.
+ */
+goffset
+spill_file_get_length (SpillFile *self)
+{
+  return self->length;
+}
+
+goffset
+spill_file_get_live_length (SpillFile *self)
+{
+  return self->live_length;
+}
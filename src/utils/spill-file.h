@@ -0,0 +1,47 @@
+/* spill-file.h
+ *
+ * Copyright 2023 Rami Alkawadri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+/* An unlinked temporary file that image surfaces are written to so they do not
+ * stay in memory, they are memory mapped back when needed. Surfaces that are not
+ * needed anymore are discarded, the file only shrinks when they were at its end. */
+struct _SpillFile;
+
+typedef struct _SpillFile SpillFile;
+
+SpillFile       *spill_file_new           (const gchar     *directory);
+void             spill_file_dispose       (SpillFile       *self);
+
+gboolean         spill_file_write_surface (SpillFile       *self,
+                                           cairo_surface_t *surface,
+                                           goffset         *offset);
+cairo_surface_t *spill_file_map_surface   (SpillFile       *self,
+                                           goffset          offset,
+                                           gint             width,
+                                           gint             height);
+void             spill_file_discard       (SpillFile       *self,
+                                           goffset          offset,
+                                           gsize            length);
+
+goffset          spill_file_get_length      (SpillFile       *self);
+goffset          spill_file_get_live_length (SpillFile       *self);
@@ -0,0 +1,882 @@
+/* tile-store.c
+ *
+ * Copyright 2023 Rami Alkawadri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "utils/cairo-utils.h"
+#include "utils/pixel-kernels.h"
+#include "utils/tile-store.h"
+
+struct _TileStore {
+  gint              width;
+  gint              height;
+  gint              columns;
+  gint              rows;
+  cairo_surface_t **tiles;
+
+  /* Change tracking, NULL when there is no change in progress */
+  cairo_surface_t **original_tiles;
+  gboolean         *is_tile_modified;
+};
+
+static const gsize TILE_BYTES = TILE_SIZE * TILE_SIZE * 4;
+static const guint32 WHITE_PIXEL = 0xffffffff;
+
+static gint
+get_tile_count_for_length (gint length)
+{
+  return (length + TILE_SIZE - 1) / TILE_SIZE;
+}
+
+static void
+whiten_tile_rectangle (cairo_surface_t *tile,
+                       GdkRectangle    *rect)
+{
+  guchar *data;
+  gint stride;
+
+  cairo_surface_flush (tile);
+  data = cairo_image_surface_get_data (tile);
+  stride = cairo_image_surface_get_stride (tile);
+
+  for (gint y = rect->y; y < rect->y + rect->height; y++)
+    pixel_fill_span ((guint32 *) (data + y * stride) + rect->x, rect->width, WHITE_PIXEL);
+
+  cairo_surface_mark_dirty_rectangle (tile, rect->x, rect->y, rect->width, rect->height);
+}
+
+static cairo_surface_t *
+create_blank_tile (void)
+{
+  cairo_surface_t *tile;
+  GdkRectangle whole_tile = { 0, 0, TILE_SIZE, TILE_SIZE };
+
+  tile = cairo_image_surface_create (CAIRO_FORMAT_RGB24, TILE_SIZE, TILE_SIZE);
+  whiten_tile_rectangle (tile, &whole_tile);
+
+  return tile;
+}
+
+static void
+get_tile_rectangle (gint          column,
+                    gint          row,
+                    GdkRectangle *rect)
+{
+  rect->x = column * TILE_SIZE;
+  rect->y = row * TILE_SIZE;
+  rect->width = TILE_SIZE;
+  rect->height = TILE_SIZE;
+}
+
+/**
+ * Clips the area to the store and finds the tiles it covers, returns false if
+ * the area is completely outside the store.
+ */
+static gboolean
+get_tile_range (TileStore    *self,
+                GdkRectangle *area,
+                GdkRectangle *clipped_area,
+                gint         *first_column,
+                gint         *first_row,
+                gint         *last_column,
+                gint         *last_row)
+{
+  GdkRectangle bounds = { 0, 0, self->width, self->height };
+
+  if (!gdk_rectangle_intersect (area, &bounds, clipped_area))
+    return false;
+
+  *first_column = clipped_area->x / TILE_SIZE;
+  *first_row = clipped_area->y / TILE_SIZE;
+  *last_column = (clipped_area->x + clipped_area->width - 1) / TILE_SIZE;
+  *last_row = (clipped_area->y + clipped_area->height - 1) / TILE_SIZE;
+
+  return true;
+}
+
+/**
+ * Makes sure that no other store is using the tile at index, a shared tile is
+ * replaced by a copy of it. Returns the number of bytes copied.
+ */
+static gsize
+unshare_tile (TileStore *self,
+              gint       index)
+{
+  cairo_surface_t *copy;
+
+  if (self->tiles[index] == NULL || cairo_surface_get_reference_count (self->tiles[index]) == 1)
+    return 0;
+
+  copy = cairo_clone_surface (self->tiles[index]);
+  cairo_surface_destroy (self->tiles[index]);
+  self->tiles[index] = copy;
+
+  return TILE_BYTES;
+}
+
+/**
+ * Returns the tile at index ready to be drawn on, blank tiles get allocated and
+ * the original tile is kept if there is a change in progress.
+ */
+static cairo_surface_t *
+get_tile_for_writing (TileStore *self,
+                      gint       index,
+                      gsize     *bytes_copied)
+{
+  if (self->is_tile_modified != NULL && !self->is_tile_modified[index])
+    {
+      self->is_tile_modified[index] = true;
+
+      if (self->tiles[index] != NULL)
+        self->original_tiles[index] = cairo_surface_reference (self->tiles[index]);
+    }
+
+  if (self->tiles[index] == NULL)
+    self->tiles[index] = create_blank_tile ();
+  else
+    *bytes_copied += unshare_tile (self, index);
+
+  return self->tiles[index];
+}
+
+/**
+ * Returns the pixel composited on a white background, the pixel is premultiplied.
+ */
+static guint32
+composite_over_white (guint32 pixel)
+{
+  guint32 alpha;
+  guint32 result;
+
+  alpha = pixel >> 24;
+
+  if (alpha == 0xff)
+    return pixel;
+
+  result = 0xff000000;
+
+  for (gint shift = 0; shift < 24; shift += 8)
+    result |= MIN (((pixel >> shift) & 0xff) + 0xff - alpha, 0xff) << shift;
+
+  return result;
+}
+
+TileStore *
+tile_store_new (gint width,
+                gint height)
+{
+  TileStore *obj = g_malloc (sizeof (TileStore));
+  obj->width = width;
+  obj->height = height;
+  obj->columns = get_tile_count_for_length (width);
+  obj->rows = get_tile_count_for_length (height);
+  obj->tiles = g_malloc0_n (obj->columns * obj->rows, sizeof (cairo_surface_t *));
+  obj->original_tiles = NULL;
+  obj->is_tile_modified = NULL;
+  return obj;
+}
+
+/**
+ * Creates a store from the texture pixels, transparent pixels are put on a white
+ * background and tiles that end up completely white are not allocated.
+ */
+TileStore *
+tile_store_new_from_texture (GdkTexture *texture)
+{
+  TileStore *obj;
+  guchar *pixels;
+  gsize stride;
+  GdkRectangle tile_rect;
+  GdkRectangle part;
+  GdkRectangle bounds;
+  cairo_surface_t *tile;
+  guchar *tile_pixels;
+  gint tile_stride;
+  gboolean is_blank;
+
+  obj = tile_store_new (gdk_texture_get_width (texture), gdk_texture_get_height (texture));
+  bounds.x = 0;
+  bounds.y = 0;
+  bounds.width = obj->width;
+  bounds.height = obj->height;
+
+  stride = (gsize) obj->width * 4;
+  pixels = g_malloc (stride * obj->height);
+  gdk_texture_download (texture, pixels, stride);
+
+  for (gint row = 0; row < obj->rows; row++)
+    {
+      for (gint column = 0; column < obj->columns; column++)
+        {
+          get_tile_rectangle (column, row, &tile_rect);
+          gdk_rectangle_intersect (&tile_rect, &bounds, &part);
+
+          tile = create_blank_tile ();
+          cairo_surface_flush (tile);
+          tile_pixels = cairo_image_surface_get_data (tile);
+          tile_stride = cairo_image_surface_get_stride (tile);
+          is_blank = true;
+
+          for (gint y = 0; y < part.height; y++)
+            {
+              guint32 *src = (guint32 *) (pixels + (part.y + y) * stride) + part.x;
+              guint32 *dst = (guint32 *) (tile_pixels + y * tile_stride);
+
+              for (gint x = 0; x < part.width; x++)
+                {
+                  dst[x] = composite_over_white (src[x]);
+                  is_blank = is_blank && (dst[x] & 0xffffff) == 0xffffff;
+                }
+            }
+
+          if (is_blank)
+            {
+              cairo_surface_destroy (tile);
+              continue;
+            }
+
+          cairo_surface_mark_dirty (tile);
+          obj->tiles[row * obj->columns + column] = tile;
+        }
+    }
+
+  g_free (pixels);
+
+  return obj;
+}
+
+/**
+ * Returns a store that shares all the tiles with this one, no pixels are copied.
+ */
+TileStore *
+tile_store_copy (TileStore *self)
+{
+  TileStore *obj;
+
+  obj = tile_store_new (self->width, self->height);
+
+  for (gint i = 0; i < self->columns * self->rows; i++)
+    {
+      if (self->tiles[i] != NULL)
+        obj->tiles[i] = cairo_surface_reference (self->tiles[i]);
+    }
+
+  return obj;
+}
+
+/**
+ * Returns a store that shares the tiles as they were when the change in progress
+ * started, no pixels are copied.
+ */
+TileStore *
+tile_store_copy_original (TileStore *self)
+{
+  TileStore *obj;
+
+  g_return_val_if_fail (self->is_tile_modified != NULL, NULL);
+
+  obj = tile_store_new (self->width, self->height);
+
+  for (gint i = 0; i < self->columns * self->rows; i++)
+    {
+      if (self->is_tile_modified[i])
+        obj->tiles[i] = self->original_tiles[i];
+      else
+        obj->tiles[i] = self->tiles[i];
+
+      if (obj->tiles[i] != NULL)
+        cairo_surface_reference (obj->tiles[i]);
+    }
+
+  return obj;
+}
+
+void
+tile_store_dispose (TileStore *self)
+{
+  if (self->is_tile_modified != NULL)
+    tile_store_end_change (self);
+
+  for (gint i = 0; i < self->columns * self->rows; i++)
+    {
+      if (self->tiles[i] != NULL)
+        cairo_surface_destroy (self->tiles[i]);
+    }
+
+  g_free (self->tiles);
+  g_free (self);
+}
+
+gint
+tile_store_get_width (TileStore *self)
+{
+  return self->width;
+}
+
+gint
+tile_store_get_height (TileStore *self)
+{
+  return self->height;
+}
+
+/**
+ * Returns the size of the tiles used by this store, including the shared ones.
+ */
+gsize
+tile_store_get_allocated_size (TileStore *self)
+{
+  gsize size = 0;
+
+  for (gint i = 0; i < self->columns * self->rows; i++)
+    {
+      if (self->tiles[i] != NULL)
+        size += TILE_BYTES;
+
+      if (self->original_tiles != NULL && self->original_tiles[i] != NULL)
+        size += TILE_BYTES;
+    }
+
+  return size;
+}
+
+/**
+ * Returns the size of the tiles of self that other does not share, other can be
+ * NULL to count all of them.
+ */
+gsize
+tile_store_get_unshared_size (TileStore *self,
+                              TileStore *other)
+{
+  gsize size = 0;
+  gint index;
+
+  for (gint row = 0; row < self->rows; row++)
+    {
+      for (gint column = 0; column < self->columns; column++)
+        {
+          index = row * self->columns + column;
+
+          if (self->tiles[index] == NULL)
+            continue;
+
+          if (other != NULL && row < other->rows && column < other->columns &&
+              other->tiles[row * other->columns + column] == self->tiles[index])
+            continue;
+
+          size += TILE_BYTES;
+        }
+    }
+
+  return size;
+}
+
+/**
+ * Tiles outside the new size are freed, and the parts of the edge tiles that are
+ * outside of it are whitened so they are blank if the store grows again.
+ */
+void
+tile_store_resize (TileStore *self,
+                   gint       width,
+                   gint       height)
+{
+  cairo_surface_t **tiles;
+  GdkRectangle outside;
+  gint columns;
+  gint rows;
+  gint index;
+
+  g_return_if_fail (self->is_tile_modified == NULL);
+
+  columns = get_tile_count_for_length (width);
+  rows = get_tile_count_for_length (height);
+  tiles = g_malloc0_n (columns * rows, sizeof (cairo_surface_t *));
+
+  for (gint row = 0; row < self->rows; row++)
+    {
+      for (gint column = 0; column < self->columns; column++)
+        {
+          index = row * self->columns + column;
+
+          if (self->tiles[index] == NULL)
+            continue;
+
+          if (row < rows && column < columns)
+            tiles[row * columns + column] = self->tiles[index];
+          else
+            cairo_surface_destroy (self->tiles[index]);
+        }
+    }
+
+  g_free (self->tiles);
+  self->tiles = tiles;
+  self->width = width;
+  self->height = height;
+  self->columns = columns;
+  self->rows = rows;
+
+  for (gint row = 0; row < rows; row++)
+    {
+      index = row * columns + columns - 1;
+
+      outside.x = width - (columns - 1) * TILE_SIZE;
+      outside.y = 0;
+      outside.width = TILE_SIZE - outside.x;
+      outside.height = TILE_SIZE;
+
+      if (tiles[index] != NULL && outside.width > 0)
+        {
+          unshare_tile (self, index);
+          whiten_tile_rectangle (tiles[index], &outside);
+        }
+    }
+
+  for (gint column = 0; column < columns; column++)
+    {
+      index = (rows - 1) * columns + column;
+
+      outside.x = 0;
+      outside.y = height - (rows - 1) * TILE_SIZE;
+      outside.width = TILE_SIZE;
+      outside.height = TILE_SIZE - outside.y;
+
+      if (tiles[index] != NULL && outside.height > 0)
+        {
+          unshare_tile (self, index);
+          whiten_tile_rectangle (tiles[index], &outside);
+        }
+    }
+}
+
+/**
+ * Paints the part of the store inside area on cr, using the store coordinates.
+ * The tiles modified by the change in progress are painted as they were when it
+ * started if use_original_tiles is true.
+ */
+static void
+paint_tiles_to (TileStore    *self,
+                cairo_t      *cr,
+                GdkRectangle *area,
+                gboolean      use_original_tiles)
+{
+  GdkRectangle clipped_area;
+  GdkRectangle tile_rect;
+  GdkRectangle part;
+  cairo_surface_t *tile;
+  gint first_column;
+  gint first_row;
+  gint last_column;
+  gint last_row;
+  gint index;
+
+  if (!get_tile_range (self, area, &clipped_area,
+                       &first_column, &first_row, &last_column, &last_row))
+    return;
+
+  cairo_save (cr);
+
+  for (gint row = first_row; row <= last_row; row++)
+    {
+      for (gint column = first_column; column <= last_column; column++)
+        {
+          get_tile_rectangle (column, row, &tile_rect);
+          gdk_rectangle_intersect (&tile_rect, &clipped_area, &part);
+          index = row * self->columns + column;
+
+          if (use_original_tiles && self->is_tile_modified[index])
+            tile = self->original_tiles[index];
+          else
+            tile = self->tiles[index];
+
+          if (tile == NULL)
+            cairo_set_source_rgb (cr, 1, 1, 1);
+          else
+            cairo_set_source_surface (cr, tile, tile_rect.x, tile_rect.y);
+
+          gdk_cairo_rectangle (cr, &part);
+          cairo_fill (cr);
+        }
+    }
+
+  cairo_restore (cr);
+}
+
+void
+tile_store_paint_to (TileStore    *self,
+                     cairo_t      *cr,
+                     GdkRectangle *area)
+{
+  paint_tiles_to (self, cr, area, false);
+}
+
+/**
+ * Paints the part of source inside area on the store, source uses the store
+ * coordinates. Returns the number of bytes copied to keep the original tiles.
+ */
+gsize
+tile_store_paint_surface (TileStore       *self,
+                          cairo_surface_t *source,
+                          GdkRectangle    *area)
+{
+  GdkRectangle clipped_area;
+  GdkRectangle tile_rect;
+  GdkRectangle part;
+  cairo_surface_t *tile;
+  cairo_t *cr;
+  gsize bytes_copied;
+  gint first_column;
+  gint first_row;
+  gint last_column;
+  gint last_row;
+
+  bytes_copied = 0;
+
+  if (!get_tile_range (self, area, &clipped_area,
+                       &first_column, &first_row, &last_column, &last_row))
+    return bytes_copied;
+
+  for (gint row = first_row; row <= last_row; row++)
+    {
+      for (gint column = first_column; column <= last_column; column++)
+        {
+          get_tile_rectangle (column, row, &tile_rect);
+          gdk_rectangle_intersect (&tile_rect, &clipped_area, &part);
+          tile = get_tile_for_writing (self, row * self->columns + column, &bytes_copied);
+
+          cr = cairo_create (tile);
+          cairo_translate (cr, -tile_rect.x, -tile_rect.y);
+          gdk_cairo_rectangle (cr, &part);
+          cairo_clip (cr);
+          cairo_set_source_surface (cr, source, 0, 0);
+          cairo_paint (cr);
+          cairo_destroy (cr);
+        }
+    }
+
+  return bytes_copied;
+}
+
+/**
+ * Blends color into the store through mask, an A8 surface whose top left
+ * corner is at the top left corner of area. The color is blended by the amount
+ * of the mask times its alpha. Returns the number of bytes copied to keep the
+ * original tiles.
+ */
+gsize
+tile_store_blend_mask (TileStore       *self,
+                       cairo_surface_t *mask,
+                       GdkRectangle    *area,
+                       const GdkRGBA   *color)
+{
+  GdkRectangle clipped_area;
+  GdkRectangle tile_rect;
+  GdkRectangle part;
+  cairo_surface_t *tile;
+  guint8 scaled_amounts[TILE_SIZE];
+  const guint8 *amounts;
+  guchar *mask_data;
+  guchar *tile_data;
+  guint32 pixel;
+  guint32 opacity;
+  gsize bytes_copied;
+  gint mask_stride;
+  gint tile_stride;
+  gint first_column;
+  gint first_row;
+  gint last_column;
+  gint last_row;
+
+  bytes_copied = 0;
+
+  if (!get_tile_range (self, area, &clipped_area,
+                       &first_column, &first_row, &last_column, &last_row))
+    return bytes_copied;
+
+  pixel = 0xff000000 |
+          (guint32) (color->red * 255 + 0.5) << 16 |
+          (guint32) (color->green * 255 + 0.5) << 8 |
+          (guint32) (color->blue * 255 + 0.5);
+  opacity = color->alpha * 255 + 0.5;
+
+  cairo_surface_flush (mask);
+  mask_data = cairo_image_surface_get_data (mask);
+  mask_stride = cairo_image_surface_get_stride (mask);
+
+  for (gint row = first_row; row <= last_row; row++)
+    {
+      for (gint column = first_column; column <= last_column; column++)
+        {
+          get_tile_rectangle (column, row, &tile_rect);
+          gdk_rectangle_intersect (&tile_rect, &clipped_area, &part);
+          tile = get_tile_for_writing (self, row * self->columns + column, &bytes_copied);
+
+          cairo_surface_flush (tile);
+          tile_data = cairo_image_surface_get_data (tile);
+          tile_stride = cairo_image_surface_get_stride (tile);
+
+          for (gint y = part.y; y < part.y + part.height; y++)
+            {
+              amounts = mask_data + (y - area->y) * mask_stride + part.x - area->x;
+
+              if (opacity < 255)
+                {
+                  for (gint x = 0; x < part.width; x++)
+                    scaled_amounts[x] = (amounts[x] * opacity + 127) / 255;
+
+                  amounts = scaled_amounts;
+                }
+
+              pixel_blend_color ((guint32 *) (tile_data + (y - tile_rect.y) * tile_stride) +
+                                 part.x - tile_rect.x,
+                                 amounts, part.width, pixel);
+            }
+
+          cairo_surface_mark_dirty_rectangle (tile,
+                                              part.x - tile_rect.x, part.y - tile_rect.y,
+                                              part.width, part.height);
+        }
+    }
+
+  return bytes_copied;
+}
+
+static cairo_surface_t *
+flatten_tiles (TileStore    *self,
+               GdkRectangle *area,
+               gboolean      use_original_tiles)
+{
+  cairo_surface_t *surface;
+  cairo_t *cr;
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_RGB24, area->width, area->height);
+
+  // The store can be bigger than the biggest image surface
+  if (cairo_surface_status (surface) != CAIRO_STATUS_SUCCESS)
+    {
+      cairo_surface_destroy (surface);
+      return NULL;
+    }
+
+  cairo_whiten_surface (surface);
+
+  cr = cairo_create (surface);
+  cairo_translate (cr, -area->x, -area->y);
+  paint_tiles_to (self, cr, area, use_original_tiles);
+  cairo_destroy (cr);
+
+  return surface;
+}
+
+/**
+ * Returns a new image surface with the pixels inside area, or NULL if area is
+ * too big for an image surface.
+ */
+cairo_surface_t *
+tile_store_flatten (TileStore    *self,
+                    GdkRectangle *area)
+{
+  return flatten_tiles (self, area, false);
+}
+
+/**
+ * Returns a new image surface with the pixels inside area as they were when the
+ * change in progress started, or NULL if area is too big for an image surface.
+ */
+cairo_surface_t *
+tile_store_flatten_original (TileStore    *self,
+                             GdkRectangle *area)
+{
+  g_return_val_if_fail (self->is_tile_modified != NULL, NULL);
+
+  return flatten_tiles (self, area, true);
+}
+
+/**
+ * Returns a texture with all the pixels of the store, unlike cairo surfaces
+ * textures are not limited in size.
+ */
+GdkTexture *
+tile_store_to_texture (TileStore *self)
+{
+  GdkTexture *texture;
+  GBytes *bytes;
+  guchar *pixels;
+  gsize stride;
+  GdkRectangle bounds = { 0, 0, self->width, self->height };
+  GdkRectangle tile_rect;
+  GdkRectangle part;
+  cairo_surface_t *tile;
+  guchar *tile_pixels;
+  gint tile_stride;
+
+  tile_pixels = NULL;
+  tile_stride = 0;
+  stride = (gsize) self->width * 4;
+  pixels = g_malloc (stride * self->height);
+
+  for (gint row = 0; row < self->rows; row++)
+    {
+      for (gint column = 0; column < self->columns; column++)
+        {
+          get_tile_rectangle (column, row, &tile_rect);
+          gdk_rectangle_intersect (&tile_rect, &bounds, &part);
+          tile = self->tiles[row * self->columns + column];
+
+          if (tile != NULL)
+            {
+              cairo_surface_flush (tile);
+              tile_pixels = cairo_image_surface_get_data (tile);
+              tile_stride = cairo_image_surface_get_stride (tile);
+            }
+
+          for (gint y = 0; y < part.height; y++)
+            {
+              guint32 *dst = (guint32 *) (pixels + (part.y + y) * stride) + part.x;
+
+              if (tile == NULL)
+                {
+                  memset (dst, 0xff, part.width * 4);
+                  continue;
+                }
+
+              memcpy (dst, tile_pixels + y * tile_stride, part.width * 4);
+
+              // The unused byte of RGB24 pixels is not guaranteed to be opaque
+              for (gint x = 0; x < part.width; x++)
+                dst[x] |= 0xff000000;
+            }
+        }
+    }
+
+  bytes = g_bytes_new_take (pixels, stride * self->height);
+  texture = gdk_memory_texture_new (self->width, self->height, GDK_MEMORY_DEFAULT, bytes, stride);
+  g_bytes_unref (bytes);
+
+  return texture;
+}
+
+void
+tile_store_begin_change (TileStore *self)
+{
+  g_return_if_fail (self->is_tile_modified == NULL);
+
+  self->original_tiles = g_malloc0_n (self->columns * self->rows, sizeof (cairo_surface_t *));
+  self->is_tile_modified = g_malloc0_n (self->columns * self->rows, sizeof (gboolean));
+}
+
+gboolean
+tile_store_is_changing (TileStore *self)
+{
+  return self->is_tile_modified != NULL;
+}
+
+/**
+ * Brings back the pixels inside area to how they were when the change started.
+ * Returns the number of bytes copied.
+ */
+gsize
+tile_store_restore_rectangle (TileStore    *self,
+                              GdkRectangle *area)
+{
+  GdkRectangle clipped_area;
+  GdkRectangle tile_rect;
+  GdkRectangle part;
+  gsize bytes_copied;
+  gint first_column;
+  gint first_row;
+  gint last_column;
+  gint last_row;
+  gint index;
+
+  bytes_copied = 0;
+
+  if (self->is_tile_modified == NULL ||
+      !get_tile_range (self, area, &clipped_area,
+                       &first_column, &first_row, &last_column, &last_row))
+    return bytes_copied;
+
+  for (gint row = first_row; row <= last_row; row++)
+    {
+      for (gint column = first_column; column <= last_column; column++)
+        {
+          index = row * self->columns + column;
+
+          if (!self->is_tile_modified[index])
+            continue;
+
+          get_tile_rectangle (column, row, &tile_rect);
+          gdk_rectangle_intersect (&tile_rect, &clipped_area, &part);
+
+          // Tile coordinates
+          part.x -= tile_rect.x;
+          part.y -= tile_rect.y;
+
+          if (self->original_tiles[index] == NULL)
+            {
+              whiten_tile_rectangle (self->tiles[index], &part);
+              bytes_copied += part.width * part.height * 4;
+            }
+          else
+            {
+              bytes_copied += cairo_copy_rectangle (self->original_tiles[index],
+                                                    self->tiles[index],
+                                                    &part);
+            }
+        }
+    }
+
+  return bytes_copied;
+}
+
+/**
+ * Keeps the changes and frees the original tiles.
+ */
+void
+tile_store_end_change (TileStore *self)
+{
+  g_return_if_fail (self->is_tile_modified != NULL);
+
+  for (gint i = 0; i < self->columns * self->rows; i++)
+    {
+      if (self->original_tiles[i] != NULL)
+        cairo_surface_destroy (self->original_tiles[i]);
+    }
+
+  g_clear_pointer (&self->original_tiles, g_free);
+  g_clear_pointer (&self->is_tile_modified, g_free);
+}
+
+/**
+ * Drops the changes and puts the original tiles back.
+ */
+void
+tile_store_cancel_change (TileStore *self)
+{
+  g_return_if_fail (self->is_tile_modified != NULL);
+
+  for (gint i = 0; i < self->columns * self->rows; i++)
+    {
+      if (!self->is_tile_modified[i])
+        continue;
+
+      cairo_surface_destroy (self->tiles[i]);
+      self->tiles[i] = self->original_tiles[i];
+      self->original_tiles[i] = NULL;
+    }
+
+  tile_store_end_change (self);
+}
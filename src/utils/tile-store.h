@@ -0,0 +1,75 @@
+/* tile-store.h
+ *
+ * Copyright 2023 Rami Alkawadri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+/* The image is split into square tiles that are only allocated once something
+ * is drawn on them, a missing tile is a blank (white) tile. Copies of a store
+ * share their tiles, a shared tile is only copied when it is drawn on. */
+#define TILE_SIZE 256
+
+struct _TileStore;
+
+typedef struct _TileStore TileStore;
+
+TileStore       *tile_store_new                (gint             width,
+                                                gint             height);
+TileStore       *tile_store_new_from_texture   (GdkTexture      *texture);
+TileStore       *tile_store_copy               (TileStore       *self);
+void             tile_store_dispose            (TileStore       *self);
+
+gint             tile_store_get_width          (TileStore       *self);
+gint             tile_store_get_height         (TileStore       *self);
+gsize            tile_store_get_allocated_size (TileStore       *self);
+gsize            tile_store_get_unshared_size  (TileStore       *self,
+                                                TileStore       *other);
+
+void             tile_store_resize             (TileStore       *self,
+                                                gint             width,
+                                                gint             height);
+
+void             tile_store_paint_to           (TileStore       *self,
+                                                cairo_t         *cr,
+                                                GdkRectangle    *area);
+gsize            tile_store_paint_surface      (TileStore       *self,
+                                                cairo_surface_t *source,
+                                                GdkRectangle    *area);
+gsize            tile_store_blend_mask         (TileStore       *self,
+                                                cairo_surface_t *mask,
+                                                GdkRectangle    *area,
+                                                const GdkRGBA   *color);
+
+cairo_surface_t *tile_store_flatten            (TileStore       *self,
+                                                GdkRectangle    *area);
+GdkTexture      *tile_store_to_texture         (TileStore       *self);
+
+/* Changes, the tiles keep a reference to their original the first time they are
+ * modified during a change so the modified areas can be restored */
+void             tile_store_begin_change       (TileStore       *self);
+gboolean         tile_store_is_changing        (TileStore       *self);
+gsize            tile_store_restore_rectangle  (TileStore       *self,
+                                                GdkRectangle    *area);
+cairo_surface_t *tile_store_flatten_original   (TileStore       *self,
+                                                GdkRectangle    *area);
+TileStore       *tile_store_copy_original      (TileStore       *self);
+void             tile_store_end_change         (TileStore       *self);
+void             tile_store_cancel_change      (TileStore       *self);
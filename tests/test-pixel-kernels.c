@@ -0,0 +1,383 @@
+/* test-pixel-kernels.c
+ *
+ * Copyright 2023 Rami Alkawadri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+
+/* The file is included to reach the scalar kernels and every SIMD version of
+ * them, not only the one the dispatch picked */
+#include "utils/pixel-kernels.c"
+
+#include <string.h>
+
+#define MAX_KERNELS 4
+#define MAX_LENGTH 67
+#define MAX_OFFSET 3
+#define ROUNDS 8
+
+/* Room for the offset before the span and a few guard values after it, so a
+ * kernel that writes outside its span changes the compared buffer */
+#define BUFFER_LENGTH (MAX_OFFSET + MAX_LENGTH + 8)
+
+static const PixelKernels *available_kernels[MAX_KERNELS];
+static guint available_count;
+
+/* The kernels the public functions dispatch to */
+static PixelKernels dispatched_kernels = {
+  NULL,
+  pixel_fill_span,
+  pixel_blend_coverage,
+  pixel_blend_color,
+  pixel_blend_span,
+  pixel_match_row,
+  pixel_replace_row,
+};
+
+static void
+add_available_kernels (void)
+{
+#if defined (__SSE2__)
+  available_kernels[available_count++] = &sse2_kernels;
+#endif
+
+#if defined (HAVE_AVX2_KERNELS)
+  if (__builtin_cpu_supports ("avx2"))
+    available_kernels[available_count++] = &avx2_kernels;
+#endif
+
+#if defined (__ARM_NEON) && defined (__aarch64__)
+  available_kernels[available_count++] = &neon_kernels;
+#endif
+
+#if !defined (__SSE2__) && !(defined (__ARM_NEON) && defined (__aarch64__))
+  available_kernels[available_count++] = &scalar_kernels;
+#endif
+
+  dispatched_kernels.name = pixel_kernels_get_name ();
+  available_kernels[available_count++] = &dispatched_kernels;
+}
+
+/**
+ * Returns a random byte, the ends of the range come up more often since the
+ * kernels special case them.
+ */
+static guint8
+get_random_byte (void)
+{
+  switch (g_test_rand_int_range (0, 4))
+    {
+    case 0:
+      return 0;
+    case 1:
+      return 255;
+    default:
+      return g_test_rand_int_range (0, 256);
+    }
+}
+
+static void
+fill_random_bytes (gpointer data,
+                   gsize    size)
+{
+  for (gsize i = 0; i < size; i++)
+    ((guint8 *) data)[i] = get_random_byte ();
+}
+
+/**
+ * Fills pixels with colors around target, within tolerance or just past it, so
+ * the match kernels find both matching pixels and pixels that do not match.
+ */
+static void
+fill_pixels_near (guint32 *pixels,
+                  gint     length,
+                  guint32  target,
+                  guint8   tolerance)
+{
+  gint channel;
+  gint difference;
+
+  fill_random_bytes (pixels, length * sizeof (guint32));
+
+  for (gint i = 0; i < length; i++)
+    {
+      // Some pixels stay random, the unused byte stays random in all of them
+      if (g_test_rand_int_range (0, 4) == 0)
+        continue;
+
+      for (gint shift = 0; shift < 24; shift += 8)
+        {
+          difference = g_test_rand_int_range (-tolerance - 2, tolerance + 3);
+          channel = CLAMP ((gint) ((target >> shift) & 0xff) + difference, 0, 255);
+          pixels[i] = (pixels[i] & ~(0xffu << shift)) | (guint32) channel << shift;
+        }
+    }
+}
+
+static void
+assert_same_bytes (const gchar   *kernel,
+                   const gchar   *backend,
+                   gint           length,
+                   gint           offset,
+                   gconstpointer  expected,
+                   gconstpointer  actual,
+                   gsize          size)
+{
+  if (memcmp (expected, actual, size) != 0)
+    g_error ("The %s kernel of %s differs from the scalar one for length %d at offset %d",
+             kernel, backend, length, offset);
+}
+
+static void
+test_selected_kernels (void)
+{
+  guint i;
+
+  // The dispatch picks one of the kernels this CPU can run
+  for (i = 0; i + 1 < available_count; i++)
+    {
+      if (g_str_equal (available_kernels[i]->name, pixel_kernels_get_name ()))
+        break;
+    }
+
+  g_assert_cmpuint (i + 1, <, available_count);
+}
+
+typedef void (*CheckKernel) (const PixelKernels *kernels,
+                             gint                length,
+                             gint                offset);
+
+/**
+ * Checks every available kernel on random data, for each length and start of
+ * the span.
+ */
+static void
+check_all_kernels (CheckKernel check)
+{
+  for (guint k = 0; k < available_count; k++)
+    {
+      for (gint length = 0; length <= MAX_LENGTH; length++)
+        {
+          for (gint offset = 0; offset <= MAX_OFFSET; offset++)
+            {
+              for (gint round = 0; round < ROUNDS; round++)
+                check (available_kernels[k], length, offset);
+            }
+        }
+    }
+}
+
+static void
+check_fill_span (const PixelKernels *kernels,
+                 gint                length,
+                 gint                offset)
+{
+  guint32 expected[BUFFER_LENGTH];
+  guint32 actual[BUFFER_LENGTH];
+  guint32 pixel;
+
+  fill_random_bytes (expected, sizeof (expected));
+  memcpy (actual, expected, sizeof (actual));
+  pixel = g_test_rand_int ();
+
+  fill_span_scalar (expected + offset, length, pixel);
+  kernels->fill_span (actual + offset, length, pixel);
+
+  assert_same_bytes ("fill span", kernels->name, length, offset,
+                     expected, actual, sizeof (actual));
+}
+
+static void
+check_blend_coverage (const PixelKernels *kernels,
+                      gint                length,
+                      gint                offset)
+{
+  guint8 expected[BUFFER_LENGTH];
+  guint8 actual[BUFFER_LENGTH];
+  guint8 source[BUFFER_LENGTH];
+
+  fill_random_bytes (expected, sizeof (expected));
+  memcpy (actual, expected, sizeof (actual));
+  fill_random_bytes (source, sizeof (source));
+
+  blend_coverage_scalar (expected + offset, source + offset, length);
+  kernels->blend_coverage (actual + offset, source + offset, length);
+
+  assert_same_bytes ("blend coverage", kernels->name, length, offset,
+                     expected, actual, sizeof (actual));
+}
+
+static void
+check_blend_color (const PixelKernels *kernels,
+                   gint                length,
+                   gint                offset)
+{
+  guint32 expected[BUFFER_LENGTH];
+  guint32 actual[BUFFER_LENGTH];
+  guint8 mask[BUFFER_LENGTH];
+  guint32 color;
+
+  fill_random_bytes (expected, sizeof (expected));
+  memcpy (actual, expected, sizeof (actual));
+  fill_random_bytes (mask, sizeof (mask));
+  fill_random_bytes (&color, sizeof (color));
+
+  blend_color_scalar (expected + offset, mask + offset, length, color);
+  kernels->blend_color (actual + offset, mask + offset, length, color);
+
+  assert_same_bytes ("blend color", kernels->name, length, offset,
+                     expected, actual, sizeof (actual));
+}
+
+static void
+check_blend_span (const PixelKernels *kernels,
+                  gint                length,
+                  gint                offset)
+{
+  guint32 expected[BUFFER_LENGTH];
+  guint32 actual[BUFFER_LENGTH];
+  guint32 color;
+  guint8 amount;
+
+  fill_random_bytes (expected, sizeof (expected));
+  memcpy (actual, expected, sizeof (actual));
+  fill_random_bytes (&color, sizeof (color));
+  amount = get_random_byte ();
+
+  blend_span_scalar (expected + offset, length, color, amount);
+  kernels->blend_span (actual + offset, length, color, amount);
+
+  assert_same_bytes ("blend span", kernels->name, length, offset,
+                     expected, actual, sizeof (actual));
+}
+
+static void
+check_match_row (const PixelKernels *kernels,
+                 gint                length,
+                 gint                offset)
+{
+  guint32 pixels[BUFFER_LENGTH];
+  guint64 expected[MAX_LENGTH / 64 + 2];
+  guint64 actual[MAX_LENGTH / 64 + 2];
+  guint32 target;
+  guint8 tolerance;
+
+  target = g_test_rand_int ();
+  tolerance = get_random_byte ();
+  fill_pixels_near (pixels, BUFFER_LENGTH, target, tolerance);
+  fill_random_bytes (expected, sizeof (expected));
+  memcpy (actual, expected, sizeof (actual));
+
+  match_row_scalar (pixels + offset, length, target, tolerance, expected);
+  kernels->match_row (pixels + offset, length, target, tolerance, actual);
+
+  assert_same_bytes ("match row", kernels->name, length, offset,
+                     expected, actual, sizeof (actual));
+}
+
+static void
+check_replace_row (const PixelKernels *kernels,
+                   gint                length,
+                   gint                offset)
+{
+  guint32 expected[BUFFER_LENGTH];
+  guint32 actual[BUFFER_LENGTH];
+  guint32 target;
+  guint32 replacement;
+  guint8 tolerance;
+  guint8 amount;
+  gboolean expected_result;
+  gboolean actual_result;
+  gint expected_ends[2];
+  gint actual_ends[2];
+
+  target = g_test_rand_int ();
+  replacement = g_test_rand_int ();
+  tolerance = get_random_byte ();
+  amount = get_random_byte ();
+  fill_pixels_near (expected, BUFFER_LENGTH, target, tolerance);
+  memcpy (actual, expected, sizeof (actual));
+
+  expected_result = replace_row_scalar (expected + offset, length, target, tolerance,
+                                        replacement, amount, &expected_ends[0], &expected_ends[1]);
+  actual_result = kernels->replace_row (actual + offset, length, target, tolerance,
+                                        replacement, amount, &actual_ends[0], &actual_ends[1]);
+
+  assert_same_bytes ("replace row", kernels->name, length, offset,
+                     expected, actual, sizeof (actual));
+  g_assert_cmpint (expected_result, ==, actual_result);
+
+  // The ends are only set when a pixel was replaced
+  if (expected_result)
+    assert_same_bytes ("replace row", kernels->name, length, offset,
+                       expected_ends, actual_ends, sizeof (actual_ends));
+}
+
+static void
+test_fill_span (void)
+{
+  check_all_kernels (check_fill_span);
+}
+
+static void
+test_blend_coverage (void)
+{
+  check_all_kernels (check_blend_coverage);
+}
+
+static void
+test_blend_color (void)
+{
+  check_all_kernels (check_blend_color);
+}
+
+static void
+test_blend_span (void)
+{
+  check_all_kernels (check_blend_span);
+}
+
+static void
+test_match_row (void)
+{
+  check_all_kernels (check_match_row);
+}
+
+static void
+test_replace_row (void)
+{
+  check_all_kernels (check_replace_row);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  add_available_kernels ();
+
+  g_test_add_func ("/pixel-kernels/selected", test_selected_kernels);
+  g_test_add_func ("/pixel-kernels/fill-span", test_fill_span);
+  g_test_add_func ("/pixel-kernels/blend-coverage", test_blend_coverage);
+  g_test_add_func ("/pixel-kernels/blend-color", test_blend_color);
+  g_test_add_func ("/pixel-kernels/blend-span", test_blend_span);
+  g_test_add_func ("/pixel-kernels/match-row", test_match_row);
+  g_test_add_func ("/pixel-kernels/replace-row", test_replace_row);
+
+  return g_test_run ();
+}